@@ -0,0 +1,102 @@
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "buffercache.h"
+
+
+void usage()
+{
+  cerr << "usage: benchbuffer filestem numops [maxcachesize [policy]]\n";
+}
+
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec*1e6+tv.tv_usec;
+}
+
+//
+// Sweeps the cache size and times random reads and writes against it
+//
+// The working set is twice the cache size, so about half of the
+// operations miss and evict whatever size the cache is.  If replacement
+// is constant time, the wall clock time per operation stays flat.
+// The writes put junk on the disk, so use a scratch one.
+//
+int main(int argc, char *argv[])
+{
+  if (argc<3) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T numops=atoi(argv[2]);
+  SIZE_T maxcachesize=(argc>3 ? atoi(argv[3]) : 1024*1024);
+  const char *policy=(argc>4 ? argv[4] : "lru");
+  ReplacementPolicy *check=ReplacementPolicy::Create(policy,1);
+
+  if (!check) {
+    usage();
+    exit(-1);
+  }
+  delete check;
+
+  DiskSystem disk(argv[1]);
+
+  SIZE_T blocksize = disk.GetBlockSize();
+  SIZE_T numblocks = disk.GetNumBlocks();
+
+  cout << "cachesize\tworkingset\thitrate\t\tdiskreads/op\tdiskwrites/op\tus/op\n";
+
+  for (SIZE_T cachesize=64; cachesize<=maxcachesize && cachesize<numblocks; cachesize*=4) {
+    SIZE_T workingset = 2*cachesize < numblocks ? 2*cachesize : numblocks;
+    BufferCache cache(&disk,cachesize,policy);
+    Block block(blocksize);
+    ERROR_T rc;
+    double start, elapsed;
+    SIZE_T diskreads, diskwrites, hits;
+
+    cache.Attach();
+    srand(cachesize);
+
+    // fill the cache before we start the clock
+    for (SIZE_T i=0;i<cachesize;i++) {
+      rc=cache.ReadBlock(rand()%workingset,block);
+      if (rc!=ERROR_NOERROR) {
+	cerr << "Error " << rc <<" occured when reading"<< endl;
+	return -1;
+      }
+    }
+
+    diskreads=cache.GetNumDiskReads();
+    diskwrites=cache.GetNumDiskWrites();
+    hits=cache.GetNumHits();
+    start=now();
+    for (SIZE_T i=0;i<numops;i++) {
+      SIZE_T b=rand()%workingset;
+      if (i%4==0) {
+	rc=cache.WriteBlock(b,block);
+      } else {
+	rc=cache.ReadBlock(b,block);
+      }
+      if (rc!=ERROR_NOERROR) {
+	cerr << "Error " << rc <<" occured on block "<< b << endl;
+	return -1;
+      }
+    }
+    elapsed=now()-start;
+
+    cout << cachesize << "\t\t" << workingset << "\t\t"
+	 << (double)(cache.GetNumHits()-hits)/numops << "\t\t"
+	 << (double)(cache.GetNumDiskReads()-diskreads)/numops << "\t\t"
+	 << (double)(cache.GetNumDiskWrites()-diskwrites)/numops << "\t\t"
+	 << elapsed/numops << endl;
+
+    // the contents are junk, so don't bother writing them back
+    cache.Attach();
+  }
+
+  return 0;
+}
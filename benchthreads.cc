@@ -0,0 +1,123 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "buffercache.h"
+
+
+void usage()
+{
+  cerr << "usage: benchthreads filestem cachesize numops [maxthreads [numshards]]\n";
+}
+
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec*1e6+tv.tv_usec;
+}
+
+
+static void Lookups(BufferCache *cache, SIZE_T workingset, SIZE_T numops, 
+		    unsigned seed, ERROR_T *result)
+{
+  Block *frame;
+  unsigned sum=0;
+
+  *result=ERROR_NOERROR;
+  for (SIZE_T i=0;i<numops;i++) { 
+    SIZE_T b=rand_r(&seed)%workingset;
+    ERROR_T rc=cache->PinBlock(b,frame);
+    if (rc!=ERROR_NOERROR) { 
+      *result=rc;
+      return;
+    }
+    sum+=frame->data[i%frame->length];
+    cache->UnpinBlock(b);
+  }
+  // so the reads can't be optimized away
+  if (sum==0xdeadbeef) { 
+    cerr << ".";
+  }
+}
+
+
+//
+// Times block lookups from more and more threads against a warm cache
+//
+// The whole working set fits in the cache, so after warming up every 
+// lookup is a hit and the only thing the threads share is the cache.
+// Each thread does numops lookups, so if the cache scales, the time 
+// stays flat as threads are added and the rate grows with them (up to
+// the number of cores).  Compare numshards=1 against more shards.
+//
+int main(int argc, char *argv[])
+{
+  if (argc<4) { 
+    usage();
+    exit(-1);
+  }
+  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T numops=atoi(argv[3]);
+  SIZE_T maxthreads=(argc>4 ? atoi(argv[4]) : 16);
+  SIZE_T numshards=(argc>5 ? atoi(argv[5]) : 64);
+
+  DiskSystem disk(argv[1]);
+
+  if (cachesize==0 || cachesize>disk.GetNumBlocks()) { 
+    usage();
+    exit(-1);
+  }
+
+  BufferCache cache(&disk,cachesize,"lru",0,0,numshards);
+  Block block;
+
+  cache.Attach();
+
+  for (SIZE_T i=0;i<cachesize;i++) { 
+    ERROR_T rc=cache.ReadBlock(i,block);
+    if (rc!=ERROR_NOERROR) { 
+      cerr << "Error " << rc <<" occured when reading"<< endl;
+      return -1;
+    }
+  }
+
+  cout << "shards = "<<cache.GetNumShards()<<", cores = "<<thread::hardware_concurrency()<<endl;
+  cout << "threads\tus\t\tMlookups/s\tspeedup\n";
+
+  double base=0;
+
+  for (SIZE_T t=1; t<=maxthreads; t*=2) { 
+    vector<thread *> threads;
+    vector<ERROR_T> results(t);
+    double start=now(), elapsed, rate;
+
+    for (SIZE_T i=0;i<t;i++) { 
+      threads.push_back(new thread(Lookups,&cache,cachesize,numops,i+1,&(results[i])));
+    }
+    for (SIZE_T i=0;i<t;i++) { 
+      threads[i]->join();
+      delete threads[i];
+      if (results[i]!=ERROR_NOERROR) { 
+	cerr << "Error " << results[i] << " occured in thread " << i << endl;
+	return -1;
+      }
+    }
+    elapsed=now()-start;
+    rate=t*numops/elapsed;
+    if (t==1) { 
+      base=rate;
+    }
+    cout << t << "\t" << elapsed << "\t\t" << rate << "\t\t" << rate/base << endl;
+  }
+
+  cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+
+  // Nothing was written, so there is nothing to write back
+  cache.Detach();
+
+  return 0;
+}
@@ -3,18 +3,18 @@
 
 #include "block.h"
 
-Block::Block() : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block() : data(0), length(0), lastaccessed(-1), dirty(false), pincount(0), borrowed(false)
 {}
 
 
-Block::Block(const SIZE_T s) : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block(const SIZE_T s) : data(0), length(0), lastaccessed(-1), dirty(false), pincount(0), borrowed(false)
 {
   Resize(s);
 }
 
 
 
-Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty)
+Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty), pincount(0), borrowed(false)
 {
   if (Resize(rhs.length)!=ERROR_NOERROR) { 
     throw GenericException();
@@ -22,7 +22,23 @@ Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccess
   memcpy(data,rhs.data,rhs.length);
 }
 
-Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block(Block &&rhs) noexcept : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty), pincount(0), borrowed(false)
+{
+  if (rhs.data==rhs.inlinedata) { 
+    // Can't take it, but it's small
+    memcpy(inlinedata,rhs.inlinedata,rhs.length);
+    data=inlinedata;
+  } else {
+    data=rhs.data;
+    borrowed=rhs.borrowed;
+  }
+  length=rhs.length;
+  rhs.data=0;
+  rhs.length=0;
+  rhs.borrowed=false;
+}
+
+Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(false), pincount(0), borrowed(false)
 {
   if (Resize(strlen(str))!=ERROR_NOERROR) { 
     throw GenericException();
@@ -32,15 +48,49 @@ Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(fal
 
 Block::~Block() 
 { 
-  if (data) { delete [] data; data=0; }
+  if (OwnsData()) { delete [] data; }
+  data=0;
   length=0;
   lastaccessed=-1;
   dirty=false;
+  pincount=0;
 }
 
 Block & Block::operator=(const Block &rhs)
 {
-  return *(new (this) Block(rhs));
+  if (this==&rhs) { 
+    return *this;
+  }
+  // Same size keeps the buffer we have, which matters if it is borrowed
+  if (Resize(rhs.length,false)!=ERROR_NOERROR) { 
+    throw GenericException();
+  }
+  memcpy(data,rhs.data,rhs.length);
+  lastaccessed=rhs.lastaccessed;
+  dirty=rhs.dirty;
+  return *this;
+}
+
+Block & Block::operator=(Block &&rhs)
+{
+  if (this==&rhs) { 
+    return *this;
+  }
+  // Borrowed memory stays ours to write into, and inline data has to
+  // be copied anyway
+  if (borrowed || !rhs.data || rhs.data==rhs.inlinedata) { 
+    return *this=(const Block &)rhs;
+  }
+  if (OwnsData()) { delete [] data; }
+  data=rhs.data;
+  length=rhs.length;
+  borrowed=rhs.borrowed;
+  lastaccessed=rhs.lastaccessed;
+  dirty=rhs.dirty;
+  rhs.data=0;
+  rhs.length=0;
+  rhs.borrowed=false;
+  return *this;
 }
 
 
@@ -50,20 +100,29 @@ Block & Block::operator=(const Block &rhs)
 ERROR_T Block::Resize(const SIZE_T newlen, const bool copy)
 {
   BYTE_T *d;
-  
-  try {
-    d = new BYTE_T [newlen];
+
+  if (data && newlen==length) { 
+    return ERROR_NOERROR;
   }
-  catch (...) {
-    return ERROR_NOMEM;
+  
+  if (newlen<=BLOCK_INLINE_BYTES) { 
+    d = inlinedata;
+  } else {
+    try {
+      d = new BYTE_T [newlen];
+    }
+    catch (...) {
+      return ERROR_NOMEM;
+    }
   }
 
-  if (copy) { 
+  if (copy && data && d!=data) { 
     memcpy(d,data,MIN(newlen,length));
   }
   
-  if (data) { delete [] data; }
+  if (OwnsData()) { delete [] data; }
   data = d;
+  borrowed = false;
 
   length=newlen;
 
@@ -71,6 +130,15 @@ ERROR_T Block::Resize(const SIZE_T newlen, const bool copy)
 }
 
 
+void Block::Borrow(BYTE_T *buf, const SIZE_T len)
+{
+  if (OwnsData()) { delete [] data; }
+  data=buf;
+  length=len;
+  borrowed=true;
+}
+
+
 static char high2hex(BYTE_T x)
 {
   x>>=4;
@@ -86,17 +154,19 @@ static char low2hex(BYTE_T x)
 
 
 
-#define MAX(x,y) ((x)>(y) ? (x) : (y))
-
+// Blocks compare the way keys do: byte by byte, and a shorter block 
+// before any it is the start of
 bool Block::operator<(const Block &rhs) const
 {
-  return memcmp(data,rhs.data,MAX(length,rhs.length))<0;
+  int c=memcmp(data,rhs.data,MIN(length,rhs.length));
+
+  return c<0 || (c==0 && length<rhs.length);
 }
 
 
 bool Block::operator==(const Block &rhs) const
 {
-  return memcmp(data,rhs.data,MAX(length,rhs.length))==0;
+  return length==rhs.length && memcmp(data,rhs.data,length)==0;
 }
 
 ostream & Block::Print(ostream &os) const
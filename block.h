@@ -7,23 +7,49 @@
 
 using namespace std;
 
+// Blocks this small (most keys and values) keep their data inside the
+// Block itself and never touch the heap
+#define BLOCK_INLINE_BYTES 32
+
+//
+// A run of bytes
+//
+// data points at inlinedata for blocks of up to BLOCK_INLINE_BYTES,
+// at memory the block owns for bigger ones, or at memory someone else
+// owns (see Borrow).  Assignment copies into the buffer already there
+// when it is the right size.  Moving takes over an owned buffer, and
+// copies anything else.
+//
 struct Block {
   BYTE_T	*data;
   SIZE_T 	length;
   double        lastaccessed;  // for use in buffercache only
   bool          dirty;         // for use in buffercahce only
+  SIZE_T        pincount;      // for use in buffercache only
+  bool          borrowed;      // data belongs to someone else, see Borrow
+  BYTE_T        inlinedata[BLOCK_INLINE_BYTES];
 
   Block();
   Block(const SIZE_T size);
   Block(const Block &rhs);
+  Block(Block &&rhs) noexcept;
   Block(const char *data);
   virtual ~Block();
   Block & operator=(const Block &rhs);
+  Block & operator=(Block &&rhs);
 
   // returns one of ERROR_NOERROR (zero)
   // ERROR_NOMEM or other nonzero error code.
   ERROR_T Resize(const SIZE_T newlength, const bool copy=true);
 
+  // Use len bytes at buf, which someone else owns, as the data
+  // The block never frees them, and resizing it to anything but len
+  // gives it memory of its own again.
+  void Borrow(BYTE_T *buf, const SIZE_T len);
+
+  // data is on the heap and ours to free
+  bool OwnsData() const { return data && !borrowed && data!=inlinedata; }
+
   bool operator<(const Block &rhs) const;
   bool operator==(const Block &rhs) const;
 
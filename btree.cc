@@ -1,6 +1,8 @@
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include "btree.h"
-#include "math.h"
 
 KeyValuePair::KeyValuePair()
 {}
@@ -15,6 +17,10 @@ KeyValuePair::KeyValuePair(const KeyValuePair &rhs) :
   key(rhs.key), value(rhs.value)
 {}
 
+KeyValuePair::KeyValuePair(KeyValuePair &&rhs) noexcept :
+  key(move(rhs.key)), value(move(rhs.value))
+{}
+
 
 KeyValuePair::~KeyValuePair()
 {}
@@ -22,21 +28,44 @@ KeyValuePair::~KeyValuePair()
 
 KeyValuePair & KeyValuePair::operator=(const KeyValuePair &rhs)
 {
-  return *( new (this) KeyValuePair(rhs));
+  key=rhs.key;
+  value=rhs.value;
+  return *this;
+}
+
+KeyValuePair & KeyValuePair::operator=(KeyValuePair &&rhs)
+{
+  key=move(rhs.key);
+  value=move(rhs.value);
+  return *this;
 }
 
 BTreeIndex::BTreeIndex(SIZE_T keysize, 
 		       SIZE_T valuesize,
 		       BufferCache *cache,
-		       bool unique) 
+		       bool unique,
+		       SIZE_T format,
+		       SIZE_T overflow) :
+  residentbudget(BTREE_RESIDENT_NODES), residentstale(true), deletepolicy(BTREE_DELETE_EAGER),
+  rightleaf(0), rightpathok(false), numappends(0)
 {
   superblock.info.keysize=keysize;
   superblock.info.valuesize=valuesize;
+  superblock.info.format=format;
+  superblock.info.prefixlen=0;
+  superblock.info.overflow=overflow;
+  superblock.info.postingsize=0;
+  if (!unique) { 
+    // The nodes hold each key's posting list as its value
+    superblock.info.postingsize=valuesize;
+    superblock.info.valuesize=superblock.info.GetPostingCellBytes();
+  }
   buffercache=cache;
-  // note: ignoring unique now
 }
 
-BTreeIndex::BTreeIndex()
+BTreeIndex::BTreeIndex() : residentbudget(BTREE_RESIDENT_NODES), residentstale(true),
+			   deletepolicy(BTREE_DELETE_EAGER),
+			   rightleaf(0), rightpathok(false), numappends(0)
 {
   // shouldn't have to do anything
 }
@@ -50,6 +79,13 @@ BTreeIndex::BTreeIndex(const BTreeIndex &rhs)
   buffercache=rhs.buffercache;
   superblock_index=rhs.superblock_index;
   superblock=rhs.superblock;
+  residentbudget=rhs.residentbudget;
+  residentstale=true;
+  splitpolicy=rhs.splitpolicy;
+  deletepolicy=rhs.deletepolicy;
+  rightleaf=0;
+  rightpathok=false;
+  numappends=0;
 }
 
 BTreeIndex::~BTreeIndex()
@@ -112,6 +148,543 @@ ERROR_T BTreeIndex::DeallocateNode(const SIZE_T &n)
 
 }
 
+
+ERROR_T BTreeIndex::DeallocateNodes(const vector<SIZE_T> &nodes)
+{
+  ERROR_T rc;
+
+  if (nodes.empty()) { 
+    return ERROR_NOERROR;
+  }
+
+  // Each links to the next, and the last to what was free before
+  BTreeNode node(BTREE_UNALLOCATED_BLOCK,
+		 superblock.info.keysize,
+		 superblock.info.valuesize,
+		 buffercache->GetBlockSize());
+  node.info.rootnode=superblock.info.rootnode;
+
+  for (SIZE_T i=0; i<nodes.size(); i++) { 
+    node.info.freelist = i+1<nodes.size() ? nodes[i+1] : superblock.info.freelist;
+    rc = node.Serialize(buffercache, nodes[i]);
+    if (rc) { return rc; }
+    buffercache->NotifyDeallocateBlock(nodes[i]);
+  }
+
+  superblock.info.freelist=nodes.front();
+
+  return superblock.Serialize(buffercache,superblock_index);
+}
+
+//
+// Values longer than the tree's overflow go in a chain of blocks of
+// their own, which the leaf points to
+//
+ERROR_T BTreeIndex::WriteOverflow(const VALUE_T &value, SIZE_T &block)
+{
+  ERROR_T rc;
+  SIZE_T perblock = superblock.info.GetOverflowBytesPerBlock();
+  SIZE_T num = (value.length+perblock-1)/perblock;
+  vector<SIZE_T> blocks;
+
+  for (SIZE_T i=0; i<num; i++) { 
+    SIZE_T n;
+    rc = AllocateNode(n);
+    if (rc) { return rc; }
+    blocks.push_back(n);
+  }
+
+  BTreeNode b(BTREE_OVERFLOW_BLOCK,
+	      superblock.info.keysize,
+	      superblock.info.valuesize,
+	      buffercache->GetBlockSize(),
+	      superblock.info.format,
+	      superblock.info.overflow);
+  for (SIZE_T i=0; i<num; i++) { 
+    b.info.numkeys = i+1<num ? perblock : value.length-i*perblock;
+    rc = b.SetPtr(0, i+1<num ? blocks[i+1] : 0);
+    if (rc) { return rc; }
+    memcpy(b.data+sizeof(SIZE_T), value.data+i*perblock, b.info.numkeys);
+    rc = b.Serialize(buffercache, blocks[i]);
+    if (rc) { return rc; }
+  }
+
+  block = blocks.front();
+  return ERROR_NOERROR;
+}
+
+
+static ERROR_T ReadOverflow(BufferCache *cache, SIZE_T block, const SIZE_T length, VALUE_T &value)
+{
+  ERROR_T rc;
+  BTreeNodeView b;
+  SIZE_T done = 0;
+
+  rc = value.Resize(length, false);
+  if (rc) { return rc; }
+
+  while (block != 0) { 
+    rc = b.Pin(cache, block);
+    if (rc) { return rc; }
+    if (b.info->nodetype != BTREE_OVERFLOW_BLOCK || done+b.info->numkeys > length) { 
+      return ERROR_INSANE;
+    }
+    memcpy(value.data+done, b.data+sizeof(SIZE_T), b.info->numkeys);
+    done += b.info->numkeys;
+    rc = b.GetPtr(0, block);
+    if (rc) { return rc; }
+  }
+  return done == length ? ERROR_NOERROR : ERROR_INSANE;
+}
+
+
+// The blocks of a chain of overflow (or posting) blocks, onto blocks
+static ERROR_T GetChain(BufferCache *cache, SIZE_T block, vector<SIZE_T> &blocks)
+{
+  ERROR_T rc;
+
+  while (block != 0) { 
+    BTreeNodeView b;
+
+    rc = b.Pin(cache, block);
+    if (rc) { return rc; }
+    blocks.push_back(block);
+    rc = b.GetPtr(0, block);
+    if (rc) { return rc; }
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::FreeOverflow(SIZE_T block)
+{
+  ERROR_T rc;
+  vector<SIZE_T> blocks;
+
+  rc = GetChain(buffercache, block, blocks);
+  if (rc) { return rc; }
+  return DeallocateNodes(blocks);
+}
+
+
+//
+// Posting lists, for an index that isn't unique.  A list is its 
+// postings back to back, each a value (after its length, if slotted),
+// in the order keys sort in.
+//
+static SIZE_T PostingLengthAt(const NodeMetadata &info, const char *p)
+{
+  SLOT_T len;
+
+  if (info.format!=BTREE_FORMAT_SLOTTED) { 
+    return info.postingsize;
+  }
+  memcpy(&len, p, sizeof(SLOT_T));
+  return len;
+}
+
+static SIZE_T PostingBytesAt(const NodeMetadata &info, const char *p)
+{
+  return info.GetPostingBytes(PostingLengthAt(info, p));
+}
+
+static const char *PostingDataAt(const NodeMetadata &info, const char *p)
+{
+  return info.format==BTREE_FORMAT_SLOTTED ? p+sizeof(SLOT_T) : p;
+}
+
+// <0, 0, >0 as the posting at p sorts before, with, or after v
+static int ComparePostingAt(const NodeMetadata &info, const char *p, const VALUE_T &v)
+{
+  SIZE_T len = PostingLengthAt(info, p);
+  int c = memcmp(PostingDataAt(info, p), v.data, len<v.length ? len : v.length);
+
+  if (c!=0 || len==v.length) { 
+    return c;
+  }
+  return len<v.length ? -1 : 1;
+}
+
+static void GetPostingAt(const NodeMetadata &info, const char *p, VALUE_T &v)
+{
+  SIZE_T len = PostingLengthAt(info, p);
+
+  v.Resize(len, false);
+  memcpy(v.data, PostingDataAt(info, p), len);
+}
+
+static string MakePosting(const NodeMetadata &info, const VALUE_T &v)
+{
+  string posting;
+
+  if (info.format==BTREE_FORMAT_SLOTTED) { 
+    SLOT_T len = v.length;
+    posting.append((const char*)&len, sizeof(SLOT_T));
+  }
+  posting.append((const char*)v.data, v.length);
+  return posting;
+}
+
+// Where in list v is, or would go.  Postings of one size are searched
+// by halves, the others one after another.
+static SIZE_T FindPosting(const NodeMetadata &info, const string &list, const VALUE_T &v, 
+			  bool &found)
+{
+  SIZE_T at = 0;
+
+  if (info.format!=BTREE_FORMAT_SLOTTED) { 
+    SIZE_T lo = 0, hi = list.size()/info.postingsize;
+
+    while (lo<hi) { 
+      SIZE_T mid = lo+(hi-lo)/2;
+      if (ComparePostingAt(info, list.data()+mid*info.postingsize, v)<0) { 
+	lo = mid+1;
+      } else {
+	hi = mid;
+      }
+    }
+    at = lo*info.postingsize;
+  } else {
+    while (at<list.size() && ComparePostingAt(info, list.data()+at, v)<0) { 
+      at += PostingBytesAt(info, list.data()+at);
+    }
+  }
+  found = at<list.size() && ComparePostingAt(info, list.data()+at, v)==0;
+  return at;
+}
+
+// Where the last posting of a list that has one starts
+static SIZE_T LastPosting(const NodeMetadata &info, const string &list)
+{
+  SIZE_T at = 0;
+
+  while (at+PostingBytesAt(info, list.data()+at)<list.size()) { 
+    at += PostingBytesAt(info, list.data()+at);
+  }
+  return at;
+}
+
+// Where to cut a list that no longer fits in a block, about halfway
+static SIZE_T HalfPostings(const NodeMetadata &info, const string &list)
+{
+  SIZE_T at = 0;
+
+  while (at<list.size()/2) { 
+    at += PostingBytesAt(info, list.data()+at);
+  }
+  return at;
+}
+
+static ERROR_T GetPostingValues(const NodeMetadata &info, const string &list, vector<VALUE_T> &values)
+{
+  SIZE_T at = 0;
+
+  while (at<list.size()) { 
+    values.push_back(VALUE_T());
+    GetPostingAt(info, list.data()+at, values.back());
+    at += PostingBytesAt(info, list.data()+at);
+  }
+  return at==list.size() ? ERROR_NOERROR : ERROR_INSANE;
+}
+
+// A key's list as its leaf holds it, and back
+static ERROR_T GetPostings(const NodeMetadata &info, const VALUE_T &cell, BTreePostings &p)
+{
+  const char *list = (const char*)cell.data+sizeof(SIZE_T);
+  SIZE_T count;
+  SIZE_T used = 0;
+
+  if (cell.length<sizeof(SIZE_T)) { 
+    return ERROR_INSANE;
+  }
+  memcpy(&count, cell.data, sizeof(SIZE_T));
+  p.count = count & ~BTREE_POSTING_SPILLED;
+  p.first = p.last = 0;
+  p.inlined.clear();
+
+  if (count & BTREE_POSTING_SPILLED) { 
+    if (cell.length<3*sizeof(SIZE_T)) { 
+      return ERROR_INSANE;
+    }
+    memcpy(&p.first, list, sizeof(SIZE_T));
+    memcpy(&p.last, list+sizeof(SIZE_T), sizeof(SIZE_T));
+    return ERROR_NOERROR;
+  }
+  for (SIZE_T i=0; i<p.count; i++) { 
+    // a posting's length has to be there before it can be read
+    if (used+info.GetPostingBytes(0) > cell.length-sizeof(SIZE_T)) { 
+      return ERROR_INSANE;
+    }
+    used += PostingBytesAt(info, list+used);
+  }
+  if (used > cell.length-sizeof(SIZE_T)) { 
+    return ERROR_INSANE;
+  }
+  p.inlined.assign(list, used);
+  return ERROR_NOERROR;
+}
+
+static void SetPostings(const NodeMetadata &info, const BTreePostings &p, VALUE_T &cell)
+{
+  SIZE_T count = p.count | (p.first ? BTREE_POSTING_SPILLED : 0);
+  SIZE_T len = sizeof(SIZE_T) + (p.first ? 2*sizeof(SIZE_T) : p.inlined.size());
+
+  // Every value in a plain leaf is the same size
+  cell.Resize(info.format==BTREE_FORMAT_SLOTTED ? len : info.valuesize, false);
+  memset(cell.data, 0, cell.length);
+  memcpy(cell.data, &count, sizeof(SIZE_T));
+  if (p.first) { 
+    memcpy(cell.data+sizeof(SIZE_T), &p.first, sizeof(SIZE_T));
+    memcpy(cell.data+2*sizeof(SIZE_T), &p.last, sizeof(SIZE_T));
+  } else {
+    memcpy(cell.data+sizeof(SIZE_T), p.inlined.data(), p.inlined.size());
+  }
+}
+
+
+static ERROR_T ReadPostingBlock(BufferCache *cache, const NodeMetadata &info, const SIZE_T block,
+				string &list, SIZE_T &next)
+{
+  ERROR_T rc;
+  BTreeNodeView b;
+
+  rc = b.Pin(cache, block);
+  if (rc) { return rc; }
+  if (b.info->nodetype != BTREE_POSTING_BLOCK || b.info->numkeys > info.GetOverflowBytesPerBlock()) { 
+    return ERROR_INSANE;
+  }
+  list.assign(b.data+sizeof(SIZE_T), b.info->numkeys);
+  rc = b.GetPtr(0, next);
+  if (rc) { return rc; }
+  return b.Unpin();
+}
+
+// All of a list's postings, from the leaf or from its chain
+static ERROR_T ReadPostings(BufferCache *cache, const NodeMetadata &info, const BTreePostings &p,
+			    string &list)
+{
+  ERROR_T rc;
+  SIZE_T block = p.first;
+  string part;
+
+  list = p.inlined;
+  while (block != 0) { 
+    rc = ReadPostingBlock(cache, info, block, part, block);
+    if (rc) { return rc; }
+    list += part;
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::WritePostingBlock(const SIZE_T block, const string &list, const SIZE_T next)
+{
+  ERROR_T rc;
+  BTreeNode b(BTREE_POSTING_BLOCK,
+	      superblock.info.keysize,
+	      superblock.info.valuesize,
+	      buffercache->GetBlockSize(),
+	      superblock.info.format,
+	      superblock.info.overflow);
+
+  b.info.numkeys = list.size();
+  rc = b.SetPtr(0, next);
+  if (rc) { return rc; }
+  memcpy(b.data+sizeof(SIZE_T), list.data(), list.size());
+  return b.Serialize(buffercache, block);
+}
+
+
+ERROR_T BTreeIndex::WritePostings(const string &list, BTreePostings &p)
+{
+  ERROR_T rc;
+  const NodeMetadata &info = superblock.info;
+  SIZE_T perblock = info.GetOverflowBytesPerBlock();
+  vector<SIZE_T> starts;
+  vector<SIZE_T> blocks;
+  SIZE_T at = 0;
+
+  // Cut the list wherever a block fills
+  while (at < list.size()) { 
+    SIZE_T start = at;
+
+    starts.push_back(start);
+    while (at < list.size() && at-start+PostingBytesAt(info, list.data()+at) <= perblock) { 
+      at += PostingBytesAt(info, list.data()+at);
+    }
+  }
+  starts.push_back(list.size());
+
+  for (SIZE_T i=0; i+1<starts.size(); i++) { 
+    SIZE_T n;
+    rc = AllocateNode(n);
+    if (rc) { return rc; }
+    blocks.push_back(n);
+  }
+  for (SIZE_T i=0; i<blocks.size(); i++) { 
+    rc = WritePostingBlock(blocks[i], list.substr(starts[i], starts[i+1]-starts[i]),
+			   i+1<blocks.size() ? blocks[i+1] : 0);
+    if (rc) { return rc; }
+  }
+
+  p.first = blocks.empty() ? 0 : blocks.front();
+  p.last = blocks.empty() ? 0 : blocks.back();
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::AddPosting(BTreePostings &p, const VALUE_T &value)
+{
+  ERROR_T rc;
+  const NodeMetadata &info = superblock.info;
+  SIZE_T perblock = info.GetOverflowBytesPerBlock();
+  string posting = MakePosting(info, value);
+  string list;
+  SIZE_T block, right, next, at;
+  bool found;
+
+  if (p.first == 0) { 
+    at = FindPosting(info, p.inlined, value, found);
+    if (found) { return ERROR_CONFLICT; }
+    p.inlined.insert(at, posting);
+    p.count++;
+    if (sizeof(SIZE_T)+p.inlined.size() <= info.GetPostingCellBytes()) { 
+      return ERROR_NOERROR;
+    }
+    // Too many for the leaf, so they move out to a posting block
+    rc = WritePostings(p.inlined, p);
+    if (rc) { return rc; }
+    p.inlined.clear();
+    return ERROR_NOERROR;
+  }
+
+  // Lists mostly grow at the end, as ids handed out in order do, so 
+  // try the last block before walking the chain
+  rc = ReadPostingBlock(buffercache, info, p.last, list, next);
+  if (rc) { return rc; }
+  if (list.empty() || ComparePostingAt(info, list.data()+LastPosting(info, list), value) < 0) { 
+    p.count++;
+    if (list.size()+posting.size() <= perblock) { 
+      return WritePostingBlock(p.last, list+posting, next);
+    }
+    // Nothing will go before this value again, so rather than split 
+    // the block, leave it full and start a new one after it
+    rc = AllocateNode(block);
+    if (rc) { return rc; }
+    rc = WritePostingBlock(block, posting, 0);
+    if (rc) { return rc; }
+    rc = WritePostingBlock(p.last, list, block);
+    if (rc) { return rc; }
+    p.last = block;
+    return ERROR_NOERROR;
+  }
+
+  // Otherwise it goes in the first block that ends at or past it
+  block = p.first;
+  while (true) { 
+    rc = ReadPostingBlock(buffercache, info, block, list, next);
+    if (rc) { return rc; }
+    if (next == 0 || 
+	(!list.empty() && ComparePostingAt(info, list.data()+LastPosting(info, list), value) >= 0)) { 
+      break;
+    }
+    block = next;
+  }
+  at = FindPosting(info, list, value, found);
+  if (found) { return ERROR_CONFLICT; }
+  list.insert(at, posting);
+  p.count++;
+  if (list.size() <= perblock) { 
+    return WritePostingBlock(block, list, next);
+  }
+
+  // which it overfills, so it splits in two
+  at = HalfPostings(info, list);
+  rc = AllocateNode(right);
+  if (rc) { return rc; }
+  rc = WritePostingBlock(right, list.substr(at), next);
+  if (rc) { return rc; }
+  rc = WritePostingBlock(block, list.substr(0, at), right);
+  if (rc) { return rc; }
+  if (block == p.last) { 
+    p.last = right;
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::RemovePosting(BTreePostings &p, const VALUE_T &value)
+{
+  ERROR_T rc;
+  const NodeMetadata &info = superblock.info;
+  string list;
+  SIZE_T block, prev, next, at;
+  bool found;
+
+  if (p.first == 0) { 
+    at = FindPosting(info, p.inlined, value, found);
+    if (!found) { return ERROR_NONEXISTENT; }
+    p.inlined.erase(at, PostingBytesAt(info, p.inlined.data()+at));
+    p.count--;
+    return ERROR_NOERROR;
+  }
+
+  // Find the block it would be in, and the one before that
+  prev = 0;
+  block = p.first;
+  while (true) { 
+    rc = ReadPostingBlock(buffercache, info, block, list, next);
+    if (rc) { return rc; }
+    if (!list.empty() && ComparePostingAt(info, list.data()+LastPosting(info, list), value) >= 0) { 
+      break;
+    }
+    if (next == 0) { 
+      return ERROR_NONEXISTENT;
+    }
+    prev = block;
+    block = next;
+  }
+  at = FindPosting(info, list, value, found);
+  if (!found) { return ERROR_NONEXISTENT; }
+  list.erase(at, PostingBytesAt(info, list.data()+at));
+  p.count--;
+
+  if (!list.empty()) { 
+    rc = WritePostingBlock(block, list, next);
+  } else {
+    // An empty block comes out of the chain
+    if (prev) { 
+      BTreeNodeView b;
+      rc = b.Pin(buffercache, prev);
+      if (rc) { return rc; }
+      rc = b.SetPtr(0, next);
+      if (rc) { return rc; }
+      rc = b.Unpin();
+    } else {
+      p.first = next;
+    }
+    if (rc) { return rc; }
+    if (block == p.last) { 
+      p.last = prev;
+    }
+    rc = DeallocateNode(block);
+  }
+  if (rc) { return rc; }
+
+  // Back into the leaf once the rest would fit in half of it, so a list
+  // at the edge doesn't go back and forth
+  if (2*p.count*info.GetPostingBytes(info.postingsize) <= info.GetPostingCellBytes()-sizeof(SIZE_T)) { 
+    rc = ReadPostings(buffercache, info, p, list);
+    if (rc) { return rc; }
+    rc = FreeOverflow(p.first);
+    if (rc) { return rc; }
+    p.inlined = list;
+    p.first = p.last = 0;
+  }
+  return ERROR_NOERROR;
+}
+
+
 ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
 {
   ERROR_T rc;
@@ -119,6 +692,10 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
   superblock_index=initblock;
   assert(superblock_index==0);
 
+  resident.clear();
+  residentstale=true;
+  rightleaf=0;
+
   if (create) {
     // build a super block, root node, and a free space list
     //
@@ -128,10 +705,29 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
     BTreeNode newsuperblock(BTREE_SUPERBLOCK,
 			    superblock.info.keysize,
 			    superblock.info.valuesize,
-			    buffercache->GetBlockSize());
+			    buffercache->GetBlockSize(),
+			    superblock.info.format,
+			    superblock.info.overflow);
     newsuperblock.info.rootnode=superblock_index+1;
     newsuperblock.info.freelist=superblock_index+2;
     newsuperblock.info.numkeys=0;
+    newsuperblock.info.postingsize=superblock.info.postingsize;
+
+    // A full slotted leaf has to split into two that each have room for
+    // the largest pair, which takes room for four of them, and offsets 
+    // into it and lengths have to fit in a SLOT_T
+    if (newsuperblock.info.format==BTREE_FORMAT_SLOTTED && 
+	(newsuperblock.info.GetNumSlotsAsLeaf()<4 || 
+	 newsuperblock.info.GetNumDataBytes()>(SLOT_T)~0 ||
+	 newsuperblock.info.valuesize>(SLOT_T)~0)) { 
+      return ERROR_SIZE;
+    }
+    // A full posting block splits in two that each have room for 
+    // another of the largest values
+    if (!newsuperblock.info.IsUnique() && 
+	newsuperblock.info.GetOverflowBytesPerBlock()<4*newsuperblock.info.GetPostingBytes(newsuperblock.info.postingsize)) { 
+      return ERROR_SIZE;
+    }
 
     buffercache->NotifyAllocateBlock(superblock_index);
 
@@ -144,7 +740,9 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
     BTreeNode newrootnode(BTREE_ROOT_NODE,
 			  superblock.info.keysize,
 			  superblock.info.valuesize,
-			  buffercache->GetBlockSize());
+			  buffercache->GetBlockSize(),
+			  superblock.info.format,
+			  superblock.info.overflow);
     newrootnode.info.rootnode=superblock_index+1;
     newrootnode.info.freelist=superblock_index+2;
     newrootnode.info.numkeys=0;
@@ -180,6 +778,82 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
 }
     
 
+void BTreeIndex::SetResidentBudget(const SIZE_T numnodes)
+{
+  residentbudget=numnodes;
+  resident.clear();
+  residentstale=true;
+}
+
+
+ERROR_T BTreeIndex::LoadResident()
+{
+  ERROR_T rc;
+  vector<SIZE_T> level(1, superblock.info.rootnode);
+  vector<SIZE_T> next;
+  SIZE_T total = 0;
+
+  if (!residentstale) { 
+    return ERROR_NOERROR;
+  }
+  resident.clear();
+
+  // Breadth first, a whole level at a time, stopping at the leaves or
+  // at the first level that doesn't fit
+  while (!level.empty() && total+level.size()<=residentbudget && 
+	 resident.size()<BTREE_MAX_DEPTH) { 
+    resident.push_back(ResidentLevel());
+    next.clear();
+    for (SIZE_T i=0; i<level.size(); i++) { 
+      BTreeNode &b = resident.back()[level[i]];
+      SIZE_T ptr;
+
+      rc = b.Unserialize(buffercache, level[i]);
+      if (rc) { 
+	resident.clear();
+	return rc;
+      }
+      if (b.info.nodetype!=BTREE_ROOT_NODE && b.info.nodetype!=BTREE_INTERIOR_NODE) { 
+	resident.pop_back();
+	next.clear();
+	break;
+      }
+      for (SIZE_T j=0; b.info.numkeys>0 && j<=b.info.numkeys; j++) { 
+	rc = b.GetPtr(j, ptr);
+	if (rc) { 
+	  resident.clear();
+	  return rc;
+	}
+	next.push_back(ptr);
+      }
+    }
+    total += level.size();
+    level.swap(next);
+  }
+
+  residentstale = false;
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::WriteNode(const BTreeNode &b, const SIZE_T &node)
+{
+  ERROR_T rc;
+
+  rc = b.Serialize(buffercache, node);
+  if (rc) { return rc; }
+
+  for (SIZE_T d=0; !residentstale && d<resident.size(); d++) { 
+    ResidentLevel::iterator r = resident[d].find(node);
+    if (r!=resident[d].end()) { 
+      (*r).second = b;
+      break;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+
 ERROR_T BTreeIndex::Detach(SIZE_T &initblock)
 {
   return superblock.Serialize(buffercache,superblock_index);
@@ -191,81 +865,187 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
 					   const KEY_T &key,
 					   VALUE_T &value)
 {
-  BTreeNode b;
+  BTreeNodeView b;
   ERROR_T rc;
   SIZE_T offset;
-  KEY_T testkey;
-  SIZE_T ptr;
+  SIZE_T leaf;
 
-  rc= b.Unserialize(buffercache,node);
+  rc=LookupForInsert(node,key,leaf);
 
   if (rc!=ERROR_NOERROR) { 
     return rc;
   }
 
-  switch (b.info.nodetype) { 
-  case BTREE_ROOT_NODE:
-  case BTREE_INTERIOR_NODE:
-    // Scan through key/ptr pairs
-    //and recurse if possible
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (key<testkey || key==testkey) {
-        // OK, so we now have the first key that's larger
-        // so we ned to recurse on the ptr immediately previous to 
-        // this one, if it exists
-        rc=b.GetPtr(offset,ptr);
-        if (rc) { return rc; }
-        return LookupOrUpdateInternal(ptr,op,key,value);
-      }
-    }
-    // if we got here, we need to go to the next pointer, if it exists
-    if (b.info.numkeys>0) { 
-      rc=b.GetPtr(b.info.numkeys,ptr);
+  // Look at the leaf where it sits in the cache
+  rc= b.Pin(buffercache,leaf);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  rc=b.LowerBound(key,offset);
+  if (rc) { return rc; }
+  if (offset==b.info->numkeys || b.CompareKey(offset,key)!=0) { 
+    return ERROR_NONEXISTENT;
+  }
+  if (op==BTREE_OP_LOOKUP) { 
+    if (b.IsValRef(offset)) { 
+      SIZE_T ref;
+      SIZE_T length=b.GetValLength(offset);
+
+      rc=b.GetValRef(offset,ref);
       if (rc) { return rc; }
-      return LookupOrUpdateInternal(ptr,op,key,value);
-    } else {
-      // There are no keys at all on this node, so nowhere to go
-      return ERROR_NONEXISTENT;
+      rc=b.Unpin();
+      if (rc) { return rc; }
+      return ReadOverflow(buffercache,ref,length,value);
     }
-    break;
-  case BTREE_LEAF_NODE:
-    // Scan through keys looking for matching value
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (testkey==key) { 
-        if (op==BTREE_OP_LOOKUP) { 
-          return b.GetVal(offset,value);
-      	} else { 
-          // BTREE_OP_UPDATE
-          // WRITE ME => Finished...I think   -PW
-          b.SetVal(offset, value);
-          return b.Serialize(buffercache, node);
-      	}
+    rc=b.GetVal(offset,value);
+  } else { 
+    // BTREE_OP_UPDATE
+    // This writes in place, the unpin marks the block dirty.  A value 
+    // that was in overflow blocks has them freed once it is replaced.
+    SIZE_T ref=0, oldref=0;
+
+    if (b.IsValRef(offset)) { 
+      rc=b.GetValRef(offset,oldref);
+      if (rc) { return rc; }
+    }
+    if (superblock.info.IsOverflow(value.length)) { 
+      rc=WriteOverflow(value,ref);
+      if (rc) { return rc; }
+    }
+    rc = ref ? b.SetValRef(offset, value.length, ref) : b.SetVal(offset, value);
+    if (rc==ERROR_NOSPACE) { 
+      // A stored slotted leaf has no room for a longer value than the
+      // one there, so rewrite the whole leaf
+      rc=b.Unpin();
+      if (rc) { return rc; }
+      rc=RewriteVal(key, value, ref);
+    } else {
+      if (!rc && leaf==rightleaf) { 
+	rc = ref ? rightnode.SetValRef(offset, value.length, ref) : rightnode.SetVal(offset, value);
       }
+      if (rc) { return rc; }
+      rc=b.Unpin();
     }
-    return ERROR_NONEXISTENT;
-    break;
-  default:
-    // We can't be looking at anything other than a root, internal, or leaf
-    return ERROR_INSANE;
-    break;
-  }  
+    if (rc) { return rc; }
+    return oldref ? FreeOverflow(oldref) : ERROR_NOERROR;
+  }
+  if (rc) { return rc; }
+  return b.Unpin();
+}
 
-  return ERROR_INSANE;
+
+ERROR_T BTreeIndex::RewriteVal(const KEY_T &key, const VALUE_T &value, const SIZE_T ref)
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T offset;
+  SIZE_T leaf;
+  BTreePath path;
+
+  rc = LookupForInsert(superblock.info.rootnode, key, leaf, 0, &path);
+  if (rc) { return rc; }
+
+  rc = b.Unserialize(buffercache, leaf);
+  if (rc) { return rc; }
+  rc = b.LowerBound(key, offset);
+  if (rc) { return rc; }
+  rc = ref ? b.SetValRef(offset, value.length, ref) : b.SetVal(offset, value);
+  if (rc) { return rc; }
+
+  // The longer value can use up the room an insert would need
+  if (b.info.numkeys >= b.GetNumSlotsAsLeaf()) { 
+    rightleaf = 0;
+    return SplitLeaf(path, b, offset);
+  }
+
+  rc = b.Serialize(buffercache, leaf);
+  if (rc) { return rc; }
+  if (leaf == rightleaf) { 
+    rightnode = b;
+  }
+  return ERROR_NOERROR;
 }
 
 
-static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplayType dt)
+// The ith value of a leaf, wherever it is
+static ERROR_T GetLeafVal(BufferCache *cache, const BTreeNode &b, const SIZE_T offset, VALUE_T &value)
 {
-  KEY_T key;
-  VALUE_T value;
+  ERROR_T rc;
+  SIZE_T ref;
+
+  if (b.IsValRef(offset)) { 
+    rc=b.GetValRef(offset,ref);
+    if (rc) { return rc; }
+    return ReadOverflow(cache,ref,b.GetValLength(offset),value);
+  }
+  return b.GetVal(offset,value);
+}
+
+
+// The ith key's values, in a leaf of an index that isn't unique
+static ERROR_T GetLeafPostings(BufferCache *cache, const NodeMetadata &tree, const BTreeNode &b,
+			       const SIZE_T offset, vector<VALUE_T> &values)
+{
+  ERROR_T rc;
+  VALUE_T cell;
+  BTreePostings p;
+  string list;
+
+  values.clear();
+  rc=GetLeafVal(cache,b,offset,cell);
+  if (rc) { return rc; }
+  rc=GetPostings(tree,cell,p);
+  if (rc) { return rc; }
+  rc=ReadPostings(cache,tree,p,list);
+  if (rc) { return rc; }
+  return GetPostingValues(tree,list,values);
+}
+
+
+// The overflow and posting blocks of a leaf's pairs from first up to 
+// last, onto blocks, which go when the pairs do
+static ERROR_T GetLeafChains(BufferCache *cache, const NodeMetadata &tree, const BTreeNode &b,
+			     const SIZE_T first, const SIZE_T last, vector<SIZE_T> &blocks)
+{
+  ERROR_T rc;
+  VALUE_T cell;
+  BTreePostings p;
+  SIZE_T ref;
+
+  for (SIZE_T offset=first; offset<last; offset++) { 
+    if (!tree.IsUnique()) { 
+      rc=GetLeafVal(cache,b,offset,cell);
+      if (rc) { return rc; }
+      rc=GetPostings(tree,cell,p);
+      if (rc) { return rc; }
+      rc=GetChain(cache,p.first,blocks);
+      if (rc) { return rc; }
+    }
+    if (b.IsValRef(offset)) { 
+      rc=b.GetValRef(offset,ref);
+      if (rc) { return rc; }
+      rc=GetChain(cache,ref,blocks);
+      if (rc) { return rc; }
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+
+// tree is the index's superblock info
+static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplayType dt,
+			 const NodeMetadata &tree, BufferCache *cache)
+{
+  const char *key;
+  const char *value;
+  VALUE_T overflowvalue;
+  vector<VALUE_T> postings;
   SIZE_T ptr;
   SIZE_T offset;
   ERROR_T rc;
-  unsigned i;
+  unsigned i, v;
 
   if (dt==BTREE_DEPTH_DOT) { 
     os << nodenum << " [ label=\""<<nodenum<<": ";
@@ -289,10 +1069,9 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
 	os << "*" << ptr << " ";
 	// Last pointer
 	if (offset==b.info.numkeys) break;
-	rc=b.GetKey(offset,key);
-	if (rc) {  return rc; }
-	for (i=0;i<b.info.keysize;i++) { 
-	  os << key.data[i];
+	key=b.ResolveKey(offset);
+	for (i=0;i<b.GetKeyLength(offset);i++) { 
+	  os << key[i];
 	}
 	os << " ";
       }
@@ -303,6 +1082,26 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
     } else {
       os << "Leaf: ";
     }
+    if (dt==BTREE_SORTED_KEYVAL && !tree.IsUnique()) { 
+      // A pair for each of a key's values
+      for (offset=0;offset<b.info.numkeys;offset++) { 
+	rc=GetLeafPostings(cache,tree,b,offset,postings);
+	if (rc) { return rc; }
+	key=b.ResolveKey(offset);
+	for (v=0;v<postings.size();v++) { 
+	  os << "(";
+	  for (i=0;i<b.GetKeyLength(offset);i++) { 
+	    os << key[i];
+	  }
+	  os << ",";
+	  for (i=0;i<postings[v].length;i++) { 
+	    os << postings[v].data[i];
+	  }
+	  os << ")\n";
+	}
+      }
+      break;
+    }
     for (offset=0;offset<b.info.numkeys;offset++) { 
       if (offset==0) { 
 	// special case for first pointer
@@ -315,20 +1114,39 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
       if (dt==BTREE_SORTED_KEYVAL) { 
 	os << "(";
       }
-      rc=b.GetKey(offset,key);
-      if (rc) {  return rc; }
-      for (i=0;i<b.info.keysize;i++) { 
-	os << key.data[i];
+      key=b.ResolveKey(offset);
+      for (i=0;i<b.GetKeyLength(offset);i++) { 
+	os << key[i];
       }
       if (dt==BTREE_SORTED_KEYVAL) { 
 	os << ",";
       } else {
 	os << " ";
       }
-      rc=b.GetVal(offset,value);
-      if (rc) {  return rc; }
-      for (i=0;i<b.info.valuesize;i++) { 
-	os << value.data[i];
+      if (!tree.IsUnique()) { 
+	rc=GetLeafPostings(cache,tree,b,offset,postings);
+	if (rc) { return rc; }
+	os << "[";
+	for (v=0;v<postings.size();v++) { 
+	  os << (v>0 ? " " : "");
+	  for (i=0;i<postings[v].length;i++) { 
+	    os << postings[v].data[i];
+	  }
+	}
+	os << "]";
+      } else {
+	value=b.ResolveVal(offset);
+	if (b.IsValRef(offset)) { 
+	  SIZE_T ref;
+	  rc=b.GetValRef(offset,ref);
+	  if (rc) { return rc; }
+	  rc=ReadOverflow(cache,ref,b.GetValLength(offset),overflowvalue);
+	  if (rc) { return rc; }
+	  value=(const char*)overflowvalue.data;
+	}
+	for (i=0;i<b.GetValLength(offset);i++) { 
+	  os << value[i];
+	}
       }
       if (dt==BTREE_SORTED_KEYVAL) { 
 	os << ")\n";
@@ -352,281 +1170,2198 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
   
 ERROR_T BTreeIndex::Lookup(const KEY_T &key, VALUE_T &value)
 {
-  return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, value);
+  ERROR_T rc;
+  VALUE_T cell;
+  BTreePostings p;
+  string list;
+  SIZE_T next;
+
+  if (superblock.info.IsUnique()) { 
+    return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, value);
+  }
+
+  rc = LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, cell);
+  if (rc) { return rc; }
+  rc = GetPostings(superblock.info, cell, p);
+  if (rc) { return rc; }
+  if (p.count == 0) { 
+    return ERROR_NONEXISTENT;
+  }
+  // The first value is in the leaf, or the first posting block
+  list = p.inlined;
+  if (p.first) { 
+    rc = ReadPostingBlock(buffercache, superblock.info, p.first, list, next);
+    if (rc) { return rc; }
+  }
+  if (list.empty()) { 
+    return ERROR_INSANE;
+  }
+  GetPostingAt(superblock.info, list.data(), value);
+  return ERROR_NOERROR;
 }
 
-ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
+
+ERROR_T BTreeIndex::LookupAll(const KEY_T &key, vector<VALUE_T> &values)
 {
-  BTreeNode b;
   ERROR_T rc;
-  SIZE_T offset;
-  KEY_T testkey;
-  
-  cout << "Hello";
-
-  SIZE_T leaf;
-  SIZE_T& ptr = leaf;
-  
-  // If root hasn't been set yet
-  if (superblock.info.numkeys == 0) {
-    cout << "Inserting root node." << endl; 
-    b.Unserialize(buffercache, superblock.info.rootnode);
-    b.info.parent = 0; // NOTE: Not sure what the parent to the root node should be set to
-    b.info.numkeys = 1;
-    b.info.keysize = superblock.info.keysize;
-    b.info.valuesize = superblock.info.valuesize;
-    b.info.blocksize = buffercache->GetBlockSize();
-    b.info.nodetype = BTREE_ROOT_NODE;
-    cout << "Setting info data for root." << endl;
-   
-    // NOTE: not sure if this is needed
-    //rc = b.SetKey(0, key);
-    cout << "Key: " << key << endl;
-    cout << "Value: " << value << endl;
-    cout << "b.data: " << b.data << endl;
-    //b.data = key;
-    cout << "SetKey Root Call" << endl;
-    //rc = b.SetVal(0, value);
-    //key.data = value;
-    cout << "key.data: " << key.data << endl;
-    cout << "SetVal Root Call" << endl;
- 
-    // Write back to disk
-    b.Serialize(buffercache, superblock.info.rootnode);
-    cout << "Write root back to disk." << endl;
+  VALUE_T cell;
+  BTreePostings p;
+  string list;
+
+  values.clear();
+  if (superblock.info.IsUnique()) { 
+    rc = LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, cell);
+    if (rc) { return rc; }
+    values.push_back(cell);
+    return ERROR_NOERROR;
   }
 
-  else {
-  // Look up where the key should be inserted. Get a pointer for it. 
-  rc = LookupForInsert(superblock.info.rootnode, key, ptr);
+  rc = LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, cell);
+  if (rc) { return rc; }
+  rc = GetPostings(superblock.info, cell, p);
+  if (rc) { return rc; }
+  rc = ReadPostings(buffercache, superblock.info, p, list);
+  if (rc) { return rc; }
+  rc = GetPostingValues(superblock.info, list, values);
+  if (rc) { return rc; }
+  return values.empty() ? ERROR_NONEXISTENT : ERROR_NOERROR;
+}
+
 
-  // Standard error checking
-  if (rc!=ERROR_NOERROR) {
-    return rc;
+ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
+{
+  if (!superblock.info.IsUnique()) { 
+    return InsertDup(key, value);
   }
+  return InsertInternal(key, value);
+}
 
-  // Unserialize our node
-  b.Unserialize(buffercache, ptr);
 
-  // Now, let's search where to insert
-  for (offset=0;offset<b.info.numkeys;offset++) { 
-    // Get the key value
-    rc=b.GetKey(offset,testkey);
-    // Do standard error checking
-    if (rc) {  return rc; }
-
-    // If we find something
-    if(key<testkey) {
-      // then break out of the loop
-      break;
-    }
+ERROR_T BTreeIndex::InsertDup(const KEY_T &key, const VALUE_T &value)
+{
+  ERROR_T rc;
+  VALUE_T cell;
+  BTreePostings p;
+
+  if (superblock.info.IsUnique()) { 
+    return InsertInternal(key, value);
+  }
+  if (!superblock.info.IsKeySize(key.length) || !superblock.info.IsPostingSize(value.length)) { 
+    return ERROR_SIZE;
+  }
+
+  // A new key goes in with a list of just this value, and otherwise 
+  // the value goes into the key's list, which then goes back in its leaf
+  rc = LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, cell);
+  if (rc == ERROR_NONEXISTENT) { 
+    rc = AddPosting(p, value);
+    if (rc) { return rc; }
+    SetPostings(superblock.info, p, cell);
+    return InsertInternal(key, cell);
   }
+  if (rc) { return rc; }
 
-  // Offset holds the position to the left of where we want to insert; let's insert!
-  // We have to move each block over to the right by one. Start at the end which must
-  // be empty (we're defining full as 2/3 full, so no leaf is ever completely full)
+  rc = GetPostings(superblock.info, cell, p);
+  if (rc) { return rc; }
+  rc = AddPosting(p, value);
+  if (rc) { return rc; }
+  SetPostings(superblock.info, p, cell);
+  return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_UPDATE, key, cell);
+}
 
-  // NOTE: Might need to allocate an empty leaf
 
-  for (SIZE_T position = b.info.numkeys; position > offset; position--) {
-    SIZE_T prev;
-    b.GetPtr(position-1, prev);
+ERROR_T BTreeIndex::InsertInternal(const KEY_T &key, const VALUE_T &value)
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T offset;
+  SIZE_T leaf;
+  SIZE_T sibling;
+  SIZE_T ref = 0;
+  BTreePath path;
 
-    b.SetPtr(position, prev);
+  if (!superblock.info.IsKeySize(key.length) || !superblock.info.IsValueSize(value.length)) { 
+    return ERROR_SIZE;
   }
 
-  // NOTE: Where should be set the parent pointer?
+  // Keys past the end of the tree go straight to the rightmost leaf
+  if (rightleaf!=0 && rightnode.CompareKey(rightnode.info.numkeys-1, key)<0) { 
+    return AppendRightmost(key, value);
+  }
 
-  // Now that we've moved everything to the right, insert at the hole that is at offset+1
-  SIZE_T newNode;
-  SIZE_T& newNodePtr = newNode;
-  // AllocateNode passes the value by reference to newNodePtr, doesn't return it's value
-  rc = AllocateNode(newNodePtr);
+  rc = LoadResident();
+  if (rc) { return rc; }
 
-  // NOTE: Add error checking...
+  // The root is resident unless the budget is 0
+  if (!resident.empty()) { 
+    b = resident[0][superblock.info.rootnode];
+  } else {
+    rc = b.Unserialize(buffercache, superblock.info.rootnode);
+    if (rc) { return rc; }
+  }
 
-  // Store this new node's pointer into the list of the old one
-  b.SetPtr(offset, newNodePtr);
-  // We've added one new key, so increment numkeys
-  b.info.numkeys = b.info.numkeys+1;
+  // If root hasn't been set yet, give it our key and two leaves:
+  // the left one holds the key, the right one starts out empty
+  if (b.info.numkeys == 0) {
+    SIZE_T left, right;
+
+    rc = AllocateNode(left);
+    if (rc) { return rc; }
+    rc = AllocateNode(right);
+    if (rc) { return rc; }
+
+    BTreeNode leftleaf(BTREE_LEAF_NODE,
+		       superblock.info.keysize,
+		       superblock.info.valuesize,
+		       buffercache->GetBlockSize(),
+		       superblock.info.format,
+		       superblock.info.overflow);
+    if (superblock.info.IsOverflow(value.length)) { 
+      rc = WriteOverflow(value, ref);
+      if (rc) { return rc; }
+    }
+    rc = leftleaf.InsertKeyVal(0, key, value, ref);
+    if (rc) { return rc; }
 
-  // Get the leaf node to set it's properties
-  BTreeNode n;
-  // NOTE: this might need to be newNode
-  n.Unserialize(buffercache, newNodePtr);
+    BTreeNode rightleaf(BTREE_LEAF_NODE,
+			superblock.info.keysize,
+			superblock.info.valuesize,
+			buffercache->GetBlockSize(),
+			superblock.info.format,
+			superblock.info.overflow);
 
-  n.info.parent = ptr;
-  n.info.numkeys = 0;
-  n.info.keysize = superblock.info.keysize;
-  n.info.valuesize = superblock.info.valuesize;
-  n.info.blocksize = buffercache->GetBlockSize();
-  n.info.nodetype = BTREE_LEAF_NODE;
+    rc = leftleaf.SetPtr(0, right);
+    if (rc) { return rc; }
 
-  // NOTE: not sure if this is needed
-  n.SetKey(offset, key);
-  n.SetVal(offset, value);
+    b.info.numkeys = 1;
+    rc = b.SetKey(0, key);
+    if (rc) { return rc; }
+    rc = b.SetPtr(0, left);
+    if (rc) { return rc; }
+    rc = b.SetPtr(1, right);
+    if (rc) { return rc; }
+
+    rc = leftleaf.Serialize(buffercache, left);
+    if (rc) { return rc; }
+    rc = rightleaf.Serialize(buffercache, right);
+    if (rc) { return rc; }
+    rc = WriteNode(b, superblock.info.rootnode);
+    if (rc) { return rc; }
 
-  // Write back to disk
-  n.Serialize(buffercache, newNodePtr);
+    return ERROR_NOERROR;
+  }
 
-  // If our node is more than 2/3 full, then that's too full. We need to split the node 
-  // in half. Num slots holds the max number, we define the max as 2/3 full
-  SIZE_T numslots = b.info.GetNumSlotsAsLeaf();
-  SIZE_T full = floor((2/3) * (float)numslots);
+  // Look up the leaf the key should be inserted into, remembering
+  // how we got there in case splits have to go back up
+  rc = LookupForInsert(superblock.info.rootnode, key, leaf, 0, &path);
+  if (rc) { return rc; }
 
-  // Uh-oh; it looks like it's too full...we need to split our node
-  if (b.info.numkeys >= full) {
-    // We want to split the keys amongst two new nodes. Find approximately
-    // half for the left, and then give the rest to the right node
-    SIZE_T numkeysLeft = floor((1/2) * b.info.numkeys);
-    SIZE_T numkeysRight = b.info.numkeys - numkeysLeft;
+  rc = b.Unserialize(buffercache, leaf);
+  if (rc) { return rc; }
 
-    SIZE_T rightNode;
-    SIZE_T& rightNodePtr = rightNode;
-    rc = AllocateNode(rightNodePtr);
+  // Now, let's search where to insert
+  rc = b.LowerBound(key, offset);
+  if (rc) { return rc; }
 
-    BTreeNode rightLeafNode;
-    // NOTE: this might need to be rightLeafNode
-    rightLeafNode.Unserialize(buffercache, rightNodePtr);
+  if (offset < b.info.numkeys && b.CompareKey(offset, key) == 0) { 
+    return ERROR_CONFLICT;
+  }
 
-    rightLeafNode.info.parent = b.info.parent;
-    rightLeafNode.info.numkeys = numkeysRight;
-    rightLeafNode.info.keysize = superblock.info.keysize;
-    rightLeafNode.info.valuesize = superblock.info.valuesize;
-    rightLeafNode.info.blocksize = buffercache->GetBlockSize();
-    rightLeafNode.info.nodetype = BTREE_LEAF_NODE;
+  if (superblock.info.IsOverflow(value.length)) { 
+    rc = WriteOverflow(value, ref);
+    if (rc) { return rc; }
+  }
 
-    for (int i = numkeysLeft; i < b.info.numkeys; i++) {
-      SIZE_T temp;
-      rc = b.GetPtr(i, temp);
-      // NOTE: error checking
+  // A leaf is never left completely full, so there is always room here
+  rc = b.InsertKeyVal(offset, key, value, ref);
+  if (rc) { return rc; }
 
-      rc = rightLeafNode.SetPtr(i-numkeysLeft, temp);
-      // NOTE: error checking
-    }
+  // If that used up the last slot, split the node
+  if (b.info.numkeys >= b.GetNumSlotsAsLeaf()) {
+    // which may move the rightmost leaf, or the path to it
+    rightleaf = 0;
+    return SplitLeaf(path, b, offset);
+  }
 
-    b.info.numkeys = numkeysLeft;
+  rc = b.Serialize(buffercache, leaf);
+  if (rc) { return rc; }
 
-    b.Serialize(buffercache, ptr);
-    rightLeafNode.Serialize(buffercache, rightNodePtr);
-  }
+  // If this is the rightmost leaf, keep it for the appends that follow
+  rc = b.GetPtr(0, sibling);
+  if (rc) { return rc; }
+  if (sibling == 0) { 
+    rightleaf = leaf;
+    rightnode = b;
+    rightpath = path;
+    rightpathok = true;
   }
   return ERROR_NOERROR;
 }
 
-ERROR_T BTreeIndex::LookupForInsert(const SIZE_T &node, const KEY_T &key, SIZE_T &returnVal) {
-  BTreeNode b;
-  ERROR_T rc;
-  SIZE_T offset;
-  KEY_T testkey;
-  SIZE_T ptr;
 
-  // Get the root node to start our search!
-  rc = b.Unserialize(buffercache,node);
-  // Do some extra error checking (like update does)
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+ERROR_T BTreeIndex::AppendRightmost(const KEY_T &key, const VALUE_T &value)
+{
+  ERROR_T rc;
+  SIZE_T numkeys = rightnode.info.numkeys;
+  SIZE_T newleaf;
+  SIZE_T sibling;
+  bool split;
+  SIZE_T ref = 0;
+  KEY_T splitkey;
+  BTreePath path;
+
+  numappends++;
+
+  if (superblock.info.IsOverflow(value.length)) { 
+    rc = WriteOverflow(value, ref);
+    if (rc) { return rc; }
   }
 
-  // Start the searching process, recursively moving down the tree
-  // until we find our value
-  switch (b.info.nodetype) { 
-  case BTREE_ROOT_NODE:
-  case BTREE_INTERIOR_NODE:
-    // Scan through key/ptr pairs
-    //and recurse if possible
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (key<testkey || key==testkey) {
-        // OK, so we now have the first key that's larger
-        // so we ned to recurse on the ptr immediately previous to 
-        // this one, if it exists
-        rc=b.GetPtr(offset,ptr);
-        if (rc) { return rc; }
-        return LookupForInsert(ptr,key,returnVal);
-      }
-    }
-    // if we got here, we need to go to the next pointer, if it exists
-    if (b.info.numkeys>0) { 
-      rc=b.GetPtr(b.info.numkeys,ptr);
-      if (rc) { return rc; }
-      return LookupForInsert(ptr,key,returnVal);
-    } else {
-      // There are no keys at all on this node, so nowhere to go
-      return ERROR_NONEXISTENT;
-    }
-    break;
-  case BTREE_LEAF_NODE:
-    // We've found our leaf node, return up and do some searching
-    // Pointer to the node itself
-    returnVal = node;
+  rc = rightnode.InsertKeyVal(numkeys, key, value, ref);
+  if (rc) { return rc; }
+
+  // Done if that left the last slot free, else take it back out
+  if (rightnode.info.numkeys < rightnode.GetNumSlotsAsLeaf()) { 
+    rc = rightnode.Serialize(buffercache, rightleaf);
+    if (rc) { return rc; }
     return ERROR_NOERROR;
-    break;
-  default:
-    // We can't be looking at anything other than a root, internal, or leaf
-    return ERROR_INSANE;
-    break;
   }
-}
-  
-ERROR_T BTreeIndex::Update(const KEY_T &key, const VALUE_T &value)
-{
-  // WRITE ME
-  VALUE_T temp = value;
-  return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_UPDATE, key, temp);
-  return ERROR_UNIMPL;
+  rightnode.info.numkeys = numkeys;
+
+  // Nothing will ever go to the left of this key again, so rather than 
+  // split the leaf, leave it full and start a new one after it.  That 
+  // needs the parent, so find the way down again if a split lost it.
+  if (!rightpathok) { 
+    SIZE_T leaf;
+
+    rc = LookupForInsert(superblock.info.rootnode, key, leaf, 0, &rightpath);
+    if (rc) { return rc; }
+    if (leaf != rightleaf) { 
+      return ERROR_INSANE;
+    }
+    rightpathok = true;
+  }
+
+  rc = AllocateNode(newleaf);
+  if (rc) { return rc; }
+
+  BTreeNode right(BTREE_LEAF_NODE,
+		  superblock.info.keysize,
+		  superblock.info.valuesize,
+		  buffercache->GetBlockSize(),
+		  superblock.info.format,
+		  superblock.info.overflow);
+  rc = right.InsertKeyVal(0, key, value, ref);
+  if (rc) { return rc; }
+
+  rc = rightnode.GetPtr(0, sibling);
+  if (rc) { return rc; }
+  rc = right.SetPtr(0, sibling);
+  if (rc) { return rc; }
+  rc = rightnode.SetPtr(0, newleaf);
+  if (rc) { return rc; }
+  rc = rightnode.GetKey(numkeys-1, splitkey);
+  if (rc) { return rc; }
+
+  rc = rightnode.Serialize(buffercache, rightleaf);
+  if (rc) { return rc; }
+  rc = right.Serialize(buffercache, newleaf);
+  if (rc) { return rc; }
+
+  path = rightpath;
+  rightleaf = newleaf;
+  rightnode = right;
+  rightpath.node[path.depth-1] = newleaf;
+  rightpath.slot[path.depth-2]++;
+
+  // If the parent split too, the path is stale
+  rc = InsertIntoParent(path, path.depth-2, splitkey, newleaf, &split);
+  rightpathok = !split;
+  return rc;
 }
 
-  
-ERROR_T BTreeIndex::Delete(const KEY_T &key)
+
+SIZE_T BTreeSplitPolicy::SplitPoint(const SIZE_T numkeys, const SIZE_T offset) const
 {
-  // This is optional extra credit 
-  //
-  // 
-  return ERROR_UNIMPL;
+  SIZE_T left;
+
+  if (type==BTREE_SPLIT_RIGHT || (type==BTREE_SPLIT_KEY && offset+1>=numkeys)) { 
+    left = (SIZE_T)(fill*numkeys);
+  } else if (type==BTREE_SPLIT_KEY && offset==0) { 
+    left = numkeys - (SIZE_T)(fill*numkeys);
+  } else {
+    left = numkeys/2;
+  }
+  if (left<1) { 
+    left = 1;
+  }
+  if (left>numkeys-1) { 
+    left = numkeys-1;
+  }
+  return left;
 }
 
-  
-//
-//
-// DEPTH first traversal
-// DOT is Depth + DOT format
-//
 
-ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
-				    ostream &o,
-				    BTreeDisplayType display_type) const
+const char *BTreeSplitPolicy::GetName() const
 {
-  KEY_T testkey;
-  SIZE_T ptr;
-  BTreeNode b;
-  ERROR_T rc;
-  SIZE_T offset;
+  return type==BTREE_SPLIT_RIGHT ? "right" : type==BTREE_SPLIT_KEY ? "key" : "even";
+}
 
-  rc= b.Unserialize(buffercache,node);
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+ERROR_T BTreeSplitPolicy::Parse(const char *spec, BTreeSplitPolicy &policy)
+{
+  const char *colon = strchr(spec,':');
+  string name = colon ? string(spec,colon-spec) : string(spec);
+
+  policy = BTreeSplitPolicy();
+  if (name=="even") { 
+    policy.type = BTREE_SPLIT_EVEN;
+  } else if (name=="right") { 
+    policy.type = BTREE_SPLIT_RIGHT;
+  } else if (name=="key") { 
+    policy.type = BTREE_SPLIT_KEY;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  if (colon) { 
+    if (sscanf(colon+1,"%lf",&policy.fill)!=1 || 
+	!(policy.fill>=0.5 && policy.fill<1)) { 
+      return ERROR_BADCONFIG;
+    }
   }
+  return ERROR_NOERROR;
+}
 
-  rc = PrintNode(o,node,b,display_type);
-  
-  if (rc) { return rc; }
 
-  if (display_type==BTREE_DEPTH_DOT) { 
-    o << ";";
+ERROR_T ParseBTreeDeletePolicy(const char *name, BTreeDeletePolicy &policy)
+{
+  if (!strcmp(name,"eager")) { 
+    policy = BTREE_DELETE_EAGER;
+  } else if (!strcmp(name,"lazy")) { 
+    policy = BTREE_DELETE_LAZY;
+  } else {
+    return ERROR_BADCONFIG;
   }
+  return ERROR_NOERROR;
+}
 
-  if (display_type!=BTREE_SORTED_KEYVAL) {
-    o << endl;
-  }
+
+const char *GetBTreeDeletePolicyName(const BTreeDeletePolicy policy)
+{
+  return policy==BTREE_DELETE_LAZY ? "lazy" : "eager";
+}
+
+
+// Whether splitting a leaf with left keys on the left leaves both sides a
+// free slot
+static bool SplitLeavesRoom(const BTreeNode &b, const SIZE_T left)
+{
+  SIZE_T right = b.info.numkeys-left;
+
+  return left < b.GetNumSlotsAsLeaf(0, left) && right < b.GetNumSlotsAsLeaf(left, right);
+}
+
+ERROR_T BTreeIndex::SplitLeaf(const BTreePath &path, BTreeNode &b, const SIZE_T offset)
+{
+  ERROR_T rc;
+  SIZE_T node = path.node[path.depth-1];
+  SIZE_T rightnode;
+  SIZE_T sibling;
+  KEY_T splitkey;
+
+  rc = AllocateNode(rightnode);
+  if (rc) { return rc; }
+
+  // Left keeps the lower keys, as many as the policy says, and right
+  // gets the rest
+  SIZE_T numkeysLeft = splitpolicy.SplitPoint(b.info.numkeys, offset);
+
+  // Both sides need room for another pair.  In a prefix leaf, a key 
+  // past either end that shortens the prefix can take away several slots
+  // at once, and in a slotted leaf the pairs are of different sizes, so
+  // the policy's point may not leave it.  Take the nearest that does;
+  // splitting such a key off from the others, as they were, always will.
+  if (!SplitLeavesRoom(b, numkeysLeft)) { 
+    for (SIZE_T d=1; d<b.info.numkeys; d++) { 
+      if (numkeysLeft > d && SplitLeavesRoom(b, numkeysLeft-d)) { 
+	numkeysLeft -= d;
+	break;
+      }
+      if (numkeysLeft+d < b.info.numkeys && SplitLeavesRoom(b, numkeysLeft+d)) { 
+	numkeysLeft += d;
+	break;
+      }
+    }
+  }
+
+  BTreeNode right(BTREE_LEAF_NODE,
+		  superblock.info.keysize,
+		  superblock.info.valuesize,
+		  buffercache->GetBlockSize(),
+		  superblock.info.format,
+		  superblock.info.overflow);
+  right.info.numkeys = b.info.numkeys - numkeysLeft;
+  memcpy(right.ResolveKeyVal(0), b.ResolveKeyVal(numkeysLeft),
+	 right.info.numkeys*(b.info.GetKeySlotBytes()+b.info.GetValueSlotBytes()));
+
+  b.info.numkeys = numkeysLeft;
+
+  // Splice the new leaf in after us in the sibling chain
+  rc = b.GetPtr(0, sibling);
+  if (rc) { return rc; }
+  rc = right.SetPtr(0, sibling);
+  if (rc) { return rc; }
+  rc = b.SetPtr(0, rightnode);
+  if (rc) { return rc; }
+
+  // Keys <= the last key on the left belong to the left
+  rc = b.GetKey(numkeysLeft-1, splitkey);
+  if (rc) { return rc; }
+
+  rc = b.Serialize(buffercache, node);
+  if (rc) { return rc; }
+  rc = right.Serialize(buffercache, rightnode);
+  if (rc) { return rc; }
+
+  return InsertIntoParent(path, path.depth-2, splitkey, rightnode);
+}
+
+
+ERROR_T BTreeIndex::SplitInterior(const BTreePath &path, const SIZE_T level, BTreeNode &b,
+				  const SIZE_T offset)
+{
+  ERROR_T rc;
+  SIZE_T node = path.node[level];
+  SIZE_T rightnode;
+  KEY_T splitkey;
+
+  rc = AllocateNode(rightnode);
+  if (rc) { return rc; }
+
+  // The key at the split point moves up, the keys and pointers after it
+  // move right.  Both sides keep at least one key.
+  SIZE_T mid = splitpolicy.SplitPoint(b.info.numkeys, offset);
+
+  if (mid > b.info.numkeys-2) { 
+    mid = b.info.numkeys-2;
+  }
+
+  rc = b.GetKey(mid, splitkey);
+  if (rc) { return rc; }
+
+  BTreeNode right(BTREE_INTERIOR_NODE,
+		  superblock.info.keysize,
+		  superblock.info.valuesize,
+		  buffercache->GetBlockSize(),
+		  superblock.info.format,
+		  superblock.info.overflow);
+  right.info.numkeys = b.info.numkeys - mid - 1;
+  memcpy(right.ResolvePtr(0), b.ResolvePtr(mid+1),
+	 right.info.numkeys*(b.info.GetKeySlotBytes()+sizeof(SIZE_T))+sizeof(SIZE_T));
+
+  b.info.numkeys = mid;
+
+  // The new node belongs on a resident level
+  if (level < resident.size()) { 
+    residentstale = true;
+  }
+
+  if (level == 0) { 
+    // Splitting the root grows the tree by one level
+    SIZE_T newrootnode;
+
+    rc = AllocateNode(newrootnode);
+    if (rc) { return rc; }
+
+    BTreeNode newroot(BTREE_ROOT_NODE,
+		      superblock.info.keysize,
+		      superblock.info.valuesize,
+		      buffercache->GetBlockSize(),
+		      superblock.info.format,
+		      superblock.info.overflow);
+    newroot.info.numkeys = 1;
+    rc = newroot.SetKey(0, splitkey);
+    if (rc) { return rc; }
+    rc = newroot.SetPtr(0, node);
+    if (rc) { return rc; }
+    rc = newroot.SetPtr(1, rightnode);
+    if (rc) { return rc; }
+
+    b.info.nodetype = BTREE_INTERIOR_NODE;
+
+    rc = b.Serialize(buffercache, node);
+    if (rc) { return rc; }
+    rc = right.Serialize(buffercache, rightnode);
+    if (rc) { return rc; }
+    rc = newroot.Serialize(buffercache, newrootnode);
+    if (rc) { return rc; }
+
+    superblock.info.rootnode = newrootnode;
+    return superblock.Serialize(buffercache, superblock_index);
+  }
+
+  rc = b.Serialize(buffercache, node);
+  if (rc) { return rc; }
+  rc = right.Serialize(buffercache, rightnode);
+  if (rc) { return rc; }
+
+  return InsertIntoParent(path, level-1, splitkey, rightnode);
+}
+
+
+ERROR_T BTreeIndex::InsertIntoParent(const BTreePath &path, 
+				     const SIZE_T level,
+				     const KEY_T &key, 
+				     const SIZE_T &rightnode,
+				     bool *split)
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T node = path.node[level];
+
+  if (split) { 
+    *split = false;
+  }
+
+  rc = b.Unserialize(buffercache, node);
+  if (rc) { return rc; }
+
+  // The split child sits at the slot we came down through, so the
+  // key goes there and the new right child goes just after it
+  rc = b.InsertKeyPtr(path.slot[level], key, rightnode);
+  if (rc) { return rc; }
+
+  if (b.info.numkeys >= b.info.GetNumSlotsAsInterior()) { 
+    if (split) { 
+      *split = true;
+    }
+    return SplitInterior(path, level, b, path.slot[level]);
+  }
+
+  return WriteNode(b, node);
+}
+
+
+ERROR_T BTreeIndex::LookupForInsert(const SIZE_T &node, const KEY_T &key, SIZE_T &returnVal,
+				    KEY_T *upper, BTreePath *path) {
+  BTreeNodeView b;
+  ERROR_T rc;
+  SIZE_T offset;
+  SIZE_T ptr = node;
+  SIZE_T depth;
+
+  rc = LoadResident();
+  if (rc) { return rc; }
+
+  // Walk down from node, one level per iteration, until we hit a leaf
+  for (depth=0; depth<BTREE_MAX_DEPTH; depth++) { 
+    if (levelstats.size()<=depth) { 
+      levelstats.resize(depth+1);
+    }
+
+    // The top levels are resident, so they don't touch the cache
+    ResidentLevel::const_iterator r;
+    if (depth<resident.size() && (r=resident[depth].find(ptr))!=resident[depth].end()) { 
+      const BTreeNode &n = (*r).second;
+
+      levelstats[depth].residenthits++;
+      if (path) { 
+	path->node[depth] = ptr;
+	path->depth = depth+1;
+      }
+      if (n.info.numkeys==0) { 
+	return ERROR_NONEXISTENT;
+      }
+      rc=n.LowerBound(key,offset);
+      if (rc) { return rc; }
+      rc=n.GetPtr(offset,ptr);
+      if (rc) { return rc; }
+      if (upper && offset<n.info.numkeys) { 
+	rc=n.GetKey(offset,*upper);
+	if (rc) { return rc; }
+      }
+      if (path) { 
+	path->slot[depth] = offset;
+      }
+      continue;
+    }
+
+    levelstats[depth].cachereads++;
+
+    // Interior nodes are only read, so look at them in place
+    rc = b.Pin(buffercache,ptr);
+    // Do some extra error checking (like update does)
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+
+    if (path) { 
+      path->node[depth] = ptr;
+      path->depth = depth+1;
+    }
+
+    switch (b.info->nodetype) { 
+    case BTREE_ROOT_NODE:
+    case BTREE_INTERIOR_NODE:
+      if (b.info->numkeys==0) { 
+	// There are no keys at all on this node, so nowhere to go
+	return ERROR_NONEXISTENT;
+      }
+      // Find the first key that's >= ours and go down the ptr 
+      // immediately previous to it, or the last ptr if there is none
+      rc=b.LowerBound(key,offset);
+      if (rc) { return rc; }
+      rc=b.GetPtr(offset,ptr);
+      if (rc) { return rc; }
+      if (upper && offset<b.info->numkeys) { 
+	rc=b.GetKey(offset,*upper);
+	if (rc) { return rc; }
+      }
+      if (path) { 
+	path->slot[depth] = offset;
+      }
+      break;
+    case BTREE_LEAF_NODE:
+      // We've found our leaf node
+      returnVal = ptr;
+      return ERROR_NOERROR;
+      break;
+    default:
+      // We can't be looking at anything other than a root, internal, or leaf
+      return ERROR_INSANE;
+      break;
+    }
+  }
+
+  // Deeper than any tree we could have built
+  return ERROR_INSANE;
+}
+
+  
+struct BatchKeyLessThan {
+  const vector<KeyValuePair> &pairs;
+  BatchKeyLessThan(const vector<KeyValuePair> &p) : pairs(p) {}
+  bool operator()(const SIZE_T a, const SIZE_T b) const {
+    return pairs[a].key<pairs[b].key;
+  }
+};
+
+
+static bool KeyPtrLessThan(const KeyPtrPair &a, const KeyPtrPair &b)
+{
+  return a.first<b.first;
+}
+
+
+//
+// Spreads num items as evenly as possible over numgroups groups,
+// the first num%numgroups groups getting one extra
+//
+static SIZE_T GroupStart(const SIZE_T num, const SIZE_T numgroups, const SIZE_T group)
+{
+  SIZE_T q=num/numgroups, r=num%numgroups;
+  return group*q + (group<r ? group : r);
+}
+
+//
+// Where each leaf starts when a sorted run of pairs, whose values are
+// vallens long, is packed into as few leaves as keep each within fill of
+// its space, as evenly as that allows, with the end of the run last.  
+// Every leaf's keys begin with whatever the first and last keys do.  A 
+// slotted leaf's space is its bytes, less what the largest pair takes.
+//
+static void PlanLeaves(const NodeMetadata &info, const vector<KeyValuePair> &pairs, 
+		       const vector<SIZE_T> &vallens, const double fill, 
+		       vector<SIZE_T> &starts)
+{
+  SIZE_T i, n;
+
+  starts.clear();
+  if (info.format!=BTREE_FORMAT_SLOTTED) { 
+    SIZE_T prefix = pairs.empty() ? 0 : 
+      info.GetLeafPrefix((char*)pairs.front().key.data, (char*)pairs.back().key.data);
+    SIZE_T perleaf = (SIZE_T)(fill*(info.GetNumSlotsAsLeaf(prefix)-1));
+
+    if (perleaf<1) { perleaf=1; }
+    n = (pairs.size()+perleaf-1)/perleaf;
+    if (n<1) { n=1; }
+    for (i=0; i<=n; i++) { 
+      starts.push_back(GroupStart(pairs.size(), n, i));
+    }
+    return;
+  }
+
+  SIZE_T total = 0;
+  SIZE_T space = (SIZE_T)(fill*(info.GetNumDataBytes()-sizeof(SIZE_T)-info.GetSlottedPairBytes()));
+  for (i=0; i<pairs.size(); i++) { 
+    total += info.GetSlottedPairBytes(pairs[i].key.length, vallens[i]);
+  }
+  if (space<1) { space=1; }
+  n = (total+space-1)/space;
+  if (n<1) { n=1; }
+
+  // Aim for the same bytes in each, but never past the space
+  SIZE_T target = (total+n-1)/n;
+  starts.push_back(0);
+  i = 0;
+  while (i<pairs.size()) { 
+    SIZE_T used = 0;
+    while (i<pairs.size()) { 
+      SIZE_T bytes = info.GetSlottedPairBytes(pairs[i].key.length, vallens[i]);
+      if (used>0 && (used>=target || used+bytes>space)) { 
+	break;
+      }
+      used += bytes;
+      i++;
+    }
+    starts.push_back(i);
+  }
+  if (starts.size()==1) { 
+    starts.push_back(0);
+  }
+}
+
+ERROR_T BTreeIndex::BulkLoad(const vector<KeyValuePair> &pairs, const double fill)
+{
+  BTreeNode root;
+  ERROR_T rc;
+  SIZE_T i, j;
+  vector<KeyValuePair> cells;
+
+  if (superblock.info.IsUnique()) { 
+    return BulkLoadInternal(pairs, fill);
+  }
+
+  if (fill<=0 || fill>1) { 
+    return ERROR_BADCONFIG;
+  }
+  for (i=0; i<pairs.size(); i++) { 
+    if (!superblock.info.IsKeySize(pairs[i].key.length) || 
+	!superblock.info.IsPostingSize(pairs[i].value.length)) { 
+      return ERROR_SIZE;
+    }
+    if (i>0 && (pairs[i].key<pairs[i-1].key || 
+		(pairs[i].key==pairs[i-1].key && !(pairs[i-1].value<pairs[i].value)))) { 
+      return ERROR_CONFLICT;
+    }
+  }
+  rc = root.Unserialize(buffercache, superblock.info.rootnode);
+  if (rc) { return rc; }
+  if (root.info.numkeys!=0) { 
+    return ERROR_CONFLICT;
+  }
+
+  // Each key's values become its list, which goes in its leaf or, if 
+  // it is too long, in posting blocks written ahead of the tree
+  for (i=0; i<pairs.size(); i=j) { 
+    BTreePostings p;
+    string list;
+
+    for (j=i; j<pairs.size() && pairs[j].key==pairs[i].key; j++) { 
+      list += MakePosting(superblock.info, pairs[j].value);
+    }
+    p.count = j-i;
+    if (sizeof(SIZE_T)+list.size() <= superblock.info.GetPostingCellBytes()) { 
+      p.inlined = list;
+    } else {
+      rc = WritePostings(list, p);
+      if (rc) { return rc; }
+    }
+    cells.push_back(KeyValuePair(pairs[i].key, VALUE_T()));
+    SetPostings(superblock.info, p, cells.back().value);
+  }
+  return BulkLoadInternal(cells, fill);
+}
+
+
+ERROR_T BTreeIndex::BulkLoadInternal(const vector<KeyValuePair> &pairs, const double fill)
+{
+  BTreeNode root;
+  ERROR_T rc;
+  SIZE_T i, j, level;
+
+  if (fill<=0 || fill>1) { 
+    return ERROR_BADCONFIG;
+  }
+
+  for (i=0; i<pairs.size(); i++) { 
+    if (!superblock.info.IsKeySize(pairs[i].key.length) || 
+	!superblock.info.IsValueSize(pairs[i].value.length)) { 
+      return ERROR_SIZE;
+    }
+    if (i>0 && !(pairs[i-1].key<pairs[i].key)) { 
+      return ERROR_CONFLICT;
+    }
+  }
+
+  rc = root.Unserialize(buffercache, superblock.info.rootnode);
+  if (rc) { return rc; }
+  if (root.info.numkeys!=0) { 
+    return ERROR_CONFLICT;
+  }
+  if (pairs.size()==0) { 
+    return ERROR_NOERROR;
+  }
+
+  // Values that overflow get their blocks first, so every block is 
+  // still written in the order it was allocated
+  vector<SIZE_T> vallens(pairs.size());
+  vector<SIZE_T> refs(pairs.size(), 0);
+  for (i=0; i<pairs.size(); i++) { 
+    vallens[i] = pairs[i].value.length;
+    if (superblock.info.IsOverflow(vallens[i])) { 
+      rc = WriteOverflow(pairs[i].value, refs[i]);
+      if (rc) { return rc; }
+    }
+  }
+
+  // Like Insert, never fill a node's last slot
+  vector<SIZE_T> leafstarts;
+  SIZE_T perinterior = (SIZE_T)(fill*(root.info.GetNumSlotsAsInterior()-1));
+  PlanLeaves(superblock.info, pairs, vallens, fill, leafstarts);
+  if (perinterior<2) { perinterior=2; }
+
+  // Work out how many nodes each level needs, leaves first.  A root 
+  // needs at least one key, so a lone leaf is split in two, just as the
+  // first insert gives it an empty right sibling.
+  vector<SIZE_T> levelsize;
+  if (leafstarts.size()==2) { 
+    leafstarts.insert(leafstarts.begin()+1, GroupStart(pairs.size(), 2, 1));
+  }
+  levelsize.push_back(leafstarts.size()-1);
+  while (levelsize.back()>1) { 
+    levelsize.push_back((levelsize.back()+perinterior)/(perinterior+1));
+  }
+
+  // Allocate everything up front so siblings and children are known 
+  // before any node is written.  The top level is the existing root.
+  vector< vector<SIZE_T> > blocks(levelsize.size());
+  for (level=0; level+1<levelsize.size(); level++) { 
+    for (j=0; j<levelsize[level]; j++) { 
+      SIZE_T n;
+      rc = AllocateNode(n);
+      if (rc) { return rc; }
+      blocks[level].push_back(n);
+    }
+  }
+  blocks.back().push_back(superblock.info.rootnode);
+
+  // The largest key under each node of the level just written
+  vector<KEY_T> maxkeys;
+
+  for (j=0; j<levelsize[0]; j++) { 
+    BTreeNode leaf(BTREE_LEAF_NODE,
+		   superblock.info.keysize,
+		   superblock.info.valuesize,
+		   buffercache->GetBlockSize(),
+		   superblock.info.format,
+		   superblock.info.overflow);
+    SIZE_T first = leafstarts[j];
+    SIZE_T last = leafstarts[j+1];
+
+    leaf.info.numkeys = last-first;
+    for (i=first; i<last; i++) { 
+      if (refs[i]) { 
+	rc = leaf.SetKey(i-first, pairs[i].key);
+	if (rc) { return rc; }
+	rc = leaf.SetValRef(i-first, vallens[i], refs[i]);
+      } else {
+	rc = leaf.SetKeyVal(i-first, pairs[i]);
+      }
+      if (rc) { return rc; }
+    }
+    rc = leaf.SetPtr(0, j+1<levelsize[0] ? blocks[0][j+1] : 0);
+    if (rc) { return rc; }
+
+    rc = leaf.Serialize(buffercache, blocks[0][j]);
+    if (rc) { return rc; }
+
+    maxkeys.push_back(last>first ? pairs[last-1].key : KEY_T());
+  }
+
+  for (level=1; level<levelsize.size(); level++) { 
+    vector<KEY_T> childmaxkeys;
+    SIZE_T numchildren = levelsize[level-1];
+
+    childmaxkeys.swap(maxkeys);
+
+    for (j=0; j<levelsize[level]; j++) { 
+      bool isroot = level+1==levelsize.size();
+      BTreeNode node(isroot ? BTREE_ROOT_NODE : BTREE_INTERIOR_NODE,
+		     superblock.info.keysize,
+		     superblock.info.valuesize,
+		     buffercache->GetBlockSize(),
+		     superblock.info.format,
+		     superblock.info.overflow);
+      SIZE_T first = GroupStart(numchildren, levelsize[level], j);
+      SIZE_T last = GroupStart(numchildren, levelsize[level], j+1);
+
+      node.info.numkeys = last-first-1;
+      for (i=first; i<last; i++) { 
+	rc = node.SetPtr(i-first, blocks[level-1][i]);
+	if (rc) { return rc; }
+	if (i+1<last) { 
+	  rc = node.SetKey(i-first, childmaxkeys[i]);
+	  if (rc) { return rc; }
+	}
+      }
+
+      rc = node.Serialize(buffercache, blocks[level][j]);
+      if (rc) { return rc; }
+
+      maxkeys.push_back(childmaxkeys[last-1]);
+    }
+  }
+
+  residentstale = true;
+  rightleaf = 0;
+  return superblock.Serialize(buffercache, superblock_index);
+}
+
+
+ERROR_T BTreeIndex::InsertBatch(const vector<KeyValuePair> &pairs, 
+				vector<ERROR_T> *results)
+{
+  BTreeNode root;
+  ERROR_T rc;
+  SIZE_T i, j;
+  vector<SIZE_T> order;
+  vector<ERROR_T> myresults;
+  PendingSeparators pending;
+  NodeParents parents;
+
+  if (!results) { 
+    results = &myresults;
+  }
+  results->assign(pairs.size(), ERROR_NOERROR);
+
+  for (i=0; i<pairs.size(); i++) { 
+    if (!superblock.info.IsKeySize(pairs[i].key.length) || 
+	!(superblock.info.IsUnique() ? superblock.info.IsValueSize(pairs[i].value.length) :
+	  superblock.info.IsPostingSize(pairs[i].value.length))) { 
+      results->assign(pairs.size(), ERROR_SIZE);
+      return ERROR_SIZE;
+    }
+    order.push_back(i);
+  }
+
+  // Each pair has to go into its key's list, so they go one at a time
+  if (!superblock.info.IsUnique()) { 
+    for (i=0; i<pairs.size(); i++) { 
+      rc = InsertDup(pairs[i].key, pairs[i].value);
+      (*results)[i] = rc;
+      if (rc && rc!=ERROR_CONFLICT) { 
+	return rc;
+      }
+    }
+    for (i=0; i<results->size(); i++) { 
+      if ((*results)[i]!=ERROR_NOERROR) { 
+	return ERROR_CONFLICT;
+      }
+    }
+    return ERROR_NOERROR;
+  }
+
+  // Sort positions rather than the pairs themselves; stable so the first
+  // of several equal keys is the one that gets in
+  stable_sort(order.begin(), order.end(), BatchKeyLessThan(pairs));
+
+  i = 0;
+
+  rc = root.Unserialize(buffercache, superblock.info.rootnode);
+  if (rc) { return rc; }
+  if (root.info.numkeys == 0 && i < order.size()) { 
+    // An empty tree needs its first leaves before there is anything to descend
+    rc = Insert(pairs[order[0]].key, pairs[order[0]].value);
+    (*results)[order[0]] = rc;
+    if (rc) { return rc; }
+    i = 1;
+  }
+
+  // Leaves will be rewritten and split without going through Insert
+  rightleaf = 0;
+
+  while (i < order.size()) { 
+    SIZE_T leaf;
+    KEY_T upper;
+    BTreePath path;
+
+    rc = LookupForInsert(superblock.info.rootnode, pairs[order[i]].key, leaf, &upper, &path);
+    if (rc) { return rc; }
+
+    // Remember who points at what, for when splits go back up
+    for (j=1; j<path.depth; j++) { 
+      parents[path.node[j]] = path.node[j-1];
+    }
+
+    // Everything up to the separator above this leaf goes in with it
+    for (j=i+1; j<order.size(); j++) { 
+      if (upper.length>0 && upper<pairs[order[j]].key) { 
+	break;
+      }
+    }
+
+    rc = InsertBatchIntoLeaf(leaf, parents[leaf], pairs, order, i, j, *results, pending);
+    if (rc) { return rc; }
+
+    i = j;
+  }
+
+  rc = InsertIntoParents(pending, parents);
+  if (rc) { return rc; }
+
+  for (i=0; i<results->size(); i++) { 
+    if ((*results)[i]!=ERROR_NOERROR) { 
+      return ERROR_CONFLICT;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::InsertBatchIntoLeaf(const SIZE_T &node,
+					const SIZE_T &parent,
+					const vector<KeyValuePair> &pairs,
+					const vector<SIZE_T> &order,
+					const SIZE_T first,
+					const SIZE_T last,
+					vector<ERROR_T> &results,
+					PendingSeparators &pending)
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T offset, i, j;
+  SIZE_T sibling;
+  vector<KeyValuePair> merged;
+  // For each merged pair, its value's length and its overflow blocks, if
+  // any, in which case only the key is in merged
+  vector<SIZE_T> vallens;
+  vector<SIZE_T> refs;
+
+  rc = b.Unserialize(buffercache, node);
+  if (rc) { return rc; }
+
+  // Merge the leaf's pairs with the new ones, dropping conflicts
+  offset = 0;
+  i = first;
+  while (offset < b.info.numkeys || i < last) { 
+    if (i < last && i > first && !(pairs[order[i-1]].key < pairs[order[i]].key)) { 
+      results[order[i]] = ERROR_CONFLICT;
+      i++;
+      continue;
+    }
+    int c = offset == b.info.numkeys ? 1 : i == last ? -1 : b.CompareKey(offset, pairs[order[i]].key);
+    if (c == 0) { 
+      results[order[i]] = ERROR_CONFLICT;
+      i++;
+    } else if (c < 0) { 
+      KeyValuePair p;
+      SIZE_T ref = 0;
+      if (b.IsValRef(offset)) { 
+	rc = b.GetKey(offset, p.key);
+	if (rc) { return rc; }
+	rc = b.GetValRef(offset, ref);
+      } else {
+	rc = b.GetKeyVal(offset, p);
+      }
+      if (rc) { return rc; }
+      merged.push_back(p);
+      vallens.push_back(b.GetValLength(offset));
+      refs.push_back(ref);
+      offset++;
+    } else {
+      const KeyValuePair &p = pairs[order[i]];
+      SIZE_T ref = 0;
+      if (superblock.info.IsOverflow(p.value.length)) { 
+	rc = WriteOverflow(p.value, ref);
+	if (rc) { return rc; }
+	merged.push_back(KeyValuePair(p.key, VALUE_T()));
+      } else {
+	merged.push_back(p);
+      }
+      vallens.push_back(p.value.length);
+      refs.push_back(ref);
+      i++;
+    }
+  }
+
+  // As with single inserts, never use a leaf's last slot
+  vector<SIZE_T> starts;
+  PlanLeaves(b.info, merged, vallens, 1.0, starts);
+  SIZE_T numpieces = starts.size()-1;
+
+  vector<SIZE_T> blocks(1, node);
+  for (j=1; j<numpieces; j++) { 
+    SIZE_T n;
+    rc = AllocateNode(n);
+    if (rc) { return rc; }
+    blocks.push_back(n);
+  }
+
+  rc = b.GetPtr(0, sibling);
+  if (rc) { return rc; }
+
+  for (j=0; j<numpieces; j++) { 
+    BTreeNode piece(BTREE_LEAF_NODE,
+		    superblock.info.keysize,
+		    superblock.info.valuesize,
+		    buffercache->GetBlockSize(),
+		    superblock.info.format,
+		    superblock.info.overflow);
+    SIZE_T start = starts[j];
+    SIZE_T end = starts[j+1];
+
+    piece.info.numkeys = end-start;
+    for (i=start; i<end; i++) { 
+      if (refs[i]) { 
+	rc = piece.SetKey(i-start, merged[i].key);
+	if (rc) { return rc; }
+	rc = piece.SetValRef(i-start, vallens[i], refs[i]);
+      } else {
+	rc = piece.SetKeyVal(i-start, merged[i]);
+      }
+      if (rc) { return rc; }
+    }
+    rc = piece.SetPtr(0, j+1<numpieces ? blocks[j+1] : sibling);
+    if (rc) { return rc; }
+
+    rc = piece.Serialize(buffercache, blocks[j]);
+    if (rc) { return rc; }
+
+    if (j>0) { 
+      pending[parent].push_back(KeyPtrPair(merged[start-1].key, blocks[j]));
+    }
+  }
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::InsertIntoParents(PendingSeparators &pending, NodeParents &parents)
+{
+  ERROR_T rc;
+  SIZE_T i, j;
+
+  // Each pass handles one level, and hands the separators from any
+  // splits up to the next
+  while (!pending.empty()) { 
+    PendingSeparators next;
+
+    for (PendingSeparators::iterator p=pending.begin(); p!=pending.end(); ++p) { 
+      SIZE_T node = (*p).first;
+      vector<KeyPtrPair> &seps = (*p).second;
+      BTreeNode b;
+      vector<KEY_T> keys;
+      vector<SIZE_T> ptrs;
+      SIZE_T ptr;
+
+      rc = b.Unserialize(buffercache, node);
+      if (rc) { return rc; }
+
+      sort(seps.begin(), seps.end(), KeyPtrLessThan);
+
+      // Merge; each separator goes in with its new node just to its right
+      rc = b.GetPtr(0, ptr);
+      if (rc) { return rc; }
+      ptrs.push_back(ptr);
+      j = 0;
+      for (i=0; i<b.info.numkeys; i++) { 
+	for (; j<seps.size() && b.CompareKey(i, seps[j].first)>0; j++) { 
+	  keys.push_back(seps[j].first);
+	  ptrs.push_back(seps[j].second);
+	}
+	KEY_T key;
+	rc = b.GetKey(i, key);
+	if (rc) { return rc; }
+	rc = b.GetPtr(i+1, ptr);
+	if (rc) { return rc; }
+	keys.push_back(key);
+	ptrs.push_back(ptr);
+      }
+      for (; j<seps.size(); j++) { 
+	keys.push_back(seps[j].first);
+	ptrs.push_back(seps[j].second);
+      }
+
+      // Like the leaves, never use the last slot
+      SIZE_T perinterior = b.info.GetNumSlotsAsInterior()-1;
+      SIZE_T numpieces = (ptrs.size()+perinterior)/(perinterior+1);
+
+      // New interior nodes may belong on a resident level
+      if (numpieces > 1) { 
+	residentstale = true;
+      }
+
+      if (numpieces > 1 && b.info.nodetype == BTREE_ROOT_NODE) { 
+	// Splitting the root grows the tree by one level; the new root
+	// starts out pointing at just the old one and picks up the
+	// separators on the next pass
+	SIZE_T newrootnode;
+
+	rc = AllocateNode(newrootnode);
+	if (rc) { return rc; }
+
+	BTreeNode newroot(BTREE_ROOT_NODE,
+			  superblock.info.keysize,
+			  superblock.info.valuesize,
+			  buffercache->GetBlockSize(),
+			  superblock.info.format,
+			  superblock.info.overflow);
+	rc = newroot.SetPtr(0, node);
+	if (rc) { return rc; }
+	rc = newroot.Serialize(buffercache, newrootnode);
+	if (rc) { return rc; }
+
+	b.info.nodetype = BTREE_INTERIOR_NODE;
+	parents[node] = newrootnode;
+	superblock.info.rootnode = newrootnode;
+	rc = superblock.Serialize(buffercache, superblock_index);
+	if (rc) { return rc; }
+      }
+
+      vector<SIZE_T> blocks(1, node);
+      for (j=1; j<numpieces; j++) { 
+	SIZE_T n;
+	rc = AllocateNode(n);
+	if (rc) { return rc; }
+	blocks.push_back(n);
+      }
+
+      for (j=0; j<numpieces; j++) { 
+	BTreeNode piece(b.info.nodetype,
+			superblock.info.keysize,
+			superblock.info.valuesize,
+			buffercache->GetBlockSize(),
+			superblock.info.format,
+			superblock.info.overflow);
+	SIZE_T start = GroupStart(ptrs.size(), numpieces, j);
+	SIZE_T end = GroupStart(ptrs.size(), numpieces, j+1);
+
+	piece.info.numkeys = end-start-1;
+	for (i=start; i<end; i++) { 
+	  rc = piece.SetPtr(i-start, ptrs[i]);
+	  if (rc) { return rc; }
+	  if (i+1<end) { 
+	    rc = piece.SetKey(i-start, keys[i]);
+	    if (rc) { return rc; }
+	  }
+	}
+
+	rc = WriteNode(piece, blocks[j]);
+	if (rc) { return rc; }
+
+	if (j>0) { 
+	  // the key between the pieces moves up
+	  next[parents[node]].push_back(KeyPtrPair(keys[start-1], blocks[j]));
+	}
+      }
+    }
+
+    pending.swap(next);
+  }
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::Scan(const KEY_T &lo, const KEY_T &hi, BTreeCursor &cursor, 
+			 const bool keysonly)
+{
+  ERROR_T rc;
+  SIZE_T leaf;
+  BTreePath path;
+
+  cursor.buffercache = buffercache;
+  cursor.keysonly = keysonly;
+  cursor.hi = hi;
+  cursor.offset = 0;
+  cursor.done = true;
+  cursor.tree = superblock.info;
+  cursor.postings.clear();
+  cursor.postingat = 0;
+  cursor.nextposting = 0;
+
+  rc = LookupForInsert(superblock.info.rootnode, lo, leaf, 0, &path);
+  if (rc == ERROR_NONEXISTENT) { 
+    // empty tree
+    return ERROR_NOERROR;
+  }
+  if (rc) { return rc; }
+
+  // Start reading the leaves to the right that the range reaches
+  // The child at slot i only holds keys above separator i-1, so stop
+  // once a separator is at or past hi
+  if (path.depth>=2) { 
+    BTreeNodeView parent;
+    SIZE_T slot, last, ptr;
+
+    rc = parent.Pin(buffercache, path.node[path.depth-2]);
+    if (rc) { return rc; }
+    slot = path.slot[path.depth-2]+1;
+    last = slot+BTREE_SCAN_PREFETCH;
+    for (; slot<=parent.info->numkeys && slot<last; slot++) { 
+      if (parent.CompareKey(slot-1, hi) >= 0) { 
+	break;
+      }
+      rc = parent.GetPtr(slot, ptr);
+      if (rc) { return rc; }
+      // Prefetching is only a hint, so no room is not a problem
+      if (buffercache->PrefetchBlock(ptr)) { 
+	break;
+      }
+    }
+  }
+
+  rc = cursor.leaf.Unserialize(buffercache, leaf);
+  if (rc) { return rc; }
+
+  rc = cursor.leaf.LowerBound(lo, cursor.offset);
+  if (rc) { return rc; }
+
+  cursor.done = false;
+  return ERROR_NOERROR;
+}
+
+
+BTreeCursor::BTreeCursor() : buffercache(0), offset(0), done(true), keysonly(false),
+			     postingat(0), nextposting(0)
+{
+  tree.postingsize = 0;
+}
+
+
+ERROR_T BTreeCursor::Next(KeyValuePair &p)
+{
+  ERROR_T rc;
+  SIZE_T sibling;
+  VALUE_T cell;
+  BTreePostings list;
+
+  // In an index that isn't unique, each of a key's values is a pair
+  while (true) { 
+    // The rest of the last key's values come first
+    while (postingat>=postings.size() && nextposting!=0) { 
+      rc = ReadPostingBlock(buffercache, tree, nextposting, postings, nextposting);
+      if (rc) { return rc; }
+      postingat = 0;
+    }
+    if (postingat<postings.size()) { 
+      p.key = key;
+      GetPostingAt(tree, postings.data()+postingat, p.value);
+      postingat += PostingBytesAt(tree, postings.data()+postingat);
+      return ERROR_NOERROR;
+    }
+
+    // Step over to the next nonempty leaf if this one is used up
+    while (!done && offset>=leaf.info.numkeys) { 
+      rc = leaf.GetPtr(0, sibling);
+      if (rc) { return rc; }
+      if (sibling == 0) { 
+	done = true;
+	break;
+      }
+      rc = leaf.Unserialize(buffercache, sibling);
+      if (rc) { return rc; }
+      offset = 0;
+      // and get the one after it coming while we read this one
+      rc = leaf.GetPtr(0, sibling);
+      if (rc) { return rc; }
+      if (sibling != 0) { 
+	buffercache->PrefetchBlock(sibling);
+      }
+    }
+
+    if (done || leaf.CompareKey(offset, hi) > 0) { 
+      done = true;
+      return ERROR_NONEXISTENT;
+    }
+
+    if (tree.IsUnique()) { 
+      break;
+    }
+
+    // Start on this key's values, or skip it if it has none
+    rc = GetLeafVal(buffercache, leaf, offset, cell);
+    if (rc) { return rc; }
+    rc = GetPostings(tree, cell, list);
+    if (rc) { return rc; }
+    offset++;
+    if (list.count == 0) { 
+      continue;
+    }
+    rc = leaf.GetKey(offset-1, keysonly ? p.key : key);
+    if (rc) { return rc; }
+    if (keysonly) { 
+      return p.value.Resize(0, false);
+    }
+    postings = list.inlined;
+    postingat = 0;
+    nextposting = list.first;
+  }
+
+  if (keysonly) { 
+    // Whatever the values, only the leaf is read
+    rc = leaf.GetKey(offset, p.key);
+    if (rc) { return rc; }
+    rc = p.value.Resize(0, false);
+  } else if (leaf.IsValRef(offset)) { 
+    SIZE_T ref;
+    rc = leaf.GetKey(offset, p.key);
+    if (rc) { return rc; }
+    rc = leaf.GetValRef(offset, ref);
+    if (rc) { return rc; }
+    rc = ReadOverflow(buffercache, ref, leaf.GetValLength(offset), p.value);
+  } else {
+    rc = leaf.GetKeyVal(offset, p);
+  }
+  if (rc) { return rc; }
+
+  offset++;
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::Update(const KEY_T &key, const VALUE_T &value)
+{
+  ERROR_T rc;
+  VALUE_T cell;
+  BTreePostings p;
+
+  if (superblock.info.IsUnique()) { 
+    if (!superblock.info.IsValueSize(value.length)) { 
+      return ERROR_SIZE;
+    }
+    VALUE_T temp = value;
+    return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_UPDATE, key, temp);
+  }
+
+  if (!superblock.info.IsPostingSize(value.length)) { 
+    return ERROR_SIZE;
+  }
+  rc = LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, cell);
+  if (rc) { return rc; }
+  rc = GetPostings(superblock.info, cell, p);
+  if (rc) { return rc; }
+  if (p.count == 0) { 
+    return ERROR_NONEXISTENT;
+  }
+  rc = FreeOverflow(p.first);
+  if (rc) { return rc; }
+  p = BTreePostings();
+  rc = AddPosting(p, value);
+  if (rc) { return rc; }
+  SetPostings(superblock.info, p, cell);
+  return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_UPDATE, key, cell);
+}
+
+
+
+// Whether a node holds less than half of what it could
+static bool IsUnderfull(const BTreeNode &b)
+{
+  if (b.info.nodetype==BTREE_LEAF_NODE) { 
+    return 2*b.info.numkeys+1 < b.GetNumSlotsAsLeaf();
+  }
+  return 2*b.info.numkeys+1 < b.info.GetNumSlotsAsInterior();
+}
+
+
+// Deal the decoded pairs of two neighboring leaves back out to them, the
+// first k to the left, and say whether both then have a free slot
+static bool SpreadLeaves(BTreeNode &l, BTreeNode &r, const string &pairs, const SIZE_T k)
+{
+  SIZE_T slotbytes = l.info.GetKeySlotBytes()+l.info.GetValueSlotBytes();
+  SIZE_T total = pairs.size()/slotbytes;
+
+  if (sizeof(SIZE_T)+k*slotbytes > l.info.GetNumBufferBytes() || 
+      sizeof(SIZE_T)+(total-k)*slotbytes > r.info.GetNumBufferBytes()) { 
+    return false;
+  }
+  l.info.numkeys = k;
+  r.info.numkeys = total-k;
+  if (k>0) { 
+    memcpy(l.ResolveKeyVal(0), pairs.data(), k*slotbytes);
+  }
+  if (total>k) { 
+    memcpy(r.ResolveKeyVal(0), pairs.data()+k*slotbytes, (total-k)*slotbytes);
+  }
+  return l.info.numkeys < l.GetNumSlotsAsLeaf() && r.info.numkeys < r.GetNumSlotsAsLeaf();
+}
+
+
+ERROR_T BTreeIndex::FixUnderfull(BTreeNode &parent,
+				 const SIZE_T parentnode,
+				 const SIZE_T level,
+				 const SIZE_T slot,
+				 BTreeNode &child,
+				 bool &merged)
+{
+  ERROR_T rc;
+  SIZE_T childnode, siblingnode;
+  BTreeNode sibling;
+  KEY_T key;
+
+  merged = false;
+  rc = parent.GetPtr(slot, childnode);
+  if (rc) { return rc; }
+  if (parent.info.numkeys == 0) { 
+    // An only child has nobody to borrow from
+    return child.info.nodetype==BTREE_LEAF_NODE ? 
+      child.Serialize(buffercache, childnode) : WriteNode(child, childnode);
+  }
+
+  // The sibling to the right, unless this is the last child
+  SIZE_T lslot = slot<parent.info.numkeys ? slot : slot-1;
+  rc = parent.GetPtr(lslot==slot ? slot+1 : lslot, siblingnode);
+  if (rc) { return rc; }
+  rc = sibling.Unserialize(buffercache, siblingnode);
+  if (rc) { return rc; }
+
+  BTreeNode &l = lslot==slot ? child : sibling;
+  BTreeNode &r = lslot==slot ? sibling : child;
+  SIZE_T lnode = lslot==slot ? childnode : siblingnode;
+  SIZE_T rnode = lslot==slot ? siblingnode : childnode;
+  // The root always keeps two leaves, until there is nothing in them
+  bool lastleaves = parentnode==superblock.info.rootnode && parent.info.numkeys==1;
+
+  if (l.info.nodetype == BTREE_LEAF_NODE) { 
+    SIZE_T slotbytes = l.info.GetKeySlotBytes()+l.info.GetValueSlotBytes();
+    SIZE_T total = l.info.numkeys+r.info.numkeys;
+    SIZE_T numkeysLeft = l.info.numkeys;
+    SIZE_T next;
+    string pairs;
+
+    if (l.info.numkeys>0) { 
+      pairs.append(l.ResolveKeyVal(0), l.info.numkeys*slotbytes);
+    }
+    if (r.info.numkeys>0) { 
+      pairs.append(r.ResolveKeyVal(0), r.info.numkeys*slotbytes);
+    }
+
+    if (lastleaves && total==0) { 
+      // The tree is empty again, as it was created
+      rc = DeallocateNode(lnode);
+      if (rc) { return rc; }
+      rc = DeallocateNode(rnode);
+      if (rc) { return rc; }
+      parent.info.numkeys = 0;
+      merged = true;
+      return ERROR_NOERROR;
+    }
+
+    if (!lastleaves && SpreadLeaves(l, r, pairs, total)) { 
+      // Everything fits on the left, so the right leaf goes, and the 
+      // left one takes its place in the sibling chain
+      rc = r.GetPtr(0, next);
+      if (rc) { return rc; }
+      rc = l.SetPtr(0, next);
+      if (rc) { return rc; }
+      rc = l.Serialize(buffercache, lnode);
+      if (rc) { return rc; }
+      rc = DeallocateNode(rnode);
+      if (rc) { return rc; }
+      merged = true;
+      return parent.RemoveKeyPtr(lslot);
+    }
+
+    // Otherwise even them out, as near half and half as leaves both 
+    // sides room, the way a split does.  Where they were always does.
+    bool spread = false;
+    for (SIZE_T d=0; d<=total && !spread; d++) { 
+      if (total/2 >= d && total/2-d >= 1 && SpreadLeaves(l, r, pairs, total/2-d)) { 
+	spread = true;
+      } else if (d>0 && total/2+d <= total && SpreadLeaves(l, r, pairs, total/2+d)) { 
+	spread = true;
+      }
+    }
+    if (!spread && !SpreadLeaves(l, r, pairs, numkeysLeft)) { 
+      return ERROR_INSANE;
+    }
+    // Keys <= the last key on the left belong to the left
+    if (l.info.numkeys>0) { 
+      rc = l.GetKey(l.info.numkeys-1, key);
+      if (rc) { return rc; }
+      rc = parent.SetKey(lslot, key);
+      if (rc) { return rc; }
+    }
+    rc = l.Serialize(buffercache, lnode);
+    if (rc) { return rc; }
+    return r.Serialize(buffercache, rnode);
+  }
+
+  // Interior nodes are fixed size, so it is all in the counts.  A merged
+  // node is the left one's keys, the separator, and the right one's keys.
+  SIZE_T ln = l.info.numkeys, rn = r.info.numkeys;
+  SIZE_T ptr;
+
+  rc = parent.GetKey(lslot, key);
+  if (rc) { return rc; }
+
+  if (ln+rn+1 < l.info.GetNumSlotsAsInterior()) { 
+    l.info.numkeys = ln+rn+1;
+    rc = l.SetKey(ln, key);
+    if (rc) { return rc; }
+    memcpy(l.ResolvePtr(ln+1), r.ResolvePtr(0),
+	   rn*(l.info.GetKeySlotBytes()+sizeof(SIZE_T))+sizeof(SIZE_T));
+    rc = parent.RemoveKeyPtr(lslot);
+    if (rc) { return rc; }
+    rc = DeallocateNode(rnode);
+    if (rc) { return rc; }
+    // A resident level just lost a node
+    residentstale = true;
+    merged = true;
+
+    if (parentnode == superblock.info.rootnode && parent.info.numkeys == 0) { 
+      // The root is down to this one child, so it becomes the root, 
+      // and the tree one level shorter
+      l.info.nodetype = BTREE_ROOT_NODE;
+      rc = l.Serialize(buffercache, lnode);
+      if (rc) { return rc; }
+      rc = DeallocateNode(parentnode);
+      if (rc) { return rc; }
+      superblock.info.rootnode = lnode;
+      return superblock.Serialize(buffercache, superblock_index);
+    }
+    return WriteNode(l, lnode);
+  }
+
+  // Rotate keys through the parent, one at a time, until they are even
+  while (l.info.numkeys+1 < r.info.numkeys) { 
+    ln = l.info.numkeys;
+    rc = r.GetPtr(0, ptr);
+    if (rc) { return rc; }
+    l.info.numkeys++;
+    rc = l.SetKey(ln, key);
+    if (rc) { return rc; }
+    rc = l.SetPtr(ln+1, ptr);
+    if (rc) { return rc; }
+    rc = r.GetKey(0, key);
+    if (rc) { return rc; }
+    rc = r.GetPtr(1, ptr);
+    if (rc) { return rc; }
+    rc = r.SetPtr(0, ptr);
+    if (rc) { return rc; }
+    rc = r.RemoveKeyPtr(0);
+    if (rc) { return rc; }
+  }
+  while (r.info.numkeys+1 < l.info.numkeys) { 
+    SIZE_T first;
+    ln = l.info.numkeys;
+    rc = l.GetPtr(ln, ptr);
+    if (rc) { return rc; }
+    rc = r.GetPtr(0, first);
+    if (rc) { return rc; }
+    rc = r.InsertKeyPtr(0, key, first);
+    if (rc) { return rc; }
+    rc = r.SetPtr(0, ptr);
+    if (rc) { return rc; }
+    rc = l.GetKey(ln-1, key);
+    if (rc) { return rc; }
+    l.info.numkeys--;
+  }
+  rc = parent.SetKey(lslot, key);
+  if (rc) { return rc; }
+  rc = WriteNode(l, lnode);
+  if (rc) { return rc; }
+  return WriteNode(r, rnode);
+}
+
+
+ERROR_T BTreeIndex::RebalanceAfterDelete(const BTreePath &path,
+					 const SIZE_T level,
+					 BTreeNode &b)
+{
+  ERROR_T rc;
+  SIZE_T node = path.node[level];
+  SIZE_T parentnode;
+  BTreeNode parent;
+  bool merged;
+
+  if (level == 0 || !IsUnderfull(b)) { 
+    return b.info.nodetype==BTREE_LEAF_NODE ? b.Serialize(buffercache, node) : WriteNode(b, node);
+  }
+
+  parentnode = path.node[level-1];
+  rc = parent.Unserialize(buffercache, parentnode);
+  if (rc) { return rc; }
+  rc = FixUnderfull(parent, parentnode, level-1, path.slot[level-1], b, merged);
+  if (rc) { return rc; }
+
+  if (level == 1 && parentnode != superblock.info.rootnode) { 
+    // It was the root, and its one child took over
+    return ERROR_NOERROR;
+  }
+  if (!merged) { 
+    // Only a separator changed, so the parent is no emptier than it was
+    return WriteNode(parent, parentnode);
+  }
+  return RebalanceAfterDelete(path, level-1, parent);
+}
+
+  
+ERROR_T BTreeIndex::Delete(const KEY_T &key)
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T offset;
+  SIZE_T leaf;
+  BTreePath path;
+  vector<SIZE_T> chains;
+
+  if (!superblock.info.IsKeySize(key.length)) { 
+    return ERROR_SIZE;
+  }
+
+  rc = LookupForInsert(superblock.info.rootnode, key, leaf, 0, &path);
+  if (rc) { return rc; }
+
+  rc = b.Unserialize(buffercache, leaf);
+  if (rc) { return rc; }
+  rc = b.LowerBound(key, offset);
+  if (rc) { return rc; }
+  if (offset == b.info.numkeys || b.CompareKey(offset, key) != 0) { 
+    return ERROR_NONEXISTENT;
+  }
+
+  // Whatever blocks the value has of its own go back to the free list
+  rc = GetLeafChains(buffercache, superblock.info, b, offset, offset+1, chains);
+  if (rc) { return rc; }
+  rc = DeallocateNodes(chains);
+  if (rc) { return rc; }
+
+  rc = b.RemoveKeyVal(offset);
+  if (rc) { return rc; }
+
+  if (deletepolicy == BTREE_DELETE_LAZY || !IsUnderfull(b)) { 
+    rc = b.Serialize(buffercache, leaf);
+    if (rc) { return rc; }
+    // The rightmost leaf has to have a key to append after
+    if (leaf == rightleaf) { 
+      rightnode = b;
+      if (b.info.numkeys == 0) { 
+	rightleaf = 0;
+      }
+    }
+    return ERROR_NOERROR;
+  }
+
+  // Rebalancing moves keys between leaves and can take nodes out of any
+  // level, so the rightmost leaf and its path have to be found again
+  rightleaf = 0;
+  rightpathok = false;
+  return RebalanceAfterDelete(path, path.depth-1, b);
+}
+
+
+ERROR_T BTreeIndex::CompactInternal(BTreeNode &b, const SIZE_T node, const SIZE_T level,
+				    bool &again)
+{
+  ERROR_T rc;
+  SIZE_T ptr;
+  SIZE_T slot;
+  BTreeNode child;
+  bool merged;
+
+  // The levels below are compacted first, each subtree on its own
+  for (slot=0; b.info.numkeys>0 && slot<=b.info.numkeys; slot++) { 
+    rc = b.GetPtr(slot, ptr);
+    if (rc) { return rc; }
+    rc = child.Unserialize(buffercache, ptr);
+    if (rc) { return rc; }
+    if (child.info.nodetype == BTREE_LEAF_NODE) { 
+      break;
+    }
+    rc = CompactInternal(child, ptr, level+1, again);
+    if (rc) { return rc; }
+    rc = WriteNode(child, ptr);
+    if (rc) { return rc; }
+  }
+
+  // then b's children, left to right.  A child that merges with the one
+  // after it may still be underfull, so it is looked at again.  Merged
+  // interior nodes put children that were compacted apart next to each
+  // other, so that takes another pass.
+  slot = 0;
+  while (b.info.numkeys>0 && slot<=b.info.numkeys) { 
+    rc = b.GetPtr(slot, ptr);
+    if (rc) { return rc; }
+    rc = child.Unserialize(buffercache, ptr);
+    if (rc) { return rc; }
+    if (!IsUnderfull(child)) { 
+      slot++;
+      continue;
+    }
+    rc = FixUnderfull(b, node, level, slot, child, merged);
+    if (rc) { return rc; }
+    if (level == 0 && node != superblock.info.rootnode) { 
+      again = true;
+      return ERROR_NOERROR;
+    }
+    if (!merged) { 
+      slot++;
+    } else if (child.info.nodetype != BTREE_LEAF_NODE) { 
+      again = true;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::Compact()
+{
+  ERROR_T rc;
+  SIZE_T root;
+  BTreeNode b;
+  bool again = true;
+
+  rightleaf = 0;
+  rightpathok = false;
+  while (again) { 
+    again = false;
+    root = superblock.info.rootnode;
+    rc = b.Unserialize(buffercache, root);
+    if (rc) { return rc; }
+    rc = CompactInternal(b, root, 0, again);
+    if (rc) { return rc; }
+    // unless the root was merged away
+    if (root == superblock.info.rootnode) { 
+      rc = WriteNode(b, root);
+      if (rc) { return rc; }
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::DeleteValue(const KEY_T &key, const VALUE_T &value)
+{
+  ERROR_T rc;
+  VALUE_T cell;
+  BTreePostings p;
+
+  rc = LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_LOOKUP, key, cell);
+  if (rc) { return rc; }
+
+  if (superblock.info.IsUnique()) { 
+    if (cell.length != value.length || memcmp(cell.data, value.data, value.length)) { 
+      return ERROR_NONEXISTENT;
+    }
+    return Delete(key);
+  }
+
+  rc = GetPostings(superblock.info, cell, p);
+  if (rc) { return rc; }
+  rc = RemovePosting(p, value);
+  if (rc) { return rc; }
+  if (p.count == 0) { 
+    return Delete(key);
+  }
+  SetPostings(superblock.info, p, cell);
+  return LookupOrUpdateInternal(superblock.info.rootnode, BTREE_OP_UPDATE, key, cell);
+}
+
+
+ERROR_T BTreeIndex::GetSubtreeBlocks(const SIZE_T node, 
+				     const SIZE_T height, 
+				     BTreeRangeDelete &del)
+{
+  ERROR_T rc;
+  BTreeNode b;
+  SIZE_T ptr;
+
+  // A leaf only has to be read for blocks its values have
+  if (height == 0 && superblock.info.IsUnique() && 
+      !superblock.info.IsOverflow(superblock.info.valuesize)) { 
+    del.freed.push_back(node);
+    return ERROR_NOERROR;
+  }
+
+  rc = b.Unserialize(buffercache, node);
+  if (rc) { return rc; }
+  if (height == 0) { 
+    rc = GetLeafChains(buffercache, superblock.info, b, 0, b.info.numkeys, del.freed);
+    if (rc) { return rc; }
+  } else {
+    for (SIZE_T slot=0; slot<=b.info.numkeys; slot++) { 
+      rc = b.GetPtr(slot, ptr);
+      if (rc) { return rc; }
+      rc = GetSubtreeBlocks(ptr, height-1, del);
+      if (rc) { return rc; }
+    }
+    // A resident level may be losing a node
+    residentstale = true;
+  }
+  del.freed.push_back(node);
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::DeleteRangeInternal(BTreeNode &b, 
+					const SIZE_T node,
+					const SIZE_T height,
+					const bool lowinside,
+					const bool highinside,
+					const KEY_T &lo,
+					const KEY_T &hi,
+					BTreeRangeDelete &del)
+{
+  ERROR_T rc;
+  SIZE_T first, last;
+  SIZE_T slot, ptr;
+  BTreeNode child;
+
+  if (height == 0) { 
+    rc = b.LowerBound(lo, first);
+    if (rc) { return rc; }
+    rc = b.UpperBound(hi, last);
+    if (rc) { return rc; }
+    if (first < last) { 
+      rc = GetLeafChains(buffercache, superblock.info, b, first, last, del.freed);
+      if (rc) { return rc; }
+      rc = b.RemoveKeyVal(first, last-first);
+      if (rc) { return rc; }
+    }
+    // Every leaf between the last one trimmed and this one is gone
+    if (del.edgenode != 0) { 
+      rc = del.edge.SetPtr(0, node);
+      if (rc) { return rc; }
+      rc = del.edge.Serialize(buffercache, del.edgenode);
+      if (rc) { return rc; }
+    }
+    del.edge = b;
+    del.edgenode = node;
+    return ERROR_NOERROR;
+  }
+
+  // Child i holds the keys above separator i-1 up to separator i.  The
+  // range starts in child first, and child last is the first to hold
+  // anything past it, so those between are entirely inside it.  The 
+  // two at the ends may be too, if b's own bounds are.
+  rc = b.LowerBound(lo, first);
+  if (rc) { return rc; }
+  rc = b.UpperBound(hi, last);
+  if (rc) { return rc; }
+
+  SIZE_T runstart = 0, runend = 0;
+  for (slot=first; slot<=last; slot++) { 
+    bool lowin = slot>0 ? b.CompareKey(slot-1, lo) >= 0 : lowinside;
+    bool highin = slot<b.info.numkeys ? b.CompareKey(slot, hi) <= 0 : highinside;
+
+    rc = b.GetPtr(slot, ptr);
+    if (rc) { return rc; }
+    if (lowin && highin) { 
+      rc = GetSubtreeBlocks(ptr, height-1, del);
+      if (rc) { return rc; }
+      if (runend == 0) { 
+	runstart = slot;
+      }
+      runend = slot+1;
+      continue;
+    }
+    rc = child.Unserialize(buffercache, ptr);
+    if (rc) { return rc; }
+    rc = DeleteRangeInternal(child, ptr, height-1, lowin, highin, lo, hi, del);
+    if (rc) { return rc; }
+    if (height > 1) { 
+      rc = WriteNode(child, ptr);
+      if (rc) { return rc; }
+    }
+  }
+
+  if (runend == 0) { 
+    return ERROR_NOERROR;
+  }
+  if (runend <= b.info.numkeys) { 
+    // The child after the run takes the place of its first, keeping 
+    // the separator before the run, if any, which still divides them
+    rc = b.GetPtr(runend, ptr);
+    if (rc) { return rc; }
+    rc = b.RemoveKeyPtr(runstart, runend-runstart);
+    if (rc) { return rc; }
+    return b.SetPtr(runstart, ptr);
+  }
+  if (runstart == 0) { 
+    // b was entirely inside the range, so it should have gone whole
+    return ERROR_INSANE;
+  }
+  return b.RemoveKeyPtr(runstart-1, runend-runstart);
+}
+
+
+ERROR_T BTreeIndex::FixPath(const KEY_T &key, const bool upper, bool &again)
+{
+  ERROR_T rc;
+  BTreePath path;
+  BTreeNode b, parent;
+  SIZE_T node, level;
+  bool merged, keyless;
+
+  // The way down, as DeleteRangeInternal went
+  path.depth = 0;
+  node = superblock.info.rootnode;
+  while (true) { 
+    rc = b.Unserialize(buffercache, node);
+    if (rc) { return rc; }
+    if (b.info.nodetype == BTREE_ROOT_NODE && b.info.numkeys == 0) { 
+      // empty tree
+      return ERROR_NOERROR;
+    }
+    if (path.depth >= BTREE_MAX_DEPTH) { 
+      return ERROR_INSANE;
+    }
+    path.node[path.depth] = node;
+    if (b.info.nodetype == BTREE_LEAF_NODE) { 
+      path.depth++;
+      break;
+    }
+    rc = upper ? b.UpperBound(key, path.slot[path.depth]) : b.LowerBound(key, path.slot[path.depth]);
+    if (rc) { return rc; }
+    rc = b.GetPtr(path.slot[path.depth], node);
+    if (rc) { return rc; }
+    path.depth++;
+  }
+
+  for (level=path.depth-1; level>0; level--) { 
+    rc = b.Unserialize(buffercache, path.node[level]);
+    if (rc) { return rc; }
+    // Lazily, only an interior node left with no keys is, as only the 
+    // root may be one
+    if (deletepolicy == BTREE_DELETE_LAZY ? 
+	b.info.nodetype == BTREE_LEAF_NODE || b.info.numkeys > 0 : !IsUnderfull(b)) { 
+      continue;
+    }
+    rc = parent.Unserialize(buffercache, path.node[level-1]);
+    if (rc) { return rc; }
+    keyless = b.info.nodetype != BTREE_LEAF_NODE && b.info.numkeys == 0;
+    rc = FixUnderfull(parent, path.node[level-1], level-1, path.slot[level-1], b, merged);
+    if (rc) { return rc; }
+    // An interior node that had no keys and borrowed some has given its
+    // only child, passed over on the way up, a sibling to be fixed with
+    if (merged || (keyless && b.info.numkeys > 0)) { 
+      again = true;
+    }
+    if (level == 1 && path.node[0] != superblock.info.rootnode) { 
+      // The root was merged away
+      return ERROR_NOERROR;
+    }
+    rc = WriteNode(parent, path.node[level-1]);
+    if (rc) { return rc; }
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeIndex::DeleteRange(const KEY_T &lo, const KEY_T &hi)
+{
+  ERROR_T rc;
+  SIZE_T leaf, root;
+  BTreePath path;
+  BTreeNode b;
+  BTreeRangeDelete del;
+  bool again;
+
+  if (!superblock.info.IsKeySize(lo.length) || !superblock.info.IsKeySize(hi.length)) { 
+    return ERROR_SIZE;
+  }
+  if (hi < lo) { 
+    return ERROR_NOERROR;
+  }
+
+  // How far down the leaves are
+  rc = LookupForInsert(superblock.info.rootnode, lo, leaf, 0, &path);
+  if (rc == ERROR_NONEXISTENT) { 
+    // empty tree
+    return ERROR_NOERROR;
+  }
+  if (rc) { return rc; }
+
+  // Keys move between leaves, and nodes can go from any level
+  rightleaf = 0;
+  rightpathok = false;
+
+  root = superblock.info.rootnode;
+  rc = b.Unserialize(buffercache, root);
+  if (rc) { return rc; }
+  del.edgenode = 0;
+  rc = DeleteRangeInternal(b, root, path.depth-1, false, false, lo, hi, del);
+  if (rc) { return rc; }
+  // A root that is itself the leaf is written just below
+  if (del.edgenode != 0 && del.edgenode != root) { 
+    rc = del.edge.Serialize(buffercache, del.edgenode);
+    if (rc) { return rc; }
+  }
+  rc = WriteNode(b, root);
+  if (rc) { return rc; }
+
+  rc = DeallocateNodes(del.freed);
+  if (rc) { return rc; }
+
+  // Everything left underfull, or with all of its keys gone, is on the
+  // way down to one end or the other.  A merge there can put another 
+  // such node next to a sibling, so that takes another pass.
+  again = true;
+  while (again) { 
+    again = false;
+    rc = FixPath(lo, false, again);
+    if (rc) { return rc; }
+    rc = FixPath(hi, true, again);
+    if (rc) { return rc; }
+  }
+  return ERROR_NOERROR;
+}
+
+  
+//
+//
+// DEPTH first traversal
+// DOT is Depth + DOT format
+//
+
+ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
+				    ostream &o,
+				    BTreeDisplayType display_type) const
+{
+  SIZE_T ptr;
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T offset;
+
+  rc= b.Unserialize(buffercache,node);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  rc = PrintNode(o,node,b,display_type,superblock.info,buffercache);
+  
+  if (rc) { return rc; }
+
+  if (display_type==BTREE_DEPTH_DOT) { 
+    o << ";";
+  }
+
+  if (display_type!=BTREE_SORTED_KEYVAL) {
+    o << endl;
+  }
 
   switch (b.info.nodetype) { 
   case BTREE_ROOT_NODE:
   case BTREE_INTERIOR_NODE:
     if (b.info.numkeys>0) { 
+      // We are about to visit every child, so keep a few of them
+      // coming ahead of us.  Asking for all of them at once would push
+      // out the ones we have not got to yet in a small cache.
+      for (offset=0;offset<=b.info.numkeys && offset<BTREE_SCAN_PREFETCH;offset++) { 
+	rc=b.GetPtr(offset,ptr);
+	if (rc) { return rc; }
+	buffercache->PrefetchBlock(ptr);
+      }
       for (offset=0;offset<=b.info.numkeys;offset++) { 
+	if (offset+BTREE_SCAN_PREFETCH<=b.info.numkeys) { 
+	  rc=b.GetPtr(offset+BTREE_SCAN_PREFETCH,ptr);
+	  if (rc) { return rc; }
+	  buffercache->PrefetchBlock(ptr);
+	}
 	rc=b.GetPtr(offset,ptr);
 	if (rc) { return rc; }
 	if (display_type==BTREE_DEPTH_DOT) { 
@@ -667,6 +3402,76 @@ ERROR_T BTreeIndex::Display(ostream &o, BTreeDisplayType display_type) const
 }
 
 
+ERROR_T BTreeIndex::StatsInternal(const SIZE_T &node, const SIZE_T depth, BTreeStats &stats) const
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T ptr;
+
+  rc = b.Unserialize(buffercache, node);
+  if (rc) { return rc; }
+
+  if (depth+1 > stats.depth) { 
+    stats.depth = depth+1;
+  }
+
+  switch (b.info.nodetype) { 
+  case BTREE_ROOT_NODE:
+  case BTREE_INTERIOR_NODE:
+    stats.numinterior++;
+    stats.interiorkeys += b.info.numkeys;
+    stats.interiorcapacity += b.info.GetNumSlotsAsInterior()-1;
+    for (SIZE_T i=0; b.info.numkeys>0 && i<=b.info.numkeys; i++) { 
+      rc = b.GetPtr(i, ptr);
+      if (rc) { return rc; }
+      rc = StatsInternal(ptr, depth+1, stats);
+      if (rc) { return rc; }
+    }
+    return ERROR_NOERROR;
+  case BTREE_LEAF_NODE:
+    stats.numleaves++;
+    stats.numkeys += b.info.numkeys;
+    stats.leafcapacity += b.GetNumSlotsAsLeaf()-1;
+    stats.prefixbytes += b.GetLeafPrefix();
+    stats.leafbytes += b.info.GetNumDataBytes();
+    for (SIZE_T i=0; i<b.info.numkeys; i++) { 
+      SIZE_T len = b.GetValLength(i);
+      stats.payloadbytes += b.GetKeyLength(i)+b.info.GetValueCellBytes(len);
+      if (b.IsValRef(i)) { 
+	SIZE_T perblock = b.info.GetOverflowBytesPerBlock();
+	stats.overflowvalues++;
+	stats.overflowblocks += (len+perblock-1)/perblock;
+      }
+      if (!superblock.info.IsUnique()) { 
+	VALUE_T cell;
+	BTreePostings p;
+	string list;
+
+	rc = GetLeafVal(buffercache, b, i, cell);
+	if (rc) { return rc; }
+	rc = GetPostings(superblock.info, cell, p);
+	if (rc) { return rc; }
+	stats.numpostings += p.count;
+	for (ptr=p.first; ptr!=0; stats.postingblocks++) { 
+	  rc = ReadPostingBlock(buffercache, superblock.info, ptr, list, ptr);
+	  if (rc) { return rc; }
+	}
+      }
+    }
+    return ERROR_NOERROR;
+  default:
+    return ERROR_INSANE;
+  }
+}
+
+
+ERROR_T BTreeIndex::GetStats(BTreeStats &stats) const
+{
+  stats = BTreeStats();
+  return StatsInternal(superblock.info.rootnode, 0, stats);
+}
+
+
 ERROR_T BTreeIndex::SanityCheck() const
 {
   // WRITE ME
@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <map>
 
 #include "global.h"
 #include "block.h"
@@ -32,11 +34,198 @@ struct KeyValuePair {
   KeyValuePair();
   KeyValuePair(const KEY_T &key, const VALUE_T &value);
   KeyValuePair(const KeyValuePair &rhs);
+  KeyValuePair(KeyValuePair &&rhs) noexcept;
   virtual ~KeyValuePair();
   KeyValuePair & operator=(const KeyValuePair &rhs);
+  KeyValuePair & operator=(KeyValuePair &&rhs);
 
 };
 
+class BTreeIndex;
+
+//
+// A key's values, in an index that isn't unique (see btree_ds.h)
+// Up to a leaf's worth are kept in the leaf, in inlined, back to back
+// and in order.  Past that, they are in a chain of posting blocks from 
+// first to last, and the leaf keeps only where the chain is.
+//
+struct BTreePostings {
+  SIZE_T count;
+  SIZE_T first;    // 0 while they are in the leaf
+  SIZE_T last;
+  string inlined;
+
+  BTreePostings() : count(0), first(0), last(0) {}
+};
+
+//
+// A cursor over the key/value pairs with lo <= key <= hi, in key order
+// BTreeIndex::Scan positions it on the first leaf, and Next then walks 
+// the leaves left to right through their sibling pointers, never 
+// going back up through the root
+//
+class BTreeCursor {
+  friend class BTreeIndex;
+ private:
+  BufferCache *buffercache;
+  BTreeNode    leaf;
+  SIZE_T       offset;
+  KEY_T        hi;
+  bool         done;
+  bool         keysonly;
+  // In an index that isn't unique, each of a key's values is a pair of
+  // its own: key's, from postings on, then the block after them
+  NodeMetadata tree;
+  KEY_T        key;
+  string       postings;
+  SIZE_T       postingat;
+  SIZE_T       nextposting;
+ public:
+  BTreeCursor();
+
+  // return zero on success, with the next pair in p (an empty value
+  // if the scan is of keys only, which gives each key once)
+  // return ERROR_NONEXISTENT once the range is exhausted
+  ERROR_T Next(KeyValuePair &p);
+
+  bool AtEnd() const { return done; }
+};
+
+// A separator key and the new node to its right, waiting to go into 
+// an interior node
+typedef pair<KEY_T, SIZE_T> KeyPtrPair;
+
+// Interior node => the separators that must be added to it
+typedef map<SIZE_T, vector<KeyPtrPair> > PendingSeparators;
+
+// Node => the interior node that points to it, as seen on the way down
+typedef map<SIZE_T, SIZE_T> NodeParents;
+
+// Deepest tree we will descend.  Even at two children per node this 
+// is far more levels than a disk of SIZE_T blocks could hold.
+#define BTREE_MAX_DEPTH 32
+
+// How many leaves past the first one a range scan reads ahead
+#define BTREE_SCAN_PREFETCH 8
+
+// How many interior nodes an index keeps resident by default
+#define BTREE_RESIDENT_NODES 64
+
+//
+// What descents found at one depth of the tree
+//
+struct BTreeLevelStats {
+  SIZE_T residenthits;   // nodes that were resident
+  SIZE_T cachereads;     // nodes that had to come from the buffer cache
+
+  BTreeLevelStats() : residenthits(0), cachereads(0) {}
+};
+
+// Block number => a decoded copy of the node
+typedef map<SIZE_T, BTreeNode> ResidentLevel;
+
+//
+// Where a full node is split
+//   even   in half
+//   right  the left node keeps fill of the keys (90/10 by default), 
+//          which suits appends, since nothing more goes to the left
+//   key    by where the key that filled it went: at the right end, 
+//          like right, at the left end, the mirror image, else in half
+//
+enum BTreeSplitType {BTREE_SPLIT_EVEN, BTREE_SPLIT_RIGHT, BTREE_SPLIT_KEY};
+
+#define BTREE_SPLIT_FILL 0.9
+
+struct BTreeSplitPolicy {
+  BTreeSplitType type;
+  double         fill;   // share the fuller side keeps, 0.5 <= fill < 1
+
+  BTreeSplitPolicy(const BTreeSplitType t=BTREE_SPLIT_EVEN, const double f=BTREE_SPLIT_FILL) :
+    type(t), fill(f) {}
+
+  // How many of a full node's numkeys stay on the left, given that the
+  // key that filled it went in at offset.  Between 1 and numkeys-1.
+  SIZE_T SplitPoint(const SIZE_T numkeys, const SIZE_T offset) const;
+
+  const char *GetName() const;
+
+  // "even", "right", or "key", optionally followed by ":fill", eg, right:0.8
+  // Gives ERROR_BADCONFIG if it makes no sense.
+  static ERROR_T Parse(const char *spec, BTreeSplitPolicy &policy);
+};
+
+//
+// What a delete does when it leaves a node underfull, less than half
+// of what it could hold
+//   eager  the node borrows from a sibling, or merges with it if they 
+//          fit in one, right away, and so on up the tree
+//   lazy   the pair only comes out of its leaf.  Nodes are left as they
+//          are until Compact rebalances the whole tree in one pass.
+//
+enum BTreeDeletePolicy {BTREE_DELETE_EAGER, BTREE_DELETE_LAZY};
+
+// "eager" or "lazy", else ERROR_BADCONFIG
+ERROR_T     ParseBTreeDeletePolicy(const char *name, BTreeDeletePolicy &policy);
+const char *GetBTreeDeletePolicyName(const BTreeDeletePolicy policy);
+
+//
+// The shape of a tree and how full its nodes are
+// Utilization is keys over the keys the nodes could hold, which for 
+// each node is one less than its slots, since the last is never used.
+//
+struct BTreeStats {
+  SIZE_T depth;          // levels, counting the leaves
+  SIZE_T numleaves;
+  SIZE_T numinterior;    // counting the root
+  SIZE_T numkeys;        // in the leaves
+  SIZE_T leafcapacity;   // keys the leaves could hold
+  SIZE_T interiorkeys;
+  SIZE_T interiorcapacity;
+  SIZE_T prefixbytes;    // stored once per leaf, over all the leaves
+  SIZE_T leafbytes;      // the leaves' data bytes
+  SIZE_T payloadbytes;   // of keys and values, in the leaves
+  SIZE_T overflowvalues; // kept in overflow blocks
+  SIZE_T overflowblocks;
+  SIZE_T numpostings;    // values, in an index that isn't unique
+  SIZE_T postingblocks;
+
+  BTreeStats() : depth(0), numleaves(0), numinterior(0), numkeys(0), 
+		 leafcapacity(0), interiorkeys(0), interiorcapacity(0),
+		 prefixbytes(0), leafbytes(0), payloadbytes(0),
+		 overflowvalues(0), overflowblocks(0),
+		 numpostings(0), postingblocks(0) {}
+
+  double GetLeafUtilization() const { return leafcapacity>0 ? (double)numkeys/leafcapacity : 0; }
+  double GetInteriorUtilization() const { return interiorcapacity>0 ? (double)interiorkeys/interiorcapacity : 0; }
+  double GetAveragePrefix() const { return numleaves>0 ? (double)prefixbytes/numleaves : 0; }
+  double GetSpaceUtilization() const { return leafbytes>0 ? (double)payloadbytes/leafbytes : 0; }
+};
+
+//
+// The root to leaf path taken by a descent
+// node[i] is the block at depth i (the root is 0) and slot[i] is the 
+// pointer followed out of it, so a split at depth i goes into 
+// node[i-1] at slot[i-1]
+//
+struct BTreePath {
+  SIZE_T depth;
+  SIZE_T node[BTREE_MAX_DEPTH];
+  SIZE_T slot[BTREE_MAX_DEPTH];
+};
+
+//
+// What a range delete carries down the tree: the blocks it frees, which
+// go back to the free list together at the end, and the last leaf it 
+// trimmed.  That leaf is held back until the next
+// one the delete reaches is known, since every leaf between them is 
+// freed without being read, and becomes its sibling.
+//
+struct BTreeRangeDelete {
+  vector<SIZE_T> freed;
+  BTreeNode      edge;
+  SIZE_T         edgenode;
+};
+
 enum BTreeOp {BTREE_OP_INSERT, BTREE_OP_DELETE, BTREE_OP_UPDATE,BTREE_OP_LOOKUP};
 
 enum BTreeDisplayType {BTREE_DEPTH, BTREE_DEPTH_DOT, BTREE_SORTED_KEYVAL};
@@ -47,18 +236,159 @@ class BTreeIndex {
   SIZE_T       superblock_index;
   BTreeNode    superblock;
 
+  // The top levels of the tree, kept decoded in memory so descents
+  // don't go to the buffer cache for them.  resident[d] holds every 
+  // node at depth d (the root is 0).  Only whole interior levels are 
+  // kept, as many as fit in residentbudget nodes.  Rewriting a resident
+  // node updates its copy, and anything that adds interior nodes to 
+  // those levels marks them stale, to be reread on the next descent.
+  vector<ResidentLevel> resident;
+  SIZE_T                residentbudget;
+  bool                  residentstale;
+  vector<BTreeLevelStats> levelstats;
+  BTreeSplitPolicy      splitpolicy;
+  BTreeDeletePolicy     deletepolicy;
+
+  // The rightmost leaf, decoded, so that keys past the end of the tree
+  // are appended without a descent.  rightleaf is 0 when it isn't 
+  // known.  rightpath is how to get there, if rightpathok, for when the
+  // leaf fills.  Anything else that splits a node or writes the leaf 
+  // forgets it, and the next insert that lands in it finds it again.
+  SIZE_T                rightleaf;
+  BTreeNode             rightnode;
+  BTreePath             rightpath;
+  bool                  rightpathok;
+  SIZE_T                numappends;
+
  protected:
 
   ERROR_T      AllocateNode(SIZE_T &node);
 
   ERROR_T      DeallocateNode(const SIZE_T &node);
+  // Gives a batch of blocks back with one write of the superblock.  
+  // Unlike DeallocateNode, it doesn't read them first.
+  ERROR_T      DeallocateNodes(const vector<SIZE_T> &nodes);
+
+  // Rereads the resident levels if they are stale
+  ERROR_T      LoadResident();
+  // Writes an interior node back, and updates its resident copy
+  ERROR_T      WriteNode(const BTreeNode &b, const SIZE_T &node);
 
   ERROR_T      LookupOrUpdateInternal(const SIZE_T &Node,
 				      const BTreeOp op, 
 				      const KEY_T &key,
 				      VALUE_T &val);
+  // Update by rewriting the leaf, for a value that doesn't fit in place
+  // A ref is where the value already is in overflow blocks
+  ERROR_T      RewriteVal(const KEY_T &key, const VALUE_T &value, const SIZE_T ref=0);
+
+  // Put a value in a chain of newly allocated overflow blocks, and give 
+  // back the first, or give a chain back to the free list
+  ERROR_T      WriteOverflow(const VALUE_T &value, SIZE_T &block);
+  ERROR_T      FreeOverflow(SIZE_T block);
+
+  // Add a value to a key's posting list, or take one out, giving 
+  // ERROR_CONFLICT if it is already there, or ERROR_NONEXISTENT if it 
+  // isn't.  Either may move the list between the leaf and posting 
+  // blocks, so the caller writes p back to the leaf.
+  ERROR_T      AddPosting(BTreePostings &p, const VALUE_T &value);
+  ERROR_T      RemovePosting(BTreePostings &p, const VALUE_T &value);
+  // Put postings in a chain of newly allocated blocks, as full as they 
+  // go (FreeOverflow gives a chain back), or rewrite one block of them
+  ERROR_T      WritePostings(const string &list, BTreePostings &p);
+  ERROR_T      WritePostingBlock(const SIZE_T block, const string &list, const SIZE_T next);
+
+  // Insert and BulkLoad for the values the nodes hold, which in an index
+  // that isn't unique are posting lists
+  ERROR_T      InsertInternal(const KEY_T &key, const VALUE_T &value);
+  ERROR_T      BulkLoadInternal(const vector<KeyValuePair> &pairs, const double fill);
+
+  // Split a full node in two and push the separating key into its parent
+  // The parent comes from the path the insert came down, and offset is
+  // where the key that filled the node went, for the split policy
+  ERROR_T      SplitLeaf(const BTreePath &path, BTreeNode &b, const SIZE_T offset);
+  ERROR_T      SplitInterior(const BTreePath &path,
+			     const SIZE_T level,
+			     BTreeNode &b,
+			     const SIZE_T offset);
+  // If split is given, it says whether the parent had to split too
+  ERROR_T      InsertIntoParent(const BTreePath &path,
+				const SIZE_T level,
+				const KEY_T &key,
+				const SIZE_T &rightnode,
+				bool *split=0);
+
+  // Write back b, the node at depth level of path, which a delete took
+  // something out of.  If that left it underfull, it is first fixed up 
+  // with a sibling, which takes something out of its parent, and so on.
+  ERROR_T      RebalanceAfterDelete(const BTreePath &path,
+				    const SIZE_T level,
+				    BTreeNode &b);
+  // Fix up the underfull child at slot of parent, at depth level, with
+  // the sibling next to it: merge the two if they fit in one node, else
+  // move entries over until they are even.  The children are written 
+  // (or freed) and parent is changed to match, but left for the caller 
+  // to write, unless it was the root and is no longer needed.
+  ERROR_T      FixUnderfull(BTreeNode &parent,
+			    const SIZE_T parentnode,
+			    const SIZE_T level,
+			    const SIZE_T slot,
+			    BTreeNode &child,
+			    bool &merged);
+  // Compacts the subtree under b, whose node is at depth level, which
+  // the caller writes, and says if it should be gone over again
+  ERROR_T      CompactInternal(BTreeNode &b, 
+			       const SIZE_T node, 
+			       const SIZE_T level,
+			       bool &again);
+
+  // Takes lo to hi out of the subtree under b, whose leaves are height 
+  // levels down.  lowinside and highinside say whether the bounds the 
+  // parent puts on it are in the range.  Children entirely inside it 
+  // are freed whole, so only the ones at its ends are gone into.  An
+  // interior b is left for the caller to write, a leaf as del.edge.
+  ERROR_T      DeleteRangeInternal(BTreeNode &b, 
+				   const SIZE_T node,
+				   const SIZE_T height,
+				   const bool lowinside,
+				   const bool highinside,
+				   const KEY_T &lo,
+				   const KEY_T &hi,
+				   BTreeRangeDelete &del);
+  // Every block of the subtree under node, onto del.freed
+  ERROR_T      GetSubtreeBlocks(const SIZE_T node, 
+				const SIZE_T height, 
+				BTreeRangeDelete &del);
+  // Fixes up every underfull node on the way down to key (or to the 
+  // first key above it, if upper), bottom up, or lazily, every interior
+  // node with no keys, and says if it needs another pass: a merge can 
+  // leave another, and a node with no keys that borrowed some has an 
+  // only child below it that was passed over
+  ERROR_T      FixPath(const KEY_T &key, const bool upper, bool &again);
+
+  // Insert a key larger than any in the tree into the rightmost leaf.
+  // A full one is left full and a new rightmost leaf started after it.
+  ERROR_T      AppendRightmost(const KEY_T &key, const VALUE_T &value);
+
+  // Batch insert helpers: merge a sorted run of pairs into one leaf,
+  // splitting it as many ways as needed, then add all the resulting
+  // separators to the interior nodes level by level
+  ERROR_T      InsertBatchIntoLeaf(const SIZE_T &node,
+				   const SIZE_T &parent,
+				   const vector<KeyValuePair> &pairs,
+				   const vector<SIZE_T> &order,
+				   const SIZE_T first,
+				   const SIZE_T last,
+				   vector<ERROR_T> &results,
+				   PendingSeparators &pending);
+  ERROR_T      InsertIntoParents(PendingSeparators &pending,
+				 NodeParents &parents);
   
 
+  ERROR_T      StatsInternal(const SIZE_T &node, 
+			     const SIZE_T depth,
+			     BTreeStats &stats) const;
+
   ERROR_T      DisplayInternal(const SIZE_T &node,
 			       ostream &o, 
 			       const BTreeDisplayType display_type=BTREE_DEPTH) const;
@@ -73,10 +403,19 @@ public:
   // otherwise, the expectation is that keysize and valuesize
   // will be zero and will be read when Attach(initialblock,false) is 
   // invoked
+  // format, likewise, is the node format (BTREE_FORMAT_*) a new index
+  // will be created with, and an existing one has its own.  In the
+  // slotted format, keysize and valuesize are the largest allowed.
+  // Values longer than overflow are kept in chains of blocks of their
+  // own, out of the leaves (0 keeps every value in its leaf).
+  // An index that isn't unique keeps each key once, with a posting list
+  // of its values, each of which is valuesize (at most, if slotted).
   BTreeIndex(SIZE_T keysize, 
 	     SIZE_T valuesize,
 	     BufferCache *cache,
-	     bool unique=true);   // true if a  key maps to a single value
+	     bool unique=true,    // true if a  key maps to a single value
+	     SIZE_T format=BTREE_FORMAT_PLAIN,
+	     SIZE_T overflow=0);
 
 
   BTreeIndex();
@@ -93,6 +432,9 @@ public:
   // you need to find the elements of the tree.
   // return zero on success or ERROR_NOTANINDEX if we are
   // giving you an incorrect block to start with
+  // return ERROR_SIZE on creating a slotted index whose blocks are too
+  // small (or too large) for its largest keys and values, or an index
+  // that isn't unique whose posting blocks can't hold four values
   ERROR_T Attach(const SIZE_T initblock, const bool create=false );
   
   // This is called after all inserts, updates, or deletes are done.
@@ -104,30 +446,135 @@ public:
   // return ERROR_NOSPACE if you run out of disk space
   // return ERROR_SIZE if the key or value are the wrong size for this index
   // return ERROR_CONFLICT if the key already exists and it's a unique index
+  // (if it isn't, this is InsertDup)
   ERROR_T Insert(const KEY_T &key, const VALUE_T &value);
+
+  // Adds value to key's values, in an index that isn't unique
+  // return zero on success
+  // return ERROR_CONFLICT if the key already has this value (or any
+  // value, in a unique index)
+  // return ERROR_SIZE or ERROR_NOSPACE as for Insert
+  ERROR_T InsertDup(const KEY_T &key, const VALUE_T &value);
+
+  // Inserts all the pairs, descending once per distinct target leaf and
+  // writing each touched node once for the whole batch
+  // results, if given, gets one code per pair, as Insert would return it
+  // (the first of several pairs with the same key wins)
+  // In an index that isn't unique, the pairs are added one at a time.
+  // return zero if every pair was inserted
+  // return ERROR_CONFLICT if any key already existed
+  // return ERROR_SIZE if a key or value is the wrong size (nothing is inserted)
+  // return ERROR_NOSPACE if you run out of disk space
+  ERROR_T InsertBatch(const vector<KeyValuePair> &pairs, 
+		      vector<ERROR_T> *results=0);
   
+  // Builds the tree bottom up from pairs, which must be in strictly
+  // increasing key order.  Leaves are packed left to right to fill
+  // (0 < fill <= 1) of their slots, then the interior levels are built 
+  // above them.  Every block is written once, in the order it was allocated.
+  // In an index that isn't unique, pairs with the same key are in 
+  // increasing value order, and become that key's posting list.
+  // return zero on success
+  // return ERROR_CONFLICT if the index is not empty or pairs are out of order
+  // return ERROR_SIZE if a key or value is the wrong size for this index
+  // return ERROR_NOSPACE if you run out of disk space
+  // return ERROR_BADCONFIG if fill is out of range
+  ERROR_T BulkLoad(const vector<KeyValuePair> &pairs, const double fill=1.0);
+
+  // In an index that isn't unique, value replaces all of key's values
   // return zero on success
   // return ERROR_NONEXISTENT  if the key doesn't exist
   // return ERROR_SIZE if the key or value are the wrong size for this index
   ERROR_T Update(const KEY_T &key, const VALUE_T &value);
   
+  // Takes key and its value (all of its values, in an index that isn't
+  // unique) out of the tree, along with any blocks they had of their own
+  // Underfull nodes are then fixed up as the delete policy says.
   // return zero on success
   // return ERROR_NONEXISTENT  if the key doesn't exist
   // return ERROR_SIZE if the key or value are the wrong size for this index
   ERROR_T Delete(const KEY_T &key);
+
+  // Takes value out of key's values, in an index that isn't unique
+  // A key left with none is deleted.  In a unique index, this is 
+  // Delete, if value is key's value.
+  // return zero on success
+  // return ERROR_NONEXISTENT if the key doesn't have this value
+  ERROR_T DeleteValue(const KEY_T &key, const VALUE_T &value);
+
+  // Takes every key from lo to hi out of the tree.  Subtrees entirely 
+  // inside the range are found from the interior nodes and freed whole,
+  // without reading their leaves (unless values can have blocks of their
+  // own), all in one update of the free list, and only the leaves at the
+  // two ends are trimmed.  The ends are then fixed up as the delete 
+  // policy says, but even lazily, an interior node the range took every
+  // key out of is.
+  // return zero on success (even if the range turns out empty)
+  // return ERROR_SIZE if lo or hi are the wrong size for this index
+  ERROR_T DeleteRange(const KEY_T &lo, const KEY_T &hi);
   
+  // In an index that isn't unique, value is the first of key's values
   // return zero on success
   // return ERROR_NONEXISTENT  if the key doesn't exist
   ERROR_T Lookup(const KEY_T &key, VALUE_T &value);
 
+  // All of key's values, in order (the one, in a unique index)
+  // return zero on success
+  // return ERROR_NONEXISTENT  if the key doesn't exist
+  ERROR_T LookupAll(const KEY_T &key, vector<VALUE_T> &values);
+
+  // Position cursor on the first key >= lo; it will stop after hi
+  // With keysonly, the cursor gives empty values, and never reads 
+  // overflow blocks
+  // return zero on success (even if the range turns out empty)
+  ERROR_T Scan(const KEY_T &lo, const KEY_T &hi, BTreeCursor &cursor,
+	       const bool keysonly=false);
+
   // A special user defined function to look up for insert
-  ERROR_T LookupForInsert(const SIZE_T &node, const KEY_T &key, SIZE_T &returnVal);
+  // Walks down from node to the leaf for key, returned in returnVal
+  // If upper is given, it is narrowed to the smallest separator above 
+  // the leaf, ie, the largest key that would be routed to it.  It is 
+  // left alone if there is none, so start it out empty.
+  // If path is given, it records the nodes and slots on the way down.
+  ERROR_T LookupForInsert(const SIZE_T &node, const KEY_T &key, SIZE_T &returnVal,
+			  KEY_T *upper=0, BTreePath *path=0);
 
   // Here you should figure out if your index makes sense
   // Is it a tree?  Is it in order?  Is it balanced?  Does each node have
   // a valid use ratio?
   ERROR_T SanityCheck() const;
 
+  // Most interior nodes to keep resident, 0 for none
+  void    SetResidentBudget(const SIZE_T numnodes);
+  SIZE_T  GetResidentBudget() const { return residentbudget; }
+  // How many levels are resident right now
+  SIZE_T  GetNumResidentLevels() const { return resident.size(); }
+  // One entry per depth that a descent has reached, root first
+  const vector<BTreeLevelStats> &GetLevelStats() const { return levelstats; }
+
+  // How inserts split full nodes (even, unless told otherwise)
+  void    SetSplitPolicy(const BTreeSplitPolicy &policy) { splitpolicy=policy; }
+  const BTreeSplitPolicy &GetSplitPolicy() const { return splitpolicy; }
+
+  // How deletes deal with underfull nodes (eager, unless told otherwise)
+  void    SetDeletePolicy(const BTreeDeletePolicy policy) { deletepolicy=policy; }
+  BTreeDeletePolicy GetDeletePolicy() const { return deletepolicy; }
+
+  // Rebalances every underfull node, bottom up, as eager deletes would 
+  // have, and frees the blocks that empties.  This is what makes lazy 
+  // deletes' leaves full again.
+  ERROR_T Compact();
+
+  // Inserts that went straight to the rightmost leaf
+  SIZE_T  GetNumAppends() const { return numappends; }
+
+  SIZE_T  GetFormat() const { return superblock.info.format; }
+  SIZE_T  GetOverflow() const { return superblock.info.overflow; }
+  bool    IsUnique() const { return superblock.info.IsUnique(); }
+
+  // Walks the whole tree
+  ERROR_T GetStats(BTreeStats &stats) const;
+
   // Display tree
   // BTREE_DEPTH means to do a depth first traversal of 
   // the tree, printing each node
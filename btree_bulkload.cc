@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string>
+#include "btree.h"
+
+void usage() 
+{
+  cerr << "usage: btree_bulkload filestem cachesize[:policy[:high,low]] fill < sorted_keys_and_values\n";
+  cerr << "  each input line is \"key value\", in strictly increasing key order\n";
+  cerr << "  fill is the fraction (0,1] of each node to use\n";
+}
+
+
+int main(int argc, char **argv)
+{
+  char *filestem;
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  SIZE_T superblocknum;
+  double fill;
+
+  if (argc!=4) { 
+    usage();
+    return -1;
+  }
+
+  filestem=argv[1];
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  fill=atof(argv[3]);
+
+  DiskSystem disk(filestem);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
+  BTreeIndex btree(0,0,&cache);
+  
+  ERROR_T rc;
+
+  if ((rc=cache.Attach())!=ERROR_NOERROR) { 
+    cerr << "Can't attach buffer cache due to error"<<rc<<endl;
+    return -1;
+  }
+
+  if ((rc=btree.Attach(0))!=ERROR_NOERROR) { 
+    cerr << "Can't attach to index  due to error "<<rc<<endl;
+    return -1;
+  } else {
+    cerr << "Index attached!"<<endl;
+    vector<KeyValuePair> pairs;
+    string key, value;
+    while (cin >> key >> value) { 
+      pairs.push_back(KeyValuePair(KEY_T(key.c_str()),VALUE_T(value.c_str())));
+    }
+    // Still detach on failure, but say so in the exit status
+    ERROR_T loadrc=btree.BulkLoad(pairs,fill);
+    if (loadrc!=ERROR_NOERROR) { 
+      cerr <<"Can't bulk load index due to error "<<loadrc<<endl;
+    } else {
+      cerr <<"Bulk load of "<<pairs.size()<<" pairs succeeded\n";
+    }
+    if ((rc=btree.Detach(superblocknum))!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from index due to error "<<rc<<endl;
+      return -1;
+    }
+    if ((rc=cache.Detach())!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from cache due to error "<<rc<<endl;
+      return -1;
+    }
+    cerr << "Performance statistics:\n";
+    
+    cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+    cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+    cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+    cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+    cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+    cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
+    cerr << endl;
+    
+    cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
+    return loadrc==ERROR_NOERROR ? 0 : -1;
+  }
+}
+  
+
+  
@@ -3,7 +3,8 @@
 
 void usage() 
 {
-  cerr << "usage: btree_delete filestem cachesize key\n";
+  cerr << "usage: btree_delete filestem cachesize[:policy[:high,low]] key [value]\n";
+  cerr << "  with a value, only that one of the key's values is deleted\n";
 }
 
 
@@ -11,20 +12,29 @@ int main(int argc, char **argv)
 {
   char *filestem;
   SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
   SIZE_T superblocknum;
   char *key;
+  char *value=0;
 
-  if (argc!=4) { 
+  if (argc<4 || argc>5) { 
     usage();
     return -1;
   }
 
   filestem=argv[1];
-  cachesize=atoi(argv[2]);
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
   key=argv[3];
+  if (argc==5) { 
+    value=argv[4];
+  }
 
   DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -40,7 +50,7 @@ int main(int argc, char **argv)
     return -1;
   } else {
     cerr << "Index attached!"<<endl;
-    if ((rc=btree.Delete(KEY_T(key)))!=ERROR_NOERROR) { 
+    if ((rc= value ? btree.DeleteValue(KEY_T(key),VALUE_T(value)) : btree.Delete(KEY_T(key)))!=ERROR_NOERROR) { 
       cerr <<"Can't delete from index due to error "<<rc<<endl;
     } else {
       cerr <<"Delete succeeded\n";
@@ -61,6 +71,10 @@ int main(int argc, char **argv)
     cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
     cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
     cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include "btree.h"
+
+void usage() 
+{
+  cerr << "usage: btree_deleterange filestem cachesize[:policy[:high,low]] lokey hikey [eager|lazy]\n";
+  cerr << "  deletes every key from lokey to hikey\n";
+}
+
+
+int main(int argc, char **argv)
+{
+  char *filestem;
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  SIZE_T superblocknum;
+  char *lokey, *hikey;
+  BTreeDeletePolicy deletepolicy=BTREE_DELETE_EAGER;
+
+  if (argc<5 || argc>6) { 
+    usage();
+    return -1;
+  }
+
+  filestem=argv[1];
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  lokey=argv[3];
+  hikey=argv[4];
+  if (argc==6 && ParseBTreeDeletePolicy(argv[5],deletepolicy)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+
+  DiskSystem disk(filestem);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
+  BTreeIndex btree(0,0,&cache);
+
+  btree.SetDeletePolicy(deletepolicy);
+  
+  ERROR_T rc;
+
+
+  if ((rc=cache.Attach())!=ERROR_NOERROR) { 
+    cerr << "Can't attach buffer cache due to error"<<rc<<endl;
+    return -1;
+  }
+
+  if ((rc=btree.Attach(0))!=ERROR_NOERROR) { 
+    cerr << "Can't attach to index  due to error "<<rc<<endl;
+    return -1;
+  } else {
+    cerr << "Index attached!"<<endl;
+    if ((rc=btree.DeleteRange(KEY_T(lokey),KEY_T(hikey)))!=ERROR_NOERROR) { 
+      cerr <<"Can't delete range from index due to error "<<rc<<endl;
+    } else {
+      cerr <<"Delete range succeeded\n";
+    }
+    if ((rc=btree.Detach(superblocknum))!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from index due to error "<<rc<<endl;
+      return -1;
+    }
+    if ((rc=cache.Detach())!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from cache due to error "<<rc<<endl;
+      return -1;
+    }
+    cerr << "Performance statistics:\n";
+    
+    cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+    cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+    cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+    cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+    cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+    cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
+    cerr << endl;
+    
+    cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
+    return 0;
+  }
+}
+  
+
+  
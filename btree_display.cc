@@ -3,7 +3,7 @@
 
 void usage() 
 {
-  cerr << "usage: btree_display filestem cachesize dot|normal\n";
+  cerr << "usage: btree_display filestem cachesize[:policy[:high,low]] dot|normal\n";
 }
 
 
@@ -12,6 +12,8 @@ int main(int argc, char **argv)
   char *filestem;
   bool dot;
   SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
   SIZE_T superblocknum;
 
   if (argc!=4) { 
@@ -20,11 +22,14 @@ int main(int argc, char **argv)
   }
 
   filestem=argv[1];
-  cachesize=atoi(argv[2]);
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
   dot=argv[3][0]=='d' || argv[3][0]=='D';
 
   DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -62,6 +67,10 @@ int main(int argc, char **argv)
     cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
     cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
     cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
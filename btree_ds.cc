@@ -19,12 +19,163 @@ SIZE_T NodeMetadata::GetNumDataBytes() const
 
 SIZE_T NodeMetadata::GetNumSlotsAsInterior() const
 {
-  return (GetNumDataBytes()-sizeof(SIZE_T))/(keysize+sizeof(SIZE_T));  // floor intended
+  return (GetNumDataBytes()-sizeof(SIZE_T))/(GetKeySlotBytes()+sizeof(SIZE_T));  // floor intended
 }
 
 SIZE_T NodeMetadata::GetNumSlotsAsLeaf() const
 {
-  return (GetNumDataBytes()-sizeof(SIZE_T))/(keysize+valuesize);  // floor intended
+  return GetNumSlotsAsLeaf(prefixlen);
+}
+
+SIZE_T NodeMetadata::GetNumSlotsAsLeaf(const SIZE_T prefix) const
+{
+  if (GetNumDataBytes()<sizeof(SIZE_T)+prefix) { 
+    return 0;
+  }
+  if (format==BTREE_FORMAT_SLOTTED) { 
+    return (GetNumDataBytes()-sizeof(SIZE_T))/GetSlottedPairBytes();
+  }
+  return (GetNumDataBytes()-sizeof(SIZE_T)-prefix)/(keysize-prefix+GetMaxValueCellBytes());  // floor intended
+}
+
+SIZE_T NodeMetadata::GetKeySlotBytes() const
+{
+  return format==BTREE_FORMAT_SLOTTED ? sizeof(SLOT_T)+keysize : keysize;
+}
+
+SIZE_T NodeMetadata::GetValueSlotBytes() const
+{
+  return format==BTREE_FORMAT_SLOTTED ? sizeof(SLOT_T)+GetMaxValueCellBytes() : GetMaxValueCellBytes();
+}
+
+bool NodeMetadata::IsKeySize(const SIZE_T len) const
+{
+  if (format==BTREE_FORMAT_SLOTTED) { 
+    // An empty key is how a batch says it has no upper bound
+    return len>=1 && len<=keysize;
+  }
+  return len==keysize;
+}
+
+bool NodeMetadata::IsValueSize(const SIZE_T len) const
+{
+  return format==BTREE_FORMAT_SLOTTED ? len<=valuesize : len==valuesize;
+}
+
+bool NodeMetadata::IsOverflow(const SIZE_T len) const
+{
+  return overflow>0 && len>overflow;
+}
+
+SIZE_T NodeMetadata::GetValueCellBytes(const SIZE_T len) const
+{
+  return IsOverflow(len) ? sizeof(SIZE_T) : len;
+}
+
+SIZE_T NodeMetadata::GetMaxValueCellBytes() const
+{
+  if (!IsOverflow(valuesize)) { 
+    return valuesize;
+  }
+  // Every value in a plain tree is valuesize, so all of them overflow,
+  // but a slotted one keeps values of up to overflow bytes
+  if (format==BTREE_FORMAT_SLOTTED && overflow>sizeof(SIZE_T)) { 
+    return overflow;
+  }
+  return sizeof(SIZE_T);
+}
+
+SIZE_T NodeMetadata::GetOverflowBytesPerBlock() const
+{
+  return GetNumDataBytes()-sizeof(SIZE_T);
+}
+
+bool NodeMetadata::IsPostingSize(const SIZE_T len) const
+{
+  return format==BTREE_FORMAT_SLOTTED ? len<=postingsize : len==postingsize;
+}
+
+SIZE_T NodeMetadata::GetPostingBytes(const SIZE_T len) const
+{
+  return format==BTREE_FORMAT_SLOTTED ? sizeof(SLOT_T)+len : len;
+}
+
+SIZE_T NodeMetadata::GetPostingCellBytes() const
+{
+  SIZE_T n=BTREE_POSTING_INLINE*GetPostingBytes(postingsize);
+
+  // and always room for where the list went when it spilled
+  if (n<2*sizeof(SIZE_T)) { 
+    n=2*sizeof(SIZE_T);
+  }
+  return sizeof(SIZE_T)+n;
+}
+
+SIZE_T NodeMetadata::GetSlottedPairBytes(const SIZE_T keylen, const SIZE_T vallen) const
+{
+  return 3*sizeof(SLOT_T)+keylen+GetValueCellBytes(vallen);
+}
+
+SIZE_T NodeMetadata::GetSlottedPairBytes() const
+{
+  return 3*sizeof(SLOT_T)+keysize+GetMaxValueCellBytes();
+}
+
+SIZE_T NodeMetadata::GetLeafPrefix(const char *lo, const char *hi) const
+{
+  SIZE_T n=0;
+
+  if (format!=BTREE_FORMAT_PREFIX) { 
+    return 0;
+  }
+  // Leave at least a byte of every key in its slot
+  while (n+1<keysize && lo[n]==hi[n]) { 
+    n++;
+  }
+  return n;
+}
+
+SIZE_T NodeMetadata::GetNumBufferBytes() const
+{
+  SIZE_T n=GetNumDataBytes();
+
+  if (nodetype==BTREE_LEAF_NODE && format==BTREE_FORMAT_PREFIX && keysize>0) { 
+    // The longest prefix packs the most pairs in
+    SIZE_T m=sizeof(SIZE_T)+GetNumSlotsAsLeaf(keysize-1)*(keysize+GetMaxValueCellBytes());
+    if (m>n) { 
+      n=m;
+    }
+  }
+  if (nodetype==BTREE_LEAF_NODE && format==BTREE_FORMAT_SLOTTED) { 
+    // The shortest records, a one byte key and no value, pack the most
+    // pairs in, and each gets a full slot once decoded
+    SIZE_T m=sizeof(SIZE_T)+(n-sizeof(SIZE_T))/GetSlottedPairBytes(1,0)*(GetKeySlotBytes()+GetValueSlotBytes());
+    if (m>n) { 
+      n=m;
+    }
+  }
+  return n;
+}
+
+
+const char *GetBTreeFormatName(const SIZE_T format)
+{
+  return format==BTREE_FORMAT_PREFIX ? "prefix" : 
+    format==BTREE_FORMAT_SLOTTED ? "slotted" : "plain";
+}
+
+ERROR_T ParseBTreeFormat(const char *name, SIZE_T &format)
+{
+  if (!strcmp(name,"plain")) { 
+    format=BTREE_FORMAT_PLAIN;
+  } else if (!strcmp(name,"prefix")) { 
+    format=BTREE_FORMAT_PREFIX;
+  } else if (!strcmp(name,"slotted")) { 
+    format=BTREE_FORMAT_SLOTTED;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
 }
 
 
@@ -36,7 +187,9 @@ ostream & NodeMetadata::Print(ostream &os) const
 				   nodetype==BTREE_INTERIOR_NODE ? "INTERIOR_NODE" :
 				   nodetype==BTREE_LEAF_NODE ? "LEAF_NODE" : "UNKNOWN_TYPE")
      << ", keysize="<<keysize<<", valuesize="<<valuesize<<", blocksize="<<blocksize
-     << ", rootnode="<<rootnode<<", freelist="<<freelist<<", numkeys="<<numkeys<<")";
+     << ", rootnode="<<rootnode<<", freelist="<<freelist<<", numkeys="<<numkeys
+     << ", format="<<GetBTreeFormatName(format)<<", prefixlen="<<prefixlen
+     << ", overflow="<<overflow<<", postingsize="<<postingsize<<")";
   return os;
 }
 
@@ -56,7 +209,8 @@ BTreeNode::~BTreeNode()
 }
 
 
-BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size)
+BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size,
+		     SIZE_T format, SIZE_T overflow)
 {
   info.nodetype=node_type;
   info.keysize=key_size;
@@ -65,10 +219,14 @@ BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T b
   info.rootnode=0;
   info.freelist=0;
   info.numkeys=0;				       
+  info.format=format;
+  info.prefixlen=0;
+  info.overflow=overflow;
+  info.postingsize=0;
   data=0;
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
-    data = new char [info.GetNumDataBytes()];
-    memset(data,0,info.GetNumDataBytes());
+    data = new char [info.GetNumBufferBytes()];
+    memset(data,0,info.GetNumBufferBytes());
   }
 }
 
@@ -81,17 +239,288 @@ BTreeNode::BTreeNode(const BTreeNode &rhs)
   info.rootnode=rhs.info.rootnode;
   info.freelist=rhs.info.freelist;
   info.numkeys=rhs.info.numkeys;				       
+  info.format=rhs.info.format;
+  info.prefixlen=rhs.info.prefixlen;
+  info.overflow=rhs.info.overflow;
+  info.postingsize=rhs.info.postingsize;
   data=0;
   if (rhs.data) { 
-   data=new char [info.GetNumDataBytes()];
-    memcpy(data,rhs.data,info.GetNumDataBytes());
+   data=new char [info.GetNumBufferBytes()];
+    memcpy(data,rhs.data,info.GetNumBufferBytes());
   }
 }
 
 
 BTreeNode & BTreeNode::operator=(const BTreeNode &rhs) 
 {
-  return *(new (this) BTreeNode(rhs));
+  if (this==&rhs) { 
+    return *this;
+  }
+  // Keep our data buffer if it is already the right size
+  if (data && (!rhs.data || info.GetNumBufferBytes()!=rhs.info.GetNumBufferBytes())) { 
+    delete [] data;
+    data=0;
+  }
+  info=rhs.info;
+  if (rhs.data) { 
+    if (!data) { 
+      data=new char [info.GetNumBufferBytes()];
+    }
+    memcpy(data,rhs.data,info.GetNumBufferBytes());
+  }
+  return *this;
+}
+
+
+//
+// Where things live in a node's data, shared by BTreeNode and BTreeNodeView.
+// Only a slotted leaf is laid out differently when stored, so for one,
+// stored says which layout data is in.
+//
+static SIZE_T GetLengthAt(const char *p)
+{
+  SLOT_T len;
+
+  // In the slotted format, a key or value's length comes right before it
+  memcpy(&len,p-sizeof(SLOT_T),sizeof(SLOT_T));
+  return len;
+}
+
+static void SetLengthAt(char *p, const SIZE_T len)
+{
+  SLOT_T l=len;
+
+  memcpy(p-sizeof(SLOT_T),&l,sizeof(SLOT_T));
+}
+
+
+static char *ResolveKeyIn(const NodeMetadata &info, char *data, const SIZE_T offset, 
+			  const bool stored)
+{
+  SIZE_T lenbytes=info.GetKeySlotBytes()-info.keysize;
+
+  switch (info.nodetype) { 
+  case BTREE_INTERIOR_NODE:
+  case BTREE_ROOT_NODE:
+    assert(offset<info.numkeys);
+    return data+sizeof(SIZE_T)+offset*(sizeof(SIZE_T)+info.GetKeySlotBytes())+lenbytes;
+    break;
+  case BTREE_LEAF_NODE:
+    assert(offset<info.numkeys);
+    if (stored && info.format==BTREE_FORMAT_SLOTTED) { 
+      SLOT_T off;
+      memcpy(&off,data+sizeof(SIZE_T)+offset*sizeof(SLOT_T),sizeof(SLOT_T));
+      return data+off+lenbytes;
+    }
+    return data+sizeof(SIZE_T)+info.prefixlen
+      +offset*(info.GetKeySlotBytes()-info.prefixlen+info.GetValueSlotBytes())+lenbytes;
+    break;
+  default:
+    return 0;
+  }
+}
+
+
+static char *ResolvePtrIn(const NodeMetadata &info, char *data, const SIZE_T offset)
+{
+  switch (info.nodetype) { 
+  case BTREE_INTERIOR_NODE:
+  case BTREE_ROOT_NODE:
+    assert(offset<=info.numkeys);
+    return data+offset*(sizeof(SIZE_T)+info.GetKeySlotBytes());
+    break;
+  case BTREE_LEAF_NODE:
+  case BTREE_OVERFLOW_BLOCK:
+  case BTREE_POSTING_BLOCK:
+    assert(offset==0);
+    return data;
+    break;
+  default:
+    return 0;
+  }
+}
+
+
+static char *ResolveValIn(const NodeMetadata &info, char *data, const SIZE_T offset,
+			  const bool stored)
+{
+  char *k;
+
+  switch (info.nodetype) { 
+  case BTREE_LEAF_NODE:
+    k=ResolveKeyIn(info,data,offset,stored);
+    if (stored && info.format==BTREE_FORMAT_SLOTTED) { 
+      return k+GetLengthAt(k)+sizeof(SLOT_T);
+    }
+    return k+info.keysize-info.prefixlen+info.GetValueSlotBytes()-info.GetMaxValueCellBytes();
+    break;
+  default:
+    return 0;
+  }
+}
+
+
+static SIZE_T KeyLengthAt(const NodeMetadata &info, const char *p)
+{
+  return info.format==BTREE_FORMAT_SLOTTED ? GetLengthAt(p) : info.keysize;
+}
+
+static SIZE_T ValLengthAt(const NodeMetadata &info, const char *p)
+{
+  return info.format==BTREE_FORMAT_SLOTTED ? GetLengthAt(p) : info.valuesize;
+}
+
+
+//
+// Compares the key at p with k.  In a leaf stored with a prefix, p is 
+// the rest of the key, and the prefix is at the front of data.
+//
+static int CompareKeyAt(const NodeMetadata &info, const char *data, const char *p, const KEY_T &k)
+{
+  SIZE_T len=KeyLengthAt(info,p);
+  SIZE_T n = k.length<len ? k.length : len;
+  SIZE_T m = n<info.prefixlen ? n : info.prefixlen;
+  int c=memcmp(data+sizeof(SIZE_T),k.data,m);
+
+  if (c==0) { 
+    c=memcmp(p,k.data+m,n-m);
+  }
+  if (c!=0 || k.length==len) { 
+    return c;
+  } else {
+    // a short key sorts before every key it is a prefix of
+    return k.length<len ? 1 : -1;
+  }
+}
+
+
+static void GetKeyAt(const NodeMetadata &info, const char *data, const char *p, KEY_T &k)
+{
+  SIZE_T len=KeyLengthAt(info,p);
+
+  k.Resize(len,false);
+  memcpy(k.data,data+sizeof(SIZE_T),info.prefixlen);
+  memcpy(k.data+info.prefixlen,p,len-info.prefixlen);
+}
+
+static ERROR_T GetValAt(const NodeMetadata &info, const char *p, VALUE_T &v)
+{
+  SIZE_T len=ValLengthAt(info,p);
+
+  if (info.IsOverflow(len)) { 
+    return ERROR_INSANE;
+  }
+  v.Resize(len,false);
+  memcpy(v.data,p,len);
+  return ERROR_NOERROR;
+}
+
+static ERROR_T GetValRefAt(const NodeMetadata &info, const char *p, SIZE_T &block)
+{
+  if (!info.IsOverflow(ValLengthAt(info,p))) { 
+    return ERROR_INSANE;
+  }
+  memcpy(&block,p,sizeof(SIZE_T));
+  return ERROR_NOERROR;
+}
+
+static ERROR_T SetValRefAt(const NodeMetadata &info, char *p, const SIZE_T length, const SIZE_T block)
+{
+  if (!info.IsOverflow(length) || !info.IsValueSize(length)) { 
+    return ERROR_INSANE;
+  }
+  if (info.format==BTREE_FORMAT_SLOTTED) { 
+    SetLengthAt(p,length);
+  }
+  memcpy(p,&block,sizeof(SIZE_T));
+  return ERROR_NOERROR;
+}
+
+
+//
+// A leaf's sibling pointer and pairs, between the decoded layout, with
+// full keys, and the stored one, with the first info.prefixlen bytes of 
+// each key once, up front
+//
+static void PackLeaf(const NodeMetadata &info, const char *from, char *to)
+{
+  SIZE_T rest=info.keysize-info.prefixlen+info.GetMaxValueCellBytes();
+
+  memcpy(to,from,sizeof(SIZE_T)+info.prefixlen);
+  from+=sizeof(SIZE_T);
+  to+=sizeof(SIZE_T)+info.prefixlen;
+  for (SIZE_T i=0;i<info.numkeys;i++) { 
+    memcpy(to,from+info.prefixlen,rest);
+    from+=info.keysize+info.GetMaxValueCellBytes();
+    to+=rest;
+  }
+}
+
+static void UnpackLeaf(const NodeMetadata &info, const char *from, char *to)
+{
+  SIZE_T rest=info.keysize-info.prefixlen+info.GetMaxValueCellBytes();
+  const char *prefix=from+sizeof(SIZE_T);
+
+  memcpy(to,from,sizeof(SIZE_T));
+  from+=sizeof(SIZE_T)+info.prefixlen;
+  to+=sizeof(SIZE_T);
+  for (SIZE_T i=0;i<info.numkeys;i++) { 
+    memcpy(to,prefix,info.prefixlen);
+    memcpy(to+info.prefixlen,from,rest);
+    from+=rest;
+    to+=info.keysize+info.GetMaxValueCellBytes();
+  }
+}
+
+
+//
+// The same for a slotted leaf, whose records are stored packed against 
+// the end of the block.  Packing leaves no holes, so a leaf is compacted
+// every time it is written.
+//
+static SIZE_T GetSlottedBytes(const NodeMetadata &info, char *data, const SIZE_T first, 
+			      const SIZE_T num)
+{
+  SIZE_T n=sizeof(SIZE_T);
+
+  for (SIZE_T i=first;i<first+num;i++) { 
+    n+=info.GetSlottedPairBytes(GetLengthAt(ResolveKeyIn(info,data,i,false)),
+				GetLengthAt(ResolveValIn(info,data,i,false)));
+  }
+  return n;
+}
+
+static void PackSlotted(const NodeMetadata &info, char *from, char *to)
+{
+  SIZE_T end=info.GetNumDataBytes();
+
+  memcpy(to,from,sizeof(SIZE_T));
+  for (SIZE_T i=0;i<info.numkeys;i++) { 
+    char *k=ResolveKeyIn(info,from,i,false);
+    char *v=ResolveValIn(info,from,i,false);
+    SIZE_T klen=GetLengthAt(k), vlen=info.GetValueCellBytes(GetLengthAt(v));
+    SLOT_T off;
+
+    end-=2*sizeof(SLOT_T)+klen+vlen;
+    memcpy(to+end,k-sizeof(SLOT_T),sizeof(SLOT_T)+klen);
+    memcpy(to+end+sizeof(SLOT_T)+klen,v-sizeof(SLOT_T),sizeof(SLOT_T)+vlen);
+    off=end;
+    memcpy(to+sizeof(SIZE_T)+i*sizeof(SLOT_T),&off,sizeof(SLOT_T));
+  }
+}
+
+static void UnpackSlotted(const NodeMetadata &info, char *from, char *to)
+{
+  memcpy(to,from,sizeof(SIZE_T));
+  for (SIZE_T i=0;i<info.numkeys;i++) { 
+    char *k=ResolveKeyIn(info,from,i,true);
+    char *v=ResolveValIn(info,from,i,true);
+
+    memcpy(ResolveKeyIn(info,to,i,false)-sizeof(SLOT_T),k-sizeof(SLOT_T),
+	   sizeof(SLOT_T)+GetLengthAt(k));
+    memcpy(ResolveValIn(info,to,i,false)-sizeof(SLOT_T),v-sizeof(SLOT_T),
+	   sizeof(SLOT_T)+info.GetValueCellBytes(GetLengthAt(v)));
+  }
 }
 
 
@@ -102,7 +531,20 @@ ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const
   Block block(sizeof(info)+info.GetNumDataBytes());
 
   memcpy(block.data,&info,sizeof(info));
-  if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
+  if (info.nodetype==BTREE_LEAF_NODE && info.format==BTREE_FORMAT_PREFIX) { 
+    NodeMetadata *stored=(NodeMetadata*)block.data;
+
+    stored->prefixlen=GetLeafPrefix();
+    if (info.numkeys>stored->GetNumSlotsAsLeaf()) { 
+      return ERROR_NOSPACE;
+    }
+    PackLeaf(*stored,data,(char*)block.data+sizeof(info));
+  } else if (info.nodetype==BTREE_LEAF_NODE && info.format==BTREE_FORMAT_SLOTTED) { 
+    if (GetSlottedBytes(info,data,0,info.numkeys)>info.GetNumDataBytes()) { 
+      return ERROR_NOSPACE;
+    }
+    PackSlotted(info,data,(char*)block.data+sizeof(info));
+  } else if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
     memcpy(block.data+sizeof(info),data,info.GetNumDataBytes());
   }
 
@@ -132,8 +574,16 @@ ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
   assert(b->GetBlockSize()==(unsigned)info.blocksize);
 
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
-    data = new char [info.GetNumDataBytes()];
-    memcpy(data,block.data+sizeof(info),info.GetNumDataBytes());
+    data = new char [info.GetNumBufferBytes()];
+    memset(data+info.GetNumDataBytes(),0,info.GetNumBufferBytes()-info.GetNumDataBytes());
+    if (info.nodetype==BTREE_LEAF_NODE && info.prefixlen>0) { 
+      UnpackLeaf(info,(char*)block.data+sizeof(info),data);
+      info.prefixlen=0;
+    } else if (info.nodetype==BTREE_LEAF_NODE && info.format==BTREE_FORMAT_SLOTTED) { 
+      UnpackSlotted(info,(char*)block.data+sizeof(info),data);
+    } else {
+      memcpy(data,block.data+sizeof(info),info.GetNumDataBytes());
+    }
   }
   
   return ERROR_NOERROR;
@@ -142,62 +592,26 @@ ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
 
 char * BTreeNode::ResolveKey(const SIZE_T offset) const
 {
-  switch (info.nodetype) { 
-  case BTREE_INTERIOR_NODE:
-  case BTREE_ROOT_NODE:
-    cout << "Resolve Key Root Call" << endl;
-    cout << "info.numkeys: " << info.numkeys << endl;
-    cout << "data: " << data << endl;
-    cout << "sizeof(SIZE_T): " << sizeof(SIZE_T) << endl;
-    assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(sizeof(SIZE_T)+info.keysize);
-    break;
-  case BTREE_LEAF_NODE:
-    assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(info.keysize+info.valuesize);
-    break;
-  default:
-    return 0;
-  }
+  return ResolveKeyIn(info,data,offset,false);
 }
 
 
 char * BTreeNode::ResolvePtr(const SIZE_T offset) const
 {
-  switch (info.nodetype) { 
-  case BTREE_INTERIOR_NODE:
-  case BTREE_ROOT_NODE:
-    assert(offset<=info.numkeys);
-    return data+offset*(sizeof(SIZE_T)+info.keysize);
-    break;
-  case BTREE_LEAF_NODE:
-    assert(offset==0);
-    return data;
-    break;
-  default:
-    return 0;
-  }
+  return ResolvePtrIn(info,data,offset);
 }
 
 
-
 char * BTreeNode::ResolveVal(const SIZE_T offset) const
 {
-  switch (info.nodetype) { 
-  case BTREE_LEAF_NODE:
-    assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(info.keysize+info.valuesize)+info.keysize;
-    break;
-  default:
-    return 0;
-  }
+  return ResolveValIn(info,data,offset,false);
 }
 
 
 
 char * BTreeNode::ResolveKeyVal(const SIZE_T offset) const
 {
-  return ResolveKey(offset);
+  return ResolveKey(offset)-(info.GetKeySlotBytes()-info.keysize);
 }
 
 ERROR_T BTreeNode::GetKey(const SIZE_T offset, KEY_T &k) const
@@ -208,8 +622,7 @@ ERROR_T BTreeNode::GetKey(const SIZE_T offset, KEY_T &k) const
     return ERROR_NOMEM;
   }
   
-  k.Resize(info.keysize,false);
-  memcpy(k.data,p,info.keysize);
+  GetKeyAt(info,data,p,k);
   return ERROR_NOERROR;
 }
 
@@ -233,9 +646,7 @@ ERROR_T BTreeNode::GetVal(const SIZE_T offset, VALUE_T &v) const
     return ERROR_NOMEM;
   }
   
-  v.Resize(info.valuesize,false);
-  memcpy(v.data,p,info.valuesize);
-  return ERROR_NOERROR;
+  return GetValAt(info,p,v);
 }
 
 ERROR_T BTreeNode::GetKeyVal(const SIZE_T offset, KeyValuePair &p) const
@@ -258,7 +669,15 @@ ERROR_T BTreeNode::SetKey(const SIZE_T offset, const KEY_T &k)
     return ERROR_NOMEM;
   }
 
-  memcpy(p,k.data,info.keysize);
+  if (info.format==BTREE_FORMAT_SLOTTED) { 
+    if (k.length>info.keysize) { 
+      return ERROR_SIZE;
+    }
+    SetLengthAt(p,k.length);
+    memcpy(p,k.data,k.length);
+  } else {
+    memcpy(p,k.data,info.keysize);
+  }
 
   return ERROR_NOERROR;
 }
@@ -285,7 +704,21 @@ ERROR_T BTreeNode::SetVal(const SIZE_T offset, const VALUE_T &v)
     return ERROR_NOMEM;
   }
   
-  memcpy(p,v.data,info.valuesize);
+  if (info.format==BTREE_FORMAT_SLOTTED) { 
+    if (v.length>info.valuesize) { 
+      return ERROR_SIZE;
+    }
+    if (info.IsOverflow(v.length)) { 
+      return ERROR_INSANE;
+    }
+    SetLengthAt(p,v.length);
+    memcpy(p,v.data,v.length);
+  } else {
+    if (info.IsOverflow(info.valuesize)) { 
+      return ERROR_INSANE;
+    }
+    memcpy(p,v.data,info.valuesize);
+  }
   
   return ERROR_NOERROR;
 }
@@ -303,6 +736,196 @@ ERROR_T BTreeNode::SetKeyVal(const SIZE_T offset, const KeyValuePair &p)
 }
 
 
+int BTreeNode::CompareKey(const SIZE_T offset, const KEY_T &k) const
+{
+  return CompareKeyAt(info,data,ResolveKey(offset),k);
+}
+
+
+SIZE_T BTreeNode::GetKeyLength(const SIZE_T offset) const
+{
+  return KeyLengthAt(info,ResolveKey(offset));
+}
+
+SIZE_T BTreeNode::GetValLength(const SIZE_T offset) const
+{
+  return ValLengthAt(info,ResolveVal(offset));
+}
+
+
+bool BTreeNode::IsValRef(const SIZE_T offset) const
+{
+  return info.IsOverflow(GetValLength(offset));
+}
+
+ERROR_T BTreeNode::GetValRef(const SIZE_T offset, SIZE_T &block) const
+{
+  return GetValRefAt(info,ResolveVal(offset),block);
+}
+
+ERROR_T BTreeNode::SetValRef(const SIZE_T offset, const SIZE_T length, const SIZE_T block)
+{
+  return SetValRefAt(info,ResolveVal(offset),length,block);
+}
+
+
+static SIZE_T numkeycompares=0;
+
+SIZE_T BTreeNode::GetNumKeyCompares()
+{
+  return numkeycompares;
+}
+
+void BTreeNode::ResetNumKeyCompares()
+{
+  numkeycompares=0;
+}
+
+//
+// Shared by LowerBound and UpperBound
+// Narrows [lo,hi) until lo is the first key that is >= k (or > k if upper)
+//
+static ERROR_T BinarySearch(const NodeMetadata &info, char *data, const bool stored,
+			    const KEY_T &k, const bool upper, SIZE_T &offset)
+{
+  SIZE_T lo=0, hi=info.numkeys, mid;
+  int c;
+
+  while (lo<hi) { 
+    mid=lo+(hi-lo)/2;
+    c=CompareKeyAt(info,data,ResolveKeyIn(info,data,mid,stored),k);
+    numkeycompares++;
+    if (upper ? c<=0 : c<0) { 
+      lo=mid+1;
+    } else {
+      hi=mid;
+    }
+  }
+  offset=lo;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeNode::LowerBound(const KEY_T &k, SIZE_T &offset) const
+{
+  return BinarySearch(info,data,false,k,false,offset);
+}
+
+ERROR_T BTreeNode::UpperBound(const KEY_T &k, SIZE_T &offset) const
+{
+  return BinarySearch(info,data,false,k,true,offset);
+}
+
+
+ERROR_T BTreeNode::InsertKeyVal(const SIZE_T offset, const KEY_T &k, const VALUE_T &v,
+			       const SIZE_T ref)
+{
+  if (info.nodetype!=BTREE_LEAF_NODE || offset>info.numkeys) { 
+    return ERROR_INSANE;
+  }
+  // A decoded leaf can hold more than its format may be able to store,
+  // which is for the caller to check
+  SIZE_T slotbytes=info.GetKeySlotBytes()+info.GetValueSlotBytes();
+
+  if (sizeof(SIZE_T)+(info.numkeys+1)*slotbytes>info.GetNumBufferBytes()) { 
+    return ERROR_NOSPACE;
+  }
+
+  info.numkeys++;
+  if (offset+1<info.numkeys) { 
+    memmove(ResolveKeyVal(offset+1),ResolveKeyVal(offset),(info.numkeys-1-offset)*slotbytes);
+  }
+
+  ERROR_T rc=SetKey(offset,k);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  } else if (ref) { 
+    return SetValRef(offset,v.length,ref);
+  } else {
+    return SetVal(offset,v);
+  }
+}
+
+
+SIZE_T BTreeNode::GetLeafPrefix(const SIZE_T first, const SIZE_T num) const
+{
+  if (num==0) { 
+    return 0;
+  }
+  return info.GetLeafPrefix(ResolveKey(first),ResolveKey(first+num-1));
+}
+
+
+SIZE_T BTreeNode::GetNumSlotsAsLeaf(const SIZE_T first, const SIZE_T num) const
+{
+  if (info.format==BTREE_FORMAT_SLOTTED) { 
+    SIZE_T used=GetSlottedBytes(info,data,first,num);
+    SIZE_T largest=info.GetSlottedPairBytes();
+
+    if (used>=info.GetNumDataBytes()) { 
+      return num;
+    }
+    return num+(info.GetNumDataBytes()-used)/largest;
+  }
+  return info.GetNumSlotsAsLeaf(GetLeafPrefix(first,num));
+}
+
+
+ERROR_T BTreeNode::InsertKeyPtr(const SIZE_T offset, const KEY_T &k, const SIZE_T &p)
+{
+  if ((info.nodetype!=BTREE_INTERIOR_NODE && info.nodetype!=BTREE_ROOT_NODE) || offset>info.numkeys) { 
+    return ERROR_INSANE;
+  }
+  if (info.numkeys>=info.GetNumSlotsAsInterior()) { 
+    return ERROR_NOSPACE;
+  }
+
+  // everything from key offset through the last pointer moves one slot right
+  info.numkeys++;
+  if (offset+1<info.numkeys) { 
+    memmove(ResolvePtr(offset+1)+sizeof(SIZE_T),ResolvePtr(offset)+sizeof(SIZE_T),
+	    (info.numkeys-1-offset)*(info.GetKeySlotBytes()+sizeof(SIZE_T)));
+  }
+
+  ERROR_T rc=SetKey(offset,k);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  } else {
+    return SetPtr(offset+1,p);
+  }
+}
+
+
+ERROR_T BTreeNode::RemoveKeyVal(const SIZE_T offset, const SIZE_T count)
+{
+  if (info.nodetype!=BTREE_LEAF_NODE || offset+count>info.numkeys) { 
+    return ERROR_INSANE;
+  }
+  SIZE_T slotbytes=info.GetKeySlotBytes()+info.GetValueSlotBytes();
+
+  if (offset+count<info.numkeys) { 
+    memmove(ResolveKeyVal(offset),ResolveKeyVal(offset+count),(info.numkeys-count-offset)*slotbytes);
+  }
+  info.numkeys-=count;
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNode::RemoveKeyPtr(const SIZE_T offset, const SIZE_T count)
+{
+  if ((info.nodetype!=BTREE_INTERIOR_NODE && info.nodetype!=BTREE_ROOT_NODE) || offset+count>info.numkeys) { 
+    return ERROR_INSANE;
+  }
+
+  // everything after pointer offset+count moves count slots left
+  if (offset+count<info.numkeys) { 
+    memmove(ResolvePtr(offset)+sizeof(SIZE_T),ResolvePtr(offset+count)+sizeof(SIZE_T),
+	    (info.numkeys-count-offset)*(info.GetKeySlotBytes()+sizeof(SIZE_T)));
+  }
+  info.numkeys-=count;
+  return ERROR_NOERROR;
+}
 
 
 ostream & BTreeNode::Print(ostream &os) const 
@@ -337,8 +960,14 @@ ostream & BTreeNode::Print(ostream &os) const
 	}
 	GetKey(i,key);
 	os<<key<<", ";
-	GetVal(i,val);
-	os<<val;
+	if (IsValRef(i)) { 
+	  SIZE_T ref;
+	  GetValRef(i,ref);
+	  os<<"overflow("<<GetValLength(i)<<" bytes at "<<ref<<")";
+	} else {
+	  GetVal(i,val);
+	  os<<val;
+	}
       }
       os <<")";
     }
@@ -346,3 +975,223 @@ ostream & BTreeNode::Print(ostream &os) const
   os <<")";
   return os;
 }
+
+
+BTreeNodeView::BTreeNodeView() : info(0), data(0), dirty(false), cache(0), block(0)
+{}
+
+BTreeNodeView::~BTreeNodeView()
+{
+  Unpin();
+}
+
+
+ERROR_T BTreeNodeView::Pin(BufferCache *b, const SIZE_T blocknum)
+{
+  Block *frame;
+  ERROR_T rc;
+
+  rc=Unpin();
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  rc=b->PinBlock(blocknum,frame);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  cache=b;
+  block=blocknum;
+  info=(NodeMetadata*)(frame->data);
+  data=(char*)(frame->data)+sizeof(NodeMetadata);
+  dirty=false;
+
+  assert(b->GetBlockSize()==(unsigned)info->blocksize);
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::Unpin()
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  if (cache) { 
+    rc=cache->UnpinBlock(block,dirty);
+  }
+  cache=0;
+  info=0;
+  data=0;
+  dirty=false;
+  return rc;
+}
+
+
+char * BTreeNodeView::ResolveKey(const SIZE_T offset) const
+{
+  return ResolveKeyIn(*info,data,offset,true);
+}
+
+char * BTreeNodeView::ResolvePtr(const SIZE_T offset) const
+{
+  return ResolvePtrIn(*info,data,offset);
+}
+
+char * BTreeNodeView::ResolveVal(const SIZE_T offset) const
+{
+  return ResolveValIn(*info,data,offset,true);
+}
+
+
+ERROR_T BTreeNodeView::GetKey(const SIZE_T offset, KEY_T &k) const
+{
+  char *p=ResolveKey(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  GetKeyAt(*info,data,p,k);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeNodeView::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
+{
+  char *p=ResolvePtr(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  memcpy(&ptr,p,sizeof(SIZE_T));
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeNodeView::GetVal(const SIZE_T offset, VALUE_T &v) const
+{
+  char *p=ResolveVal(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  return GetValAt(*info,p,v);
+}
+
+
+ERROR_T BTreeNodeView::SetKey(const SIZE_T offset, const KEY_T &k)
+{
+  char *p=ResolveKey(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  if (info->format==BTREE_FORMAT_SLOTTED) { 
+    // The value follows the key in a stored leaf's record
+    if (k.length>info->keysize || 
+	(info->nodetype==BTREE_LEAF_NODE && k.length!=GetLengthAt(p))) { 
+      return ERROR_NOSPACE;
+    }
+    SetLengthAt(p,k.length);
+    memcpy(p,k.data,k.length);
+    dirty=true;
+    return ERROR_NOERROR;
+  }
+  if (k.length<info->prefixlen || memcmp(data+sizeof(SIZE_T),k.data,info->prefixlen)) { 
+    return ERROR_INSANE;
+  }
+
+  memcpy(p,k.data+info->prefixlen,info->keysize-info->prefixlen);
+  dirty=true;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeNodeView::SetPtr(const SIZE_T offset, const SIZE_T &ptr)
+{
+  char *p=ResolvePtr(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+
+  memcpy(p,&ptr,sizeof(SIZE_T));
+  dirty=true;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeNodeView::SetVal(const SIZE_T offset, const VALUE_T &v)
+{
+  char *p=ResolveVal(offset);
+  
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  if (info->format==BTREE_FORMAT_SLOTTED) { 
+    if (info->IsOverflow(v.length)) { 
+      return ERROR_INSANE;
+    }
+    // Only what fits in the record's space, which ends with the value
+    if (v.length>info->GetValueCellBytes(GetLengthAt(p))) { 
+      return ERROR_NOSPACE;
+    }
+    SetLengthAt(p,v.length);
+    memcpy(p,v.data,v.length);
+  } else {
+    if (info->IsOverflow(info->valuesize)) { 
+      return ERROR_INSANE;
+    }
+    memcpy(p,v.data,info->valuesize);
+  }
+  dirty=true;
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T BTreeNodeView::GetValLength(const SIZE_T offset) const
+{
+  return ValLengthAt(*info,ResolveVal(offset));
+}
+
+bool BTreeNodeView::IsValRef(const SIZE_T offset) const
+{
+  return info->IsOverflow(GetValLength(offset));
+}
+
+ERROR_T BTreeNodeView::GetValRef(const SIZE_T offset, SIZE_T &block) const
+{
+  return GetValRefAt(*info,ResolveVal(offset),block);
+}
+
+ERROR_T BTreeNodeView::SetValRef(const SIZE_T offset, const SIZE_T length, const SIZE_T block)
+{
+  char *p=ResolveVal(offset);
+  ERROR_T rc;
+
+  if (info->format==BTREE_FORMAT_SLOTTED && 
+      sizeof(SIZE_T)>info->GetValueCellBytes(GetLengthAt(p))) { 
+    return ERROR_NOSPACE;
+  }
+  rc=SetValRefAt(*info,p,length,block);
+  if (rc==ERROR_NOERROR) { 
+    dirty=true;
+  }
+  return rc;
+}
+
+
+int BTreeNodeView::CompareKey(const SIZE_T offset, const KEY_T &k) const
+{
+  return CompareKeyAt(*info,data,ResolveKey(offset),k);
+}
+
+ERROR_T BTreeNodeView::LowerBound(const KEY_T &k, SIZE_T &offset) const
+{
+  return BinarySearch(*info,data,true,k,false,offset);
+}
+
+ERROR_T BTreeNodeView::UpperBound(const KEY_T &k, SIZE_T &offset) const
+{
+  return BinarySearch(*info,data,true,k,true,offset);
+}
@@ -13,7 +13,32 @@ using namespace std;
 #define BTREE_ROOT_NODE 2
 #define BTREE_INTERIOR_NODE 3
 #define BTREE_LEAF_NODE 4
+#define BTREE_OVERFLOW_BLOCK 5
+#define BTREE_POSTING_BLOCK 6
 
+// Node formats, chosen when the tree is created and kept in the superblock
+//   plain    every key in full
+//   prefix   the bytes all of a leaf's keys begin with are stored once,
+//            and each slot holds only the rest of its key
+//   slotted  keys of 1 to keysize bytes and values of up to valuesize,
+//            each kept with its length.  Leaves are slotted pages, so 
+//            how many pairs they hold follows the bytes actually used.
+#define BTREE_FORMAT_PLAIN 0
+#define BTREE_FORMAT_PREFIX 1
+#define BTREE_FORMAT_SLOTTED 2
+
+const char *GetBTreeFormatName(const SIZE_T format);
+// "plain", "prefix" or "slotted", else ERROR_BADCONFIG
+ERROR_T     ParseBTreeFormat(const char *name, SIZE_T &format);
+
+// Offsets and lengths in slotted nodes
+typedef unsigned short SLOT_T;
+
+// How many of the largest values a key's posting list keeps in its leaf
+// before it spills to posting blocks, and the bit of its count that 
+// says it has
+#define BTREE_POSTING_INLINE 4
+#define BTREE_POSTING_SPILLED 0x80000000
 
 typedef Block Buffer;
 typedef Buffer KeyOrValue;
@@ -31,12 +56,50 @@ struct NodeMetadata {
   SIZE_T blocksize;
   SIZE_T rootnode; //meaningful only for superblock
   SIZE_T freelist; //meaningful only for superblock or a free block
-  SIZE_T numkeys;
-  SIZE_T parent;
+  SIZE_T numkeys;   //in the node (the superblock keeps no count)
+  SIZE_T format;    //BTREE_FORMAT_* (the tree's, for the superblock)
+  SIZE_T prefixlen; //leaf on disk: bytes of key stored once, up front
+  SIZE_T overflow;  //longest value kept in a leaf, 0 for any (the tree's)
+  SIZE_T postingsize; //superblock: longest value in a posting list, 0 if unique
 
   SIZE_T GetNumDataBytes() const;
   SIZE_T GetNumSlotsAsInterior() const;
   SIZE_T GetNumSlotsAsLeaf() const;
+  // Slots in a leaf whose keys share their first prefixlen bytes
+  // A slotted leaf holds at least this many, of the largest size
+  SIZE_T GetNumSlotsAsLeaf(const SIZE_T prefixlen) const;
+  // Bytes a key or value takes in a fixed width slot, which in the 
+  // slotted format includes its length
+  SIZE_T GetKeySlotBytes() const;
+  SIZE_T GetValueSlotBytes() const;
+  // Whether a key or value this long can go in the tree
+  bool   IsKeySize(const SIZE_T len) const;
+  bool   IsValueSize(const SIZE_T len) const;
+  // Whether a value this long is kept in overflow blocks, and the bytes
+  // it then takes in a leaf: all of it, or the first block's number
+  bool   IsOverflow(const SIZE_T len) const;
+  SIZE_T GetValueCellBytes(const SIZE_T len) const;
+  // The most that takes for any value the tree can hold
+  SIZE_T GetMaxValueCellBytes() const;
+  // Bytes of value an overflow block holds
+  SIZE_T GetOverflowBytesPerBlock() const;
+  // An index that isn't unique keeps each key's values in a posting 
+  // list, and its values, as the nodes see them, are those lists
+  bool   IsUnique() const { return postingsize==0; }
+  bool   IsPostingSize(const SIZE_T len) const;
+  // Bytes a value this long takes in a posting list, and the most a 
+  // leaf keeps for a list before it spills
+  SIZE_T GetPostingBytes(const SIZE_T len) const;
+  SIZE_T GetPostingCellBytes() const;
+  // Bytes a pair with a key and value this long takes in a stored 
+  // slotted leaf, its offset included, and the most any pair takes
+  SIZE_T GetSlottedPairBytes(const SIZE_T keylen, const SIZE_T vallen) const;
+  SIZE_T GetSlottedPairBytes() const;
+  // How many bytes a leaf holding keys from lo to hi would store once
+  // (0 unless the format is prefix)
+  SIZE_T GetLeafPrefix(const char *lo, const char *hi) const;
+  // Bytes of data a decoded node needs (see BTreeNode)
+  SIZE_T GetNumBufferBytes() const;
 
   ostream &Print(ostream &rhs) const;
 			  
@@ -54,9 +117,45 @@ inline ostream & operator<< (ostream &os, const NodeMetadata &node) { return nod
 //
 // Leaf:
 //
-// PTR* KEY VALUE KEY VALUE KEY VALUE
+// PTR* PREFIX KEY VALUE KEY VALUE KEY VALUE
+//
+// *Here this pointer is the leaf's right sibling (0 if it is the last leaf)
+//
+// PREFIX is the first prefixlen bytes of every key in the leaf, and 
+// each KEY is the remaining keysize-prefixlen.  A plain leaf has 
+// prefixlen 0.
+//
+// In the slotted format each KEY and VALUE is a SLOT_T length followed
+// by keysize (valuesize) bytes, the first length of which are used.
+// That is how interior nodes are stored, but a leaf is stored as
+//
+// PTR* OFFSET OFFSET OFFSET ... free space ... RECORD RECORD RECORD
+//
+// where each RECORD is a key's length and bytes then its value's, 
+// with nothing else, packed against the end of the block, and OFFSET
+// is where in the data its RECORD starts, in key order.
+//
+// A VALUE longer than overflow is kept in a chain of overflow blocks, and
+// the leaf holds only the first one's block number (its length is still 
+// the whole value's).  Each overflow block is 
+//
+// PTR BYTES
 //
-// *Here this pointer is not used
+// where PTR is the next block in the chain (0 for the last) and numkeys
+// is how many BYTES of the value it holds.
+//
+// In an index that isn't unique, each VALUE is a key's posting list,
+//
+// COUNT POSTING POSTING ...    or, once it has spilled,    COUNT FIRST LAST
+//
+// where each POSTING is one of the key's values (after its SLOT_T length
+// in the slotted format), in the order keys sort in.  A list that has 
+// spilled has BTREE_POSTING_SPILLED set in its COUNT, and its POSTINGs 
+// are in a chain of posting blocks from FIRST to LAST, each of which is
+//
+// PTR POSTING POSTING ...
+//
+// with numkeys the bytes of POSTINGs in it.
 
 
 struct BTreeNode {
@@ -66,6 +165,13 @@ struct BTreeNode {
   // unallocated or superblock => blank
   // interior => array of keys
   // leaf => array of key/value pairs
+  // overflow => the next block and part of a value
+  // posting => the next block and some of a key's values
+  //
+  // A leaf is always held decoded, with full keys and prefixlen 0,
+  // whatever its format.  Serialize packs it in that format and
+  // Unserialize unpacks it, so a prefix leaf's data has room for as
+  // many pairs as the longest prefix allows.
 
 
   BTreeNode();
@@ -75,7 +181,8 @@ struct BTreeNode {
   //         because we will serialize it directly to disk
   //
   ~BTreeNode();
-  BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size);
+  BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size,
+	    SIZE_T format=BTREE_FORMAT_PLAIN, SIZE_T overflow=0);
   BTreeNode(const BTreeNode &rhs);
   BTreeNode & operator=(const BTreeNode &rhs);
   
@@ -83,7 +190,7 @@ struct BTreeNode {
   ERROR_T Unserialize(BufferCache *b, const SIZE_T block);
 
   char *ResolveKey(const SIZE_T offset) const; // Gives a pointer to the ith key  (interior or leaf)
-  char *ResolvePtr(const SIZE_T offset) const; // Gives a pointer to the ith pointer (interior)
+  char *ResolvePtr(const SIZE_T offset) const; // Gives a pointer to the ith pointer (interior) or the sibling (leaf, offset 0)
   char *ResolveVal(const SIZE_T offset) const; // Gives a pointer to the ith value (leaf)
   char *ResolveKeyVal(const SIZE_T offset) const ; // Gives a pointer to the ith keyvalue pair (leaf)
 
@@ -97,6 +204,57 @@ struct BTreeNode {
   ERROR_T SetVal(const SIZE_T offset, const VALUE_T &v); // Writes the ith value (leaf)
   ERROR_T SetKeyVal(const SIZE_T offset, const KeyValuePair &p); // Writes the ith key value pair (leaf)
 
+  // Compares the ith key in place against k, without copying it out
+  // <0, 0, >0 as the ith key is less than, equal to, or greater than k
+  int CompareKey(const SIZE_T offset, const KEY_T &k) const;
+
+  // The length of the ith key or value, which is keysize or valuesize
+  // unless the format is slotted
+  SIZE_T GetKeyLength(const SIZE_T offset) const;
+  SIZE_T GetValLength(const SIZE_T offset) const;
+
+  // Leaf: whether the ith value is in overflow blocks, and the first of
+  // them.  GetVal and SetVal give ERROR_INSANE for a value that is or 
+  // would be, which SetValRef stores instead, as length bytes at block.
+  bool    IsValRef(const SIZE_T offset) const;
+  ERROR_T GetValRef(const SIZE_T offset, SIZE_T &block) const;
+  ERROR_T SetValRef(const SIZE_T offset, const SIZE_T length, const SIZE_T block);
+
+  // Binary search over the packed keys (interior or leaf)
+  // LowerBound gives the offset of the first key >= k, UpperBound 
+  // the offset of the first key > k.  Both give numkeys if there is none.
+  ERROR_T LowerBound(const KEY_T &k, SIZE_T &offset) const;
+  ERROR_T UpperBound(const KEY_T &k, SIZE_T &offset) const;
+
+  // Opens a hole at offset, shifting the later entries right, and fills it
+  // Leaf: the key value pair lands at offset, or with a ref, the key and 
+  //       a value of v's length in overflow blocks from there
+  // Interior: the key lands at offset and the pointer right after it (offset+1)
+  ERROR_T InsertKeyVal(const SIZE_T offset, const KEY_T &k, const VALUE_T &v, 
+		       const SIZE_T ref=0);
+  ERROR_T InsertKeyPtr(const SIZE_T offset, const KEY_T &k, const SIZE_T &p);
+
+  // Closes the hole again, shifting the later entries left, for count
+  // entries from offset
+  // Leaf: the pairs go (a value in overflow blocks keeps them)
+  // Interior: the keys and the pointers right after each of them go
+  ERROR_T RemoveKeyVal(const SIZE_T offset, const SIZE_T count=1);
+  ERROR_T RemoveKeyPtr(const SIZE_T offset, const SIZE_T count=1);
+
+  // Leaf: the bytes of key stored once for the num pairs from first on,
+  // and how many pairs would fit in a leaf with just those.  For a
+  // slotted leaf, that is them and as many of the largest size as fit
+  // in the space they leave.
+  SIZE_T GetLeafPrefix(const SIZE_T first, const SIZE_T num) const;
+  SIZE_T GetNumSlotsAsLeaf(const SIZE_T first, const SIZE_T num) const;
+  // The same for all of them
+  SIZE_T GetLeafPrefix() const { return GetLeafPrefix(0,info.numkeys); }
+  SIZE_T GetNumSlotsAsLeaf() const { return GetNumSlotsAsLeaf(0,info.numkeys); }
+
+  // Number of key comparisons done by LowerBound/UpperBound (for benchmarking)
+  static SIZE_T GetNumKeyCompares();
+  static void   ResetNumKeyCompares();
+
   ostream &Print(ostream &rhs) const;
 };
 
@@ -104,6 +262,62 @@ struct BTreeNode {
 inline ostream & operator<<(ostream &os, const BTreeNode &node) { return node.Print(os); }
 
 
+//
+// A node looked at in place, inside a frame pinned in the buffer cache
+//
+// info and data point straight into the cached block, so reading a node 
+// this way copies nothing.  The Set* calls write into the frame and mark 
+// the view dirty, and Unpin hands that back to the cache.  The frame is 
+// only valid between Pin and Unpin (the destructor unpins for you).
+// A leaf is seen as stored, so in a prefix leaf ResolveKey points at the
+// rest of the key after the prefix, and SetKey only takes a key that
+// begins with the prefix.  In a slotted leaf, SetKey and SetVal give
+// ERROR_NOSPACE for anything longer than what they replace.
+// An overflow or posting block's data is its next pointer and then its bytes.
+//
+struct BTreeNodeView {
+  NodeMetadata *info;
+  char         *data;
+  bool          dirty;
+
+  BTreeNodeView();
+  ~BTreeNodeView();
+
+  // Pinning a view that is already pinned unpins the old block first
+  ERROR_T Pin(BufferCache *b, const SIZE_T block);
+  ERROR_T Unpin();
+
+  char *ResolveKey(const SIZE_T offset) const;
+  char *ResolvePtr(const SIZE_T offset) const;
+  char *ResolveVal(const SIZE_T offset) const;
+
+  ERROR_T GetKey(const SIZE_T offset, KEY_T &k) const;
+  ERROR_T GetPtr(const SIZE_T offset, SIZE_T &p) const;
+  ERROR_T GetVal(const SIZE_T offset, VALUE_T &v) const;
+
+  ERROR_T SetKey(const SIZE_T offset, const KEY_T &k);
+  ERROR_T SetPtr(const SIZE_T offset, const SIZE_T &p);
+  ERROR_T SetVal(const SIZE_T offset, const VALUE_T &v);
+
+  // As for BTreeNode
+  SIZE_T  GetValLength(const SIZE_T offset) const;
+  bool    IsValRef(const SIZE_T offset) const;
+  ERROR_T GetValRef(const SIZE_T offset, SIZE_T &block) const;
+  ERROR_T SetValRef(const SIZE_T offset, const SIZE_T length, const SIZE_T block);
+  int CompareKey(const SIZE_T offset, const KEY_T &k) const;
+  ERROR_T LowerBound(const KEY_T &k, SIZE_T &offset) const;
+  ERROR_T UpperBound(const KEY_T &k, SIZE_T &offset) const;
+
+ private:
+  BufferCache  *cache;
+  SIZE_T        block;
+
+  // A view is tied to its pin, so it can't be copied
+  BTreeNodeView(const BTreeNodeView &rhs) = delete;
+  BTreeNodeView & operator=(const BTreeNodeView &rhs) = delete;
+};
+
+
 
 
 
@@ -1,10 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "btree.h"
 
 void usage() 
 {
-  cerr << "usage: btree_init filestem cachesize keysize valuesize\n";
+  cerr << "usage: btree_init filestem cachesize[:policy[:high,low]] keysize valuesize [format [overflow [unique|dups]]]\n";
+  cerr << "  format is the node format, plain, prefix, or slotted (default plain)\n";
+  cerr << "  slotted takes keys and values of any length up to keysize and valuesize\n";
+  cerr << "  values longer than overflow go in overflow blocks (default 0, never)\n";
+  cerr << "  dups keeps each key once, with a list of its values (default unique)\n";
 }
 
 
@@ -12,21 +17,44 @@ int main(int argc, char **argv)
 {
   char *filestem;
   SIZE_T cachesize, keysize, valuesize;
+  SIZE_T format=BTREE_FORMAT_PLAIN;
+  SIZE_T overflow=0;
+  bool unique=true;
+  string policy;
+  double highwater, lowwater;
   SIZE_T superblocknum;
 
-  if (argc!=5) { 
+  if (argc<5 || argc>8) { 
     usage();
     return -1;
   }
 
   filestem=argv[1];
-  cachesize=atoi(argv[2]);
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
   keysize=atoi(argv[3]);
   valuesize=atoi(argv[4]);
+  if (argc>=6 && ParseBTreeFormat(argv[5],format)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  if (argc>=7) { 
+    overflow=atoi(argv[6]);
+  }
+  if (argc==8) { 
+    if (!strcmp(argv[7],"dups")) { 
+      unique=false;
+    } else if (strcmp(argv[7],"unique")) { 
+      usage();
+      return -1;
+    }
+  }
 
   DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
-  BTreeIndex btree(keysize,valuesize,&cache);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
+  BTreeIndex btree(keysize,valuesize,&cache,unique,format,overflow);
   
   ERROR_T rc;
 
@@ -56,6 +84,10 @@ int main(int argc, char **argv)
     cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
     cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
     cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
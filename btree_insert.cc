@@ -3,7 +3,7 @@
 
 void usage() 
 {
-  cerr << "usage: btree_insert filestem cachesize key value\n";
+  cerr << "usage: btree_insert filestem cachesize[:policy[:high,low]] key value\n";
 }
 
 
@@ -11,6 +11,8 @@ int main(int argc, char **argv)
 {
   char *filestem;
   SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
   SIZE_T superblocknum;
   char *key, *value;
 
@@ -20,12 +22,15 @@ int main(int argc, char **argv)
   }
 
   filestem=argv[1];
-  cachesize=atoi(argv[2]);
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
   key=argv[3];
   value=argv[4];
 
   DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -61,6 +66,10 @@ int main(int argc, char **argv)
     cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
     cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
     cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
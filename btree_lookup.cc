@@ -3,7 +3,7 @@
 
 void usage() 
 {
-  cerr << "usage: btree_lookup filestem cachesize key\n";
+  cerr << "usage: btree_lookup filestem cachesize[:policy[:high,low]] key\n";
 }
 
 
@@ -11,6 +11,8 @@ int main(int argc, char **argv)
 {
   char *filestem;
   SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
   SIZE_T superblocknum;
   char *key;
 
@@ -20,11 +22,14 @@ int main(int argc, char **argv)
   }
 
   filestem=argv[1];
-  cachesize=atoi(argv[2]);
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
   key=argv[3];
 
   DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -41,7 +46,18 @@ int main(int argc, char **argv)
   } else {
     cerr << "Index attached!"<<endl;
     VALUE_T val;
-    if ((rc=btree.Lookup(KEY_T(key),val))!=ERROR_NOERROR) { 
+    vector<VALUE_T> vals;
+    if (!btree.IsUnique()) { 
+      // every value the key has, one per line
+      if ((rc=btree.LookupAll(KEY_T(key),vals))!=ERROR_NOERROR) { 
+	cerr <<"Lookup failed: error "<<rc<<endl;
+      } else {
+	cerr <<"Lookup succeeded, "<<vals.size()<<" values\n";
+	for (SIZE_T i=0;i<vals.size();i++) { 
+	  cout << vals[i] << endl;
+	}
+      }
+    } else if ((rc=btree.Lookup(KEY_T(key),val))!=ERROR_NOERROR) { 
       cerr <<"Lookup failed: error "<<rc<<endl;
     } else {
       cerr <<"Lookup succeeded\n";
@@ -63,6 +79,10 @@ int main(int argc, char **argv)
     cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
     cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
     cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include "btree.h"
+
+void usage() 
+{
+  cerr << "usage: btree_scan filestem cachesize[:policy[:high,low]] lokey hikey [keys]\n";
+  cerr << "  with keys, only the keys are read and printed\n";
+}
+
+
+int main(int argc, char **argv)
+{
+  char *filestem;
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  SIZE_T superblocknum;
+  char *lokey, *hikey;
+  bool keysonly;
+
+  if (argc!=5 && !(argc==6 && !strcmp(argv[5],"keys"))) { 
+    usage();
+    return -1;
+  }
+
+  filestem=argv[1];
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  lokey=argv[3];
+  hikey=argv[4];
+  keysonly=(argc==6);
+
+  DiskSystem disk(filestem);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
+  BTreeIndex btree(0,0,&cache);
+  
+  ERROR_T rc;
+
+
+  if ((rc=cache.Attach())!=ERROR_NOERROR) { 
+    cerr << "Can't attach buffer cache due to error"<<rc<<endl;
+    return -1;
+  }
+
+  if ((rc=btree.Attach(0))!=ERROR_NOERROR) { 
+    cerr << "Can't attach to index  due to error "<<rc<<endl;
+    return -1;
+  } else {
+    cerr << "Index attached!"<<endl;
+    BTreeCursor cursor;
+    KeyValuePair p;
+    SIZE_T numfound=0;
+    if ((rc=btree.Scan(KEY_T(lokey),KEY_T(hikey),cursor,keysonly))!=ERROR_NOERROR) { 
+      cerr <<"Scan failed: error "<<rc<<endl;
+    } else {
+      while ((rc=cursor.Next(p))==ERROR_NOERROR) { 
+	cout << "(";
+	for (SIZE_T i=0;i<p.key.length;i++) { 
+	  cout << p.key.data[i];
+	}
+	if (!keysonly) { 
+	  cout << ",";
+	  for (SIZE_T i=0;i<p.value.length;i++) { 
+	    cout << p.value.data[i];
+	  }
+	}
+	cout << ")\n";
+	numfound++;
+      }
+      if (rc!=ERROR_NONEXISTENT) { 
+	cerr <<"Scan failed: error "<<rc<<endl;
+      } else {
+	cerr <<"Scan succeeded, "<<numfound<<" pairs found\n";
+      }
+    }
+    if ((rc=btree.Detach(superblocknum))!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from index due to error "<<rc<<endl;
+      return -1;
+    }
+    if ((rc=cache.Detach())!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from cache due to error "<<rc<<endl;
+      return -1;
+    }
+    cerr << "Performance statistics:\n";
+    
+    cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+    cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+    cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+    cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+    cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+    cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
+    cerr << endl;
+    
+    cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
+    return 0;
+  }
+}
+  
+
+  
@@ -0,0 +1,177 @@
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "btree.h"
+
+// Count every heap allocation so we can see what a search costs
+static SIZE_T numallocs=0;
+
+void *operator new(size_t n)
+{
+  numallocs++;
+  void *p=malloc(n ? n : 1);
+  if (!p) { 
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t n)
+{
+  return operator new(n);
+}
+
+void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) throw()
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t) throw()
+{
+  free(p);
+}
+
+void usage()
+{
+  cerr << "usage: btree_searchbench blocksize keysize valuesize numlookups\n";
+}
+
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec*1e6+tv.tv_usec;
+}
+
+// Fixed width base 36 so that memcmp order is numeric order
+static void MakeKey(SIZE_T n, KEY_T &key)
+{
+  const char *digits="0123456789abcdefghijklmnopqrstuvwxyz";
+  for (SIZE_T i=key.length;i>0;i--) {
+    key.data[i-1]=digits[n%36];
+    n/=36;
+  }
+}
+
+// The scan that the descent used to do
+static SIZE_T LinearScan(const BTreeNode &b, const KEY_T &key, SIZE_T &numcompares)
+{
+  KEY_T testkey;
+  SIZE_T offset;
+
+  for (offset=0;offset<b.info.numkeys;offset++) {
+    b.GetKey(offset,testkey);
+    numcompares++;
+    if (key<testkey || key==testkey) {
+      break;
+    }
+  }
+  return offset;
+}
+
+
+static void Bench(const char *name, BTreeNode &b, SIZE_T numlookups)
+{
+  KEY_T key(b.info.keysize);
+  SIZE_T linearcompares=0;
+  SIZE_T offset, check;
+  SIZE_T linearallocs, binaryallocs;
+  double start, lineartime, binarytime;
+
+  srand(b.info.numkeys);
+  numallocs=0;
+  start=now();
+  for (SIZE_T i=0;i<numlookups;i++) {
+    MakeKey(rand()%b.info.numkeys,key);
+    LinearScan(b,key,linearcompares);
+  }
+  lineartime=now()-start;
+  linearallocs=numallocs;
+
+  srand(b.info.numkeys);
+  BTreeNode::ResetNumKeyCompares();
+  numallocs=0;
+  start=now();
+  for (SIZE_T i=0;i<numlookups;i++) {
+    MakeKey(rand()%b.info.numkeys,key);
+    b.LowerBound(key,offset);
+  }
+  binarytime=now()-start;
+  binaryallocs=numallocs;
+
+  // both must land on the same slot
+  for (SIZE_T i=0;i<b.info.numkeys;i+=1+b.info.numkeys/16) {
+    SIZE_T dummy=0;
+    MakeKey(i,key);
+    b.LowerBound(key,offset);
+    check=LinearScan(b,key,dummy);
+    if (offset!=check) {
+      cerr << name << ": search mismatch at key "<<i<<" ("<<offset<<" vs "<<check<<")\n";
+    }
+  }
+
+  cout << name << " numkeys          = "<<b.info.numkeys<<endl;
+  cout << name << " linear compares  = "<<(double)linearcompares/numlookups<<" per lookup"<<endl;
+  cout << name << " binary compares  = "<<(double)BTreeNode::GetNumKeyCompares()/numlookups<<" per lookup"<<endl;
+  cout << name << " linear allocs    = "<<(double)linearallocs/numlookups<<" per lookup"<<endl;
+  cout << name << " binary allocs    = "<<(double)binaryallocs/numlookups<<" per lookup"<<endl;
+  cout << name << " linear time      = "<<lineartime/numlookups<<" us per lookup"<<endl;
+  cout << name << " binary time      = "<<binarytime/numlookups<<" us per lookup"<<endl;
+}
+
+
+int main(int argc, char **argv)
+{
+  SIZE_T blocksize, keysize, valuesize, numlookups;
+
+  if (argc!=5) {
+    usage();
+    return -1;
+  }
+
+  blocksize=atoi(argv[1]);
+  keysize=atoi(argv[2]);
+  valuesize=atoi(argv[3]);
+  numlookups=atoi(argv[4]);
+
+  BTreeNode leaf(BTREE_LEAF_NODE,keysize,valuesize,blocksize);
+  BTreeNode interior(BTREE_INTERIOR_NODE,keysize,valuesize,blocksize);
+  KEY_T key(keysize);
+
+  if (leaf.info.GetNumSlotsAsLeaf()<1 || interior.info.GetNumSlotsAsInterior()<1) {
+    cerr << "Block is too small for even one key\n";
+    return -1;
+  }
+
+  leaf.info.numkeys=leaf.info.GetNumSlotsAsLeaf();
+  for (SIZE_T i=0;i<leaf.info.numkeys;i++) {
+    MakeKey(i,key);
+    leaf.SetKey(i,key);
+  }
+
+  interior.info.numkeys=interior.info.GetNumSlotsAsInterior();
+  for (SIZE_T i=0;i<interior.info.numkeys;i++) {
+    MakeKey(i,key);
+    interior.SetKey(i,key);
+    interior.SetPtr(i,i);
+  }
+  interior.SetPtr(interior.info.numkeys,interior.info.numkeys);
+
+  Bench("leaf",leaf,numlookups);
+  Bench("interior",interior,numlookups);
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include "btree.h"
+
+void usage() 
+{
+  cerr << "usage: btree_stats filestem cachesize[:policy[:high,low]]\n";
+}
+
+
+int main(int argc, char **argv)
+{
+  char *filestem;
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  SIZE_T superblocknum;
+
+  if (argc!=3) { 
+    usage();
+    return -1;
+  }
+
+  filestem=argv[1];
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+
+  DiskSystem disk(filestem);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
+  BTreeIndex btree(0,0,&cache);
+  BTreeStats stats;
+  
+  ERROR_T rc;
+
+
+  if ((rc=cache.Attach())!=ERROR_NOERROR) { 
+    cerr << "Can't attach buffer cache due to error"<<rc<<endl;
+    return -1;
+  }
+
+  if ((rc=btree.Attach(0))!=ERROR_NOERROR) { 
+    cerr << "Can't attach to index  due to error "<<rc<<endl;
+    return -1;
+  } else {
+    cerr << "Index attached!"<<endl;
+    if ((rc=btree.GetStats(stats))!=ERROR_NOERROR) { 
+      cerr <<"Can't walk the index due to error "<<rc<<endl;
+    } else {
+      cout << "format          = "<<GetBTreeFormatName(btree.GetFormat())<<endl;
+      cout << "depth           = "<<stats.depth<<endl;
+      cout << "leaves          = "<<stats.numleaves<<endl;
+      cout << "interiornodes   = "<<stats.numinterior<<endl;
+      cout << "keys            = "<<stats.numkeys<<endl;
+      cout << "leafutil        = "<<stats.GetLeafUtilization()<<endl;
+      cout << "interiorutil    = "<<stats.GetInteriorUtilization()<<endl;
+      cout << "avgprefix       = "<<stats.GetAveragePrefix()<<endl;
+      cout << "spaceutil       = "<<stats.GetSpaceUtilization()<<endl;
+      cout << "overflow        = "<<btree.GetOverflow()<<endl;
+      cout << "overflowvalues  = "<<stats.overflowvalues<<endl;
+      cout << "overflowblocks  = "<<stats.overflowblocks<<endl;
+      cout << "unique          = "<<btree.IsUnique()<<endl;
+      if (!btree.IsUnique()) { 
+	cout << "numpostings     = "<<stats.numpostings<<endl;
+	cout << "postingblocks   = "<<stats.postingblocks<<endl;
+      }
+    }
+    if ((rc=btree.Detach(superblocknum))!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from index due to error "<<rc<<endl;
+      return -1;
+    }
+    if ((rc=cache.Detach())!=ERROR_NOERROR) { 
+      cerr <<"Can't detach from cache due to error "<<rc<<endl;
+      return -1;
+    }
+    cerr << "Performance statistics:\n";
+    
+    cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+    cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+    cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+    cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+    cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+    cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+    cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+    cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+    cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+    cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
+    cerr << endl;
+    
+    cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
+    return 0;
+  }
+}
+  
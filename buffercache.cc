@@ -1,53 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+
 #include "buffercache.h"
 
-ERROR_T BufferCache::CheckDeleteOldest()
+CacheShard &BufferCache::ShardOf(const SIZE_T blocknum) const
+{
+  return *(shards[(blocknum/BUFFERCACHE_SHARD_SPAN)%numshards]);
+}
+
+CacheFrame *BufferCache::FindFrame(CacheShard &s, const SIZE_T blocknum)
 {
-  // In a real buffer cache, we would use a priority queue to make this O(1)
+  return s.blockmap.Find(blocknum);
+}
+
+void BufferCache::Hit(CacheShard &s, CacheFrame *f)
+{
+  s.hits++;
+  if (f->readahead) { 
+    f->readahead=false;
+    s.readaheadhits++;
+  }
+  if (f->prefetched) { 
+    // it only counts once, and we can't have it before it arrives
+    f->prefetched=false;
+    s.prefetchhits++;
+    lock_guard<mutex> d(disklock);
+    if (f->ready>curtime) { 
+      curtime=f->ready;
+    }
+  }
+  f->block.lastaccessed=curtime;
+  s.policy->Hit(f);
+}
+
+CacheFrame *BufferCache::NewFrame(CacheShard &s, const SIZE_T blocknum)
+{
+  CacheFrame *f;
+
+  if (!s.freeframes.empty()) { 
+    f=s.freeframes.back();
+    s.freeframes.pop_back();
+  } else {
+    // Everything is pinned, so we go over for a while
+    f=new CacheFrame;
+    f->block.Resize(GetBlockSize(),false);
+  }
+  f->Reset(blocknum);
+  s.blockmap.Insert(f);
+  f->block.lastaccessed=curtime;
+  s.policy->Insert(f);
+  return f;
+}
+
+void BufferCache::DeleteFrame(CacheShard &s, CacheFrame *f)
+{
+  if (f->block.dirty) { 
+    s.numdirty--;
+  }
+  s.policy->Remove(f);
+  s.blockmap.Erase(f->blocknum);
+  if (s.InPool(f)) { 
+    s.freeframes.push_back(f);
+  } else {
+    delete f;
+  }
+}
+
+ERROR_T BufferCache::WriteBack(CacheShard &s, CacheFrame *f)
+{
+  s.scratch.clear();
+  s.scratch.push_back(f);
+  return WriteBackRuns(s,s.scratch);
+}
+
+
+static bool BlockNumOrder(const CacheFrame *a, const CacheFrame *b)
+{
+  return a->blocknum<b->blocknum;
+}
+
+
+ERROR_T BufferCache::WriteBackRuns(CacheShard &s, vector<CacheFrame *> &frames)
+{
+  SIZE_T i, j;
+
+  sort(frames.begin(),frames.end(),BlockNumOrder);
+
+  for (i=0;i<frames.size();i=j) { 
+    if (!frames[i]->block.dirty) { 
+      j=i+1;
+      continue;
+    }
+    // Extend the run as far as the blocks stay adjacent and dirty
+    for (j=i+1; 
+	 j<frames.size() && j-i<BUFFERCACHE_WB_MAXRUN &&
+	   frames[j]->block.dirty &&
+	   frames[j]->blocknum==frames[j-1]->blocknum+1;
+	 j++) { 
+    }
+    // One request for the run, with the data going straight from the
+    // frames, so nothing is copied
+    double reqtime;
+    int rc=ERROR_NOERROR;
+    {
+      lock_guard<mutex> d(disklock);
+      reqtime=disk->Charge(frames[i]->blocknum,j-i);
+      for (SIZE_T k=i;k<j && rc==ERROR_NOERROR;k++) { 
+	rc=disk->Store(frames[k]->blocknum,frames[k]->block);
+      }
+      AddDiskTime(reqtime);
+      writebacktime=writebacktime+reqtime;
+    }
+    diskwrites+=j-i;
+    diskwritereqs++;
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    for (SIZE_T k=i;k<j;k++) { 
+      frames[k]->block.dirty=false;
+      s.numdirty--;
+    }
+  }
+  return ERROR_NOERROR;
+}
 
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator oldestptr=blockmap.end();
-  double oldest = curtime+1;
 
-  // Only delete if the cache is full
-  if (blockmap.size() < cachesize) {
+ERROR_T BufferCache::WriteBackCluster(CacheShard &s, CacheFrame *f)
+{
+  vector<CacheFrame *> &frames=s.scratch;
+  CacheFrame *n;
+
+  if (!f->block.dirty) { 
     return ERROR_NOERROR;
   }
+  frames.clear();
+  frames.push_back(f);
+  // Centered on f, as far as each side stays dirty and in this shard
+  for (SIZE_T b=f->blocknum; 
+       b>0 && frames.size()<BUFFERCACHE_WB_MAXRUN/2 && 
+	 &ShardOf(b-1)==&s && (n=FindFrame(s,b-1)) && n->block.dirty;
+       b--) { 
+    frames.push_back(n);
+  }
+  for (SIZE_T b=f->blocknum+1; 
+       frames.size()<BUFFERCACHE_WB_MAXRUN && 
+	 &ShardOf(b)==&s && (n=FindFrame(s,b)) && n->block.dirty;
+       b++) { 
+    frames.push_back(n);
+  }
+  return WriteBackRuns(s,frames);
+}
 
-  // Find oldest
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-       if ((*i).second.lastaccessed<oldest) { 
-	 oldestptr=i;
-	 oldest=(*i).second.lastaccessed;
-       }
+void BufferCache::AddDiskTime(const double reqtime)
+{
+  // The disk does one thing at a time, so we wait for any prefetches
+  // it was already working on
+  double t=curtime;
+
+  if (diskfree>t) { 
+    t=diskfree;
   }
-  
-  // write and delete it if it exists
- 
-  if (oldestptr!=blockmap.end()) { 
-    if ((*oldestptr).second.dirty) {
-      double reqtime;
-      int rc=disk->Write((*oldestptr).first,
-			 (*oldestptr).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
+  t+=reqtime;
+  curtime=t;
+  diskfree=t;
+}
+
+
+bool BufferCache::DetectStream(const SIZE_T blocknum, const SIZE_T maxwindow,
+			       const SIZE_T maxspan, SIZE_T &stride, SIZE_T &window)
+{
+  ReadAheadStream *s=0;
+  SIZE_T i;
+
+  streamclock++;
+
+  // A miss that is exactly where a run should go next continues it
+  for (i=0;i<BUFFERCACHE_RA_STREAMS;i++) { 
+    if (streams[i].run>0 && streams[i].stride>0 && 
+	blocknum==streams[i].last+streams[i].stride) { 
+      s=&(streams[i]);
+      s->run++;
+      break;
+    }
+  }
+  // Otherwise one a little way after a lone miss gives it its stride
+  if (!s) { 
+    for (i=0;i<BUFFERCACHE_RA_STREAMS;i++) { 
+      if (streams[i].run>0 && streams[i].stride==0 &&
+	  blocknum>streams[i].last && 
+	  blocknum-streams[i].last<=BUFFERCACHE_RA_MAXSTRIDE) { 
+	s=&(streams[i]);
+	s->stride=blocknum-s->last;
+	s->run=2;
+	break;
+      }
+    }
+  }
+  // Otherwise it starts a new stream in place of the stalest one
+  if (!s) { 
+    s=&(streams[0]);
+    for (i=1;i<BUFFERCACHE_RA_STREAMS;i++) { 
+      if (streams[i].used<s->used) { 
+	s=&(streams[i]);
+      }
+    }
+    *s=ReadAheadStream();
+    s->run=1;
+  }
+  s->last=blocknum;
+  s->used=streamclock;
+
+  if (s->run<BUFFERCACHE_RA_TRIGGER) { 
+    return false;
+  }
+
+  stride=s->stride;
+  window=(s->window>0 ? s->window : BUFFERCACHE_RA_MINWINDOW);
+  if (window>BUFFERCACHE_RA_MAXSPAN/stride) { 
+    window=BUFFERCACHE_RA_MAXSPAN/stride;
+  }
+  if (window>maxwindow) { 
+    window=maxwindow;
+  }
+  if ((window-1)*stride>=maxspan) { 
+    window=(maxspan-1)/stride+1;
+  }
+  if (blocknum+(window-1)*stride>=disk->GetNumBlocks()) { 
+    window=(disk->GetNumBlocks()-1-blocknum)/stride+1;
+  }
+  if (window<2) { 
+    return false;
+  }
+
+  // The next miss on it should be just past what we bring in now
+  s->last=blocknum+(window-1)*stride;
+  s->window = 2*window<BUFFERCACHE_RA_MAXWINDOW ? 2*window : BUFFERCACHE_RA_MAXWINDOW;
+  return true;
+}
+
+
+ERROR_T BufferCache::InstallReadAhead(CacheShard &s, CacheFrame *f,
+				      const SIZE_T stride, const SIZE_T window,
+				      SIZE_T &fetched)
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  fetched=1;
+
+  // Keep the block we came for while making room for the rest
+  f->block.pincount++;
+
+  for (SIZE_T i=1;i<window;i++) { 
+    SIZE_T blocknum=f->blocknum+i*stride;
+
+    // What we have may be newer than what is on disk
+    if (FindFrame(s,blocknum)) { 
+      continue;
+    }
+    s.policy->Miss(blocknum);
+    if (s.blockmap.Size() >= s.size) { 
+      CacheFrame *victim=s.policy->Victim();
+      if (!victim) { 
+	// Everything is pinned, and it was only a guess anyway
+	s.policy->Cancel();
+	break;
+      }
+      rc=WriteBackCluster(s,victim);
       if (rc!=ERROR_NOERROR) { 
-	return rc;
+	s.policy->Cancel();
+	break;
       }
+      DeleteFrame(s,victim);
     }
-    blockmap.erase(oldestptr);
+    CacheFrame *r=NewFrame(s,blocknum);
+    rc=disk->Fetch(blocknum,r->block);
+    if (rc!=ERROR_NOERROR) { 
+      DeleteFrame(s,r);
+      break;
+    }
+    r->block.lastaccessed=curtime;
+    r->block.dirty=false;
+    r->readahead=true;
+    readaheads++;
+    fetched=i+1;
+  }
+
+  f->block.pincount--;
+  return rc;
+}
+
+
+ERROR_T BufferCache::CheckDeleteOldest(CacheShard &s, const SIZE_T blocknum)
+{
+  s.misses++;
+  s.policy->Miss(blocknum);
+
+  // Finished prefetches are pinned until we take them in
+  if (s.inflight>0) { 
+    Reap(s);
+  }
+
+  // Only delete if the shard is full
+  if (s.blockmap.Size() < s.size) { 
+    return ERROR_NOERROR;
+  }
+
+  // The policy picks, and never picks a pinned frame
+  // If everything is pinned, we go over the shard's size for a while
+
+  CacheFrame *victim=s.policy->Victim();
+
+  // write and delete it if it exists
+
+  if (victim) { 
+    if (victim->block.dirty) { 
+      dirtyevictions++;
+    }
+    ERROR_T rc=WriteBackCluster(s,victim);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    DeleteFrame(s,victim);
   }
   return ERROR_NOERROR;
 }
 
 BufferCache::BufferCache(DiskSystem *d,
-			 SIZE_T cs) : 
-   disk(d), cachesize(cs), curtime(0),
-   allocs(0), deallocs(0), reads(0), writes(0),
-   diskreads(0), diskwrites(0)
-{}
+			 SIZE_T cs,
+			 const char *p,
+			 const double hw,
+			 const double lw,
+			 const SIZE_T ns) : 
+   disk(d), cachesize(cs), numshards(ns), highwater(hw), lowwater(lw),
+   arena(0), arenasize(0),
+   curtime(0), diskfree(0), writebacktime(0), streamclock(0),
+   allocs(0), deallocs(0), writes(0),
+   diskreads(0), diskwrites(0),
+   prefetches(0), readaheads(0),
+   diskwritereqs(0), flushes(0), flushreqs(0), dirtyevictions(0),
+   iothread(0), iostop(false)
+{
+  if (!(hw==0 && lw==0) && !(lw>0 && lw<hw && hw<=1)) { 
+    throw GenericException();
+  }
+  if (numshards==0) { 
+    numshards=1;
+  }
+  if (numshards>cachesize && cachesize>0) { 
+    numshards=cachesize;
+  }
+  for (SIZE_T i=0;i<numshards;i++) { 
+    CacheShard *s=new CacheShard;
+    shards.push_back(s);
+    s->size=cachesize/numshards + (i<cachesize%numshards ? 1 : 0);
+    s->policy=ReplacementPolicy::Create(p,s->size);
+    if (!s->policy) { 
+      for (SIZE_T j=0;j<=i;j++) { 
+	delete shards[j];
+      }
+      throw GenericException();
+    }
+  }
+}
 
 
 BufferCache::~BufferCache()
@@ -55,12 +375,90 @@ BufferCache::~BufferCache()
   if (disk) { 
     Detach();
   }
+  StopIOThread();
+  for (SIZE_T i=0;i<numshards;i++) { 
+    EmptyShard(*(shards[i]));
+    delete shards[i];
+  }
+  shards.clear();
+  free(arena);
+  arena=0; arenasize=0;
   disk=0; cachesize=0; curtime=0;
 }
 
+ERROR_T BufferCache::MakeFrames()
+{
+  SIZE_T blocksize=GetBlockSize();
+  size_t align=sysconf(_SC_PAGESIZE);
+
+  arenasize=cachesize*blocksize;
+  if (BUFFERCACHE_HUGEPAGES && arenasize>=BUFFERCACHE_HUGEPAGESIZE) { 
+    align=BUFFERCACHE_HUGEPAGESIZE;
+  }
+  arenasize=(arenasize+align-1)/align*align;
+  if (posix_memalign((void **)&arena,align,arenasize)!=0) { 
+    arena=0; arenasize=0;
+    return ERROR_NOMEM;
+  }
+#ifdef MADV_HUGEPAGE
+  if (BUFFERCACHE_HUGEPAGES && align==BUFFERCACHE_HUGEPAGESIZE) { 
+    // Only a hint.  Without THP we just get small pages.
+    madvise(arena,arenasize,MADV_HUGEPAGE);
+  }
+#endif
+
+  BYTE_T *next=arena;
+
+  for (SIZE_T i=0;i<numshards;i++) { 
+    CacheShard &s=*(shards[i]);
+    s.frames.resize(s.size);
+    for (SIZE_T j=0;j<s.size;j++) { 
+      s.frames[j].block.Borrow(next,blocksize);
+      next+=blocksize;
+    }
+    s.freeframes.reserve(s.size);
+    s.scratch.reserve(s.size);
+    s.blockmap.Init(s.size);
+  }
+  return ERROR_NOERROR;
+}
+
+void BufferCache::EmptyShard(CacheShard &s)
+{
+  for (SIZE_T i=0;i<s.blockmap.Capacity();i++) { 
+    CacheFrame *f=s.blockmap.Slot(i);
+    if (f && !s.InPool(f)) { 
+      delete f;
+    }
+  }
+  s.blockmap.Clear();
+  s.policy->Clear();
+  s.numdirty=0;
+  // Handed out from the back, so in arena order
+  s.freeframes.clear();
+  for (SIZE_T j=s.frames.size();j>0;j--) { 
+    s.freeframes.push_back(&(s.frames[j-1]));
+  }
+}
+
 ERROR_T BufferCache::Attach()
 {
-  blockmap.clear();
+  DrainPrefetches();
+  if (!arena) { 
+    ERROR_T rc=MakeFrames();
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+  for (SIZE_T i=0;i<numshards;i++) { 
+    CacheShard &s=*(shards[i]);
+    lock_guard<mutex> l(s.lock);
+    EmptyShard(s);
+  }
+  lock_guard<mutex> d(disklock);
+  for (SIZE_T i=0;i<BUFFERCACHE_RA_STREAMS;i++) { 
+    streams[i]=ReadAheadStream();
+  }
   return ERROR_NOERROR;
 }
 
@@ -68,22 +466,56 @@ ERROR_T BufferCache::Detach()
 {
   // write out all of our data and then throw it away
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-    if ((*i).second.dirty) { 
-      double reqtime;
-      int rc=disk->Write((*i).first,
-			 (*i).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
+  DrainPrefetches();
+
+  for (SIZE_T i=0;i<numshards;i++) { 
+    CacheShard &s=*(shards[i]);
+    lock_guard<mutex> l(s.lock);
+    vector<CacheFrame *> dirty;
+
+    for (SIZE_T b=0;b<s.blockmap.Capacity();b++) { 
+      CacheFrame *f=s.blockmap.Slot(b);
+      if (f && f->block.dirty) { 
+	dirty.push_back(f);
       }
     }
+    ERROR_T rc=WriteBackRuns(s,dirty);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    EmptyShard(s);
+  }
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BufferCache::ParseCacheSpec(const char *spec, SIZE_T &cachesize, string &policyname,
+				    double &highwater, double &lowwater)
+{
+  const char *colon=strchr(spec,':');
+  const char *marks=colon ? strchr(colon+1,':') : 0;
+  ReplacementPolicy *p;
+
+  cachesize=atoi(spec);
+  highwater=lowwater=0;
+  if (!colon) { 
+    policyname="lru";
+  } else if (!marks) { 
+    policyname=string(colon+1);
+  } else {
+    policyname=string(colon+1,marks-colon-1);
+    if (sscanf(marks+1,"%lf,%lf",&highwater,&lowwater)!=2 ||
+	!(lowwater>0 && lowwater<highwater && highwater<=1)) { 
+      return ERROR_BADCONFIG;
+    }
+  }
+
+  p=ReplacementPolicy::Create(policyname.c_str(),cachesize);
+  if (cachesize==0 || !p) { 
+    delete p;
+    return ERROR_BADCONFIG;
   }
-  blockmap.clear();
+  delete p;
   return ERROR_NOERROR;
 }
 
@@ -109,150 +541,558 @@ double BufferCache::GetCurrentTime() const
   return curtime;
 }
 
+SIZE_T BufferCache::SumShards(SIZE_T CacheShard::*counter) const
+{
+  SIZE_T sum=0;
+
+  for (SIZE_T i=0;i<numshards;i++) { 
+    lock_guard<mutex> l(shards[i]->lock);
+    sum+=(*(shards[i])).*counter;
+  }
+  return sum;
+}
+
+double BufferCache::GetReadAheadHitRate() const
+{
+  SIZE_T ra=readaheads;
+  return ra>0 ? (double)GetNumReadAheadHits()/ra : 0;
+}
+
+double BufferCache::GetHitRate() const
+{
+  SIZE_T h=GetNumHits(), m=GetNumMisses();
+  return h+m>0 ? (double)h/(h+m) : 0;
+}
+
 ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
 {
   allocs++;
+  lock_guard<mutex> d(disklock);
   return disk->NotifyAllocateBlocks(outblocknum,1);
 }
 
 ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
 {
   deallocs++;
+  lock_guard<mutex> d(disklock);
   return disk->NotifyDeallocateBlocks(inblocknum,1);
 }
 
 
 bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
 {
+  lock_guard<mutex> d(disklock);
   return disk->IsBlockAllocated(inblocknum);
 }
 
 
-ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+ERROR_T BufferCache::PinFrame(CacheShard &s, const SIZE_T inblocknum, CacheFrame *&f,
+			      const bool reading)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
+  WaitLoaded(s,inblocknum,reading);
 
-  b = blockmap.find(inblocknum);
+  f=FindFrame(s,inblocknum);
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, just update its lastaccessed and return it
-    outblock=(*b).second;
-    (*b).second.lastaccessed=curtime;
-    reads++;
-    return ERROR_NOERROR;
+  if (f) {
+    // It's in  cache, just update its lastaccessed and hand it out
+    Hit(s,f);
   } else {
     // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    // read it from disk
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << inblocknum<<endl;
-      }
-    }
+    CheckDeleteOldest(s,inblocknum);
+    f=NewFrame(s,inblocknum);
+
+    // read it from disk, straight into its frame.  A read-ahead is one
+    // request, and the rest of its window is fetched as it is installed
+    SIZE_T stride, numwindow, fetched;
+    bool ahead;
     double reqtime;
-    int rc = disk->Read(inblocknum,
-			outblock,
+    int rc;
+    {
+      lock_guard<mutex> d(disklock);
+      if (!(disk->IsBlockAllocated(inblocknum))) { 
+	if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) { 
+	  cerr << "BufferCache::PinBlock: Attempt to read unallocated block " << inblocknum<<endl;
+	}
+      }
+      // Never read ahead more than a quarter of the shard, or into
+      // blocks that another shard keeps
+      ahead=DetectStream(inblocknum,s.size/4,
+			 numshards>1 ? 
+			   BUFFERCACHE_SHARD_SPAN-inblocknum%BUFFERCACHE_SHARD_SPAN :
+			   disk->GetNumBlocks(),
+			 stride,numwindow);
+      if (ahead) { 
+	rc = disk->Fetch(inblocknum,f->block);
+      } else {
+	rc = disk->Read(inblocknum,
+			f->block,
 			reqtime);
-    curtime+=reqtime;
+	AddDiskTime(reqtime);
+      }
+    }
     diskreads++;
+    if (rc==ERROR_NOERROR && ahead) { 
+      // The one request runs as far as the last block that came in, 
+      // and goes after the writes that made room for it
+      rc = InstallReadAhead(s,f,stride,numwindow,fetched);
+      lock_guard<mutex> d(disklock);
+      AddDiskTime(disk->Charge(inblocknum,(fetched-1)*stride+1));
+    }
     if (rc!=ERROR_NOERROR) { 
+      DeleteFrame(s,f);
       return rc;
-    } else {
-      outblock.lastaccessed=curtime;
-      outblock.dirty=false;
-      blockmap[inblocknum]=outblock;
-      reads++;
-      return ERROR_NOERROR;
     }
+    f->block.lastaccessed=curtime;
+    f->block.dirty=false;
   }
-} 
- 
+  f->block.pincount++;
+  s.reads++;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::PinBlock(const SIZE_T inblocknum, Block *&frame)
+{
+  CacheShard &s=ShardOf(inblocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheFrame *f;
+
+  ERROR_T rc=PinFrame(s,inblocknum,f);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  frame=&(f->block);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::UnpinBlock(const SIZE_T inblocknum, const bool dirty)
+{
+  CacheShard &s=ShardOf(inblocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheFrame *f=FindFrame(s,inblocknum);
+
+  if (!f) { 
+    return ERROR_NOSUCHBLOCK;
+  }
+  if (f->block.pincount==0) { 
+    return ERROR_INSANE;
+  }
+  f->block.pincount--;
+  if (dirty) { 
+    // The pin already counted as the access
+    f->block.lastaccessed=curtime;
+    writes++;
+    MarkDirty(s,f);
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+{
+  CacheShard &s=ShardOf(inblocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheFrame *f;
+
+  // Copied under the lock, so nobody writes it halfway through.  If it
+  // is being written out, the I/O thread only reads it too.
+  ERROR_T rc=PinFrame(s,inblocknum,f,true);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  outblock=f->block;
+  f->block.pincount--;
+  return ERROR_NOERROR;
+}
+
 ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(inblocknum);
+  // Frames are all exactly a block
+  if (inblock.length!=GetBlockSize()) { 
+    return ERROR_WRONGSIZEBLOCK;
+  }
+
+  CacheShard &s=ShardOf(inblocknum);
+  lock_guard<mutex> l(s.lock);
 
-  if (b!=blockmap.end()) {
+  WaitLoaded(s,inblocknum);
+
+  CacheFrame *f=FindFrame(s,inblocknum);
+
+  if (f) {
     // It's in  cache, so just replace the block
-    (*b).second=inblock;
-    (*b).second.lastaccessed=curtime;
-    (*b).second.dirty=true;
+    // Copy into the frame that is already there so that anyone who
+    // has it pinned keeps looking at the right bytes
+    memcpy(f->block.data,inblock.data,inblock.length);
+    Hit(s,f);
     writes++;
+    MarkDirty(s,f);
     return ERROR_NOERROR;
   } else {
     // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
+    CheckDeleteOldest(s,inblocknum);
+    if (!IsBlockAllocated(inblocknum)) { 
       if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
 	cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
       }
     }
-    Block myblock=inblock;
-    myblock.lastaccessed=curtime;
-    myblock.dirty=true;
-    blockmap[inblocknum]=myblock;
+    f=NewFrame(s,inblocknum);
+    memcpy(f->block.data,inblock.data,inblock.length);
+    f->block.lastaccessed=curtime;
+    f->block.dirty=false;
     writes++;
+    MarkDirty(s,f);
     return ERROR_NOERROR;
   }
 }
-  
+
 ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum)
 {
-  // Not implemented yet
-  return ERROR_IMPLBUG;
+  if (blocknum>=disk->GetNumBlocks()) { 
+    return ERROR_NOSUCHBLOCK;
+  }
+
+  CacheShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.lock);
+
+  if (FindFrame(s,blocknum)) { 
+    // Already here, or on its way
+    return ERROR_NOERROR;
+  }
+
+  if (s.inflight>0) { 
+    Reap(s);
+  }
+
+  s.policy->Miss(blocknum);
+
+  if (s.blockmap.Size() >= s.size) { 
+    // Only take a frame nobody is using
+    CacheFrame *victim=s.policy->Victim();
+    if (!victim) { 
+      return ERROR_NOFETCH;
+    }
+    ERROR_T rc=WriteBackCluster(s,victim);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    DeleteFrame(s,victim);
+  }
+
+  // The frame stays pinned for the I/O thread until we reap it
+  CacheFrame *f=NewFrame(s,blocknum);
+  f->loading=true;
+  f->prefetched=true;
+  f->block.dirty=false;
+  f->block.pincount++;
+
+  // The read is charged now, in line behind whatever the disk is 
+  // already doing, but the caller doesn't wait for it
+  {
+    lock_guard<mutex> d(disklock);
+    if (!(disk->IsBlockAllocated(blocknum))) { 
+      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+	cerr << "BufferCache::PrefetchBlock: Attempt to read unallocated block " << blocknum<<endl;
+      }
+    }
+    double reqtime=disk->Charge(blocknum,1);
+    f->ready=(diskfree>curtime ? diskfree : (double)curtime)+reqtime;
+    diskfree=f->ready;
+  }
+  diskreads++;
+  prefetches++;
+  s.inflight++;
+  Submit(f);
+
+  return ERROR_NOERROR;
+}
+
+
+void BufferCache::Submit(CacheFrame *f)
+{
+  {
+    lock_guard<mutex> l(iolock);
+    if (!iothread) { 
+      iothread=new thread(&BufferCache::IOThread,this);
+    }
+    ioqueue.push_back(f);
+  }
+  iowork.notify_one();
+}
+
+
+void BufferCache::MarkDirty(CacheShard &s, CacheFrame *f)
+{
+  if (f->block.dirty) { 
+    return;
+  }
+  f->block.dirty=true;
+  s.numdirty++;
+  if (highwater>0 && s.flushing==0 && s.numdirty>highwater*s.size) { 
+    StartFlush(s);
+  }
+}
+
+
+static bool LastAccessOrder(const CacheFrame *a, const CacheFrame *b)
+{
+  return a->block.lastaccessed<b->block.lastaccessed;
+}
+
+
+void BufferCache::StartFlush(CacheShard &s)
+{
+  vector<CacheFrame *> &frames=s.scratch;
+  SIZE_T target=(SIZE_T)(lowwater*s.size);
+  SIZE_T i, j;
+
+  if (s.inflight>0) { 
+    Reap(s);
+  }
+
+  // Someone may be writing into a pinned frame, so leave those be
+  frames.clear();
+  for (SIZE_T b=0;b<s.blockmap.Capacity();b++) { 
+    CacheFrame *f=s.blockmap.Slot(b);
+    if (f && f->block.dirty && f->block.pincount==0) { 
+      frames.push_back(f);
+    }
+  }
+  if (s.numdirty<=target || frames.empty()) { 
+    return;
+  }
+
+  // The ones touched longest ago, in disk order
+  if (s.numdirty-target<frames.size()) { 
+    nth_element(frames.begin(),frames.begin()+(s.numdirty-target),frames.end(),LastAccessOrder);
+    frames.resize(s.numdirty-target);
+  }
+  sort(frames.begin(),frames.end(),BlockNumOrder);
+
+  for (i=0;i<frames.size();i=j) { 
+    for (j=i+1; 
+	 j<frames.size() && j-i<BUFFERCACHE_WB_MAXRUN &&
+	   frames[j]->blocknum==frames[j-1]->blocknum+1;
+	 j++) { 
+    }
+    // Charged now, like a prefetch, so the model sees it in issue order
+    {
+      lock_guard<mutex> d(disklock);
+      double reqtime=disk->Charge(frames[i]->blocknum,j-i);
+      diskfree=(diskfree>curtime ? diskfree : (double)curtime)+reqtime;
+      writebacktime=writebacktime+reqtime;
+    }
+    diskwrites+=j-i;
+    diskwritereqs++;
+    flushes+=j-i;
+    flushreqs++;
+
+    // What goes out is what is in the frame now, so it counts as clean
+    // from here on.  The pin keeps it in the cache until the write is 
+    // reaped, and nobody can change it until then.
+    for (SIZE_T k=i;k<j;k++) { 
+      CacheFrame *f=frames[k];
+      f->block.dirty=false;
+      s.numdirty--;
+      f->flushing=true;
+      f->block.pincount++;
+      s.inflight++;
+      s.flushing++;
+      Submit(f);
+    }
+  }
+}
+
+
+void BufferCache::IOThread()
+{
+  unique_lock<mutex> l(iolock);
+
+  while (true) { 
+    while (ioqueue.empty() && !iostop) { 
+      iowork.wait(l);
+    }
+    if (ioqueue.empty()) { 
+      // told to stop, and nothing left to do
+      return;
+    }
+    CacheFrame *f=ioqueue.front();
+    ioqueue.pop_front();
+
+    // Nobody else changes a frame that is loading or flushing, so no
+    // lock is needed
+    l.unlock();
+    ERROR_T rc = f->flushing ? 
+      disk->Store(f->blocknum,f->block) : disk->Fetch(f->blocknum,f->block);
+    l.lock();
+
+    ShardOf(f->blocknum).iodone.push_back(make_pair(f,rc));
+    iofinished.notify_all();
+  }
+}
+
+
+void BufferCache::Reap(CacheShard &s)
+{
+  // The two vectors trade places, so neither is ever reallocated once 
+  // it is big enough
+  vector<pair<CacheFrame *, ERROR_T> > &done=s.reaped;
+
+  done.clear();
+  {
+    lock_guard<mutex> l(iolock);
+    done.swap(s.iodone);
+  }
+
+  for (SIZE_T i=0;i<done.size();i++) { 
+    CacheFrame *f=done[i].first;
+    f->block.pincount--;
+    s.inflight--;
+    if (f->flushing) { 
+      f->flushing=false;
+      s.flushing--;
+      if (done[i].second!=ERROR_NOERROR) { 
+	// Still needs writing, and the foreground will do it
+	f->block.dirty=true;
+	s.numdirty++;
+      }
+      continue;
+    }
+    f->loading=false;
+    if (done[i].second!=ERROR_NOERROR) { 
+      // Forget it, and whoever wants it will read it themselves
+      DeleteFrame(s,f);
+    }
+  }
+}
+
+
+void BufferCache::WaitLoaded(CacheShard &s, const SIZE_T blocknum,
+			     const bool reading)
+{
+  CacheFrame *f;
+
+  if (s.inflight==0) { 
+    return;
+  }
+
+  while ((f=FindFrame(s,blocknum)) && 
+	 (f->loading || (f->flushing && !reading))) { 
+    {
+      unique_lock<mutex> l(iolock);
+      while (s.iodone.empty()) { 
+	iofinished.wait(l);
+      }
+    }
+    Reap(s);
+  }
 }
-  
+
+
+void BufferCache::DrainPrefetches()
+{
+  for (SIZE_T i=0;i<numshards;i++) { 
+    CacheShard &s=*(shards[i]);
+    lock_guard<mutex> g(s.lock);
+    while (s.inflight>0) { 
+      {
+	unique_lock<mutex> l(iolock);
+	while (s.iodone.empty()) { 
+	  iofinished.wait(l);
+	}
+      }
+      Reap(s);
+    }
+  }
+}
+
+
+void BufferCache::StopIOThread()
+{
+  if (!iothread) { 
+    return;
+  }
+  {
+    lock_guard<mutex> l(iolock);
+    iostop=true;
+  }
+  iowork.notify_all();
+  iothread->join();
+  delete iothread;
+  iothread=0;
+  iostop=false;
+}
+
+
 ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(blocknum);
+  CacheShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.lock);
 
-  if (b==blockmap.end()) { 
+  WaitLoaded(s,blocknum);
+
+  CacheFrame *f=FindFrame(s,blocknum);
+
+  if (!f) { 
     return ERROR_NOERROR;
   } else {
-    if ((*b).second.dirty) { 
-      double reqtime;
-      int rc;
-      rc=disk->Write((*b).first,
-		     (*b).second,
-		     reqtime);
-      diskwrites++;
-      curtime+=reqtime;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
-      }
+    ERROR_T rc=WriteBack(s,f);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    // someone is still looking at it, so it is clean now but stays
+    if (f->block.pincount==0) { 
+      DeleteFrame(s,f);
     }
-    blockmap.erase(b);
     return ERROR_NOERROR;
   }
 }
-  
+
 ostream & BufferCache::Print(ostream &os) const
 {
   os << "BufferCache(cachesize="<<cachesize
+     << ", shards="<<numshards
      << ", blocksize="<<GetBlockSize()
      << ", curtime="<<curtime
      << ", allocs="<<allocs
      << ", deallocs="<<deallocs
-     << ", reads="<<reads
+     << ", reads="<<GetNumReads()
      << ", writes="<<writes
      << ", diskreads="<<diskreads
      << ", diskwrites="<<diskwrites
+     << ", diskwritereqs="<<diskwritereqs
+     << ", flushes="<<flushes
+     << ", dirtyevictions="<<dirtyevictions
+     << ", policy="<<GetPolicyName()
+     << ", hits="<<GetNumHits()
+     << ", misses="<<GetNumMisses()
+     << ", hitrate="<<GetHitRate()
+     << ", prefetches="<<prefetches
+     << ", prefetchhits="<<GetNumPrefetchHits()
+     << ", readaheads="<<readaheads
+     << ", readaheadhits="<<GetNumReadAheadHits()
      << ", blocks = {";
 
-  
-  for (map<SIZE_T, Block, cache_compare_lessthan>::const_iterator b=blockmap.begin(); 
-       b!=blockmap.end(); 
-       ++b) {
-    if (b!=blockmap.begin()) { 
+
+  vector<const CacheFrame *> frames;
+
+  for (SIZE_T s=0;s<numshards;s++) { 
+    for (SIZE_T i=0;i<shards[s]->blockmap.Capacity();i++) { 
+      if (shards[s]->blockmap.Slot(i)) { 
+	frames.push_back(shards[s]->blockmap.Slot(i));
+      }
+    }
+  }
+  sort(frames.begin(),frames.end(),BlockNumOrder);
+
+  for (SIZE_T i=0; i<frames.size(); i++) { 
+    const CacheFrame &f=*(frames[i]);
+    if (i>0) { 
       os << ", ";
     }
-    os << (*b).first << ((*b).second.dirty ? "(dirty)" : "");
+    os << f.blocknum << (f.block.dirty ? "(dirty)" : "")
+       << (f.loading ? "(loading)" : f.flushing ? "(flushing)" : 
+	   f.block.pincount>0 ? "(pinned)" : "");
   }
   os << "}, disk="<<*disk<<")";
-  
+
   return os;
 }
-  
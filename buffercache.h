@@ -2,39 +2,264 @@
 #define _buffercache
 
 #include <iostream>
-#include <map>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "global.h"
 #include "block.h"
 #include "disksystem.h"
+#include "cachepolicy.h"
 
 using namespace std;
 
-struct cache_compare_lessthan {
-  bool operator()(const SIZE_T s1, const SIZE_T s2) const {
-    return s1<s2;
+// Read-ahead: how many streams we follow at once, how far apart two
+// misses can be and still be a stride, how many misses in a row it 
+// takes to believe it, and how big the window gets (in blocks wanted, 
+// and in blocks spanned on the disk)
+#define BUFFERCACHE_RA_STREAMS    8
+#define BUFFERCACHE_RA_MAXSTRIDE  8
+#define BUFFERCACHE_RA_TRIGGER    3
+#define BUFFERCACHE_RA_MINWINDOW  4
+#define BUFFERCACHE_RA_MAXWINDOW  32
+#define BUFFERCACHE_RA_MAXSPAN    64
+
+// Most blocks a single write-back request will carry
+#define BUFFERCACHE_WB_MAXRUN     64
+
+//
+// One access stream the read-ahead detector is following
+// Only forward strides are followed.
+//
+struct ReadAheadStream {
+  SIZE_T last;     // last block that missed on it
+  SIZE_T stride;   // 0 until a second miss shows what it is
+  SIZE_T run;      // misses in a row that fit, 0 if the slot is free
+  SIZE_T window;   // blocks the next read-ahead will want
+  SIZE_T used;     // when it last fit a miss, to pick one to replace
+
+  ReadAheadStream() : last(0), stride(0), run(0), window(0), used(0) {}
+};
+
+
+// Blocks are dealt out to the shards in aligned groups this big, so 
+// that short runs of adjacent blocks (read ahead, or written back) 
+// stay in one shard.  Bigger groups keep longer runs together, but 
+// spread a small working set over fewer shards.
+#define BUFFERCACHE_SHARD_SPAN    16
+
+// The frames' data all comes from one arena, allocated at Attach.  If
+// this is 1, an arena of at least a huge page is aligned to huge pages
+// and the kernel is asked to back it with transparent huge pages.
+#define BUFFERCACHE_HUGEPAGES     1
+#define BUFFERCACHE_HUGEPAGESIZE  (2*1024*1024)
+
+
+//
+// One partition of the cache
+// Everything in it is under its lock, except iodone, which is under 
+// the cache's iolock since the I/O thread fills it.
+//
+// Its frames are made once, at the first Attach, and their data is its
+// slice of the cache's arena.  Free ones wait on freeframes.  Only if 
+// every frame is pinned does it make (and later free) extra ones.
+//
+struct CacheShard {
+  mutex              lock;
+  FrameTable         blockmap;
+  vector<CacheFrame> frames;
+  vector<CacheFrame *> freeframes;
+  vector<CacheFrame *> scratch;  // reused by write-back and the flusher
+  ReplacementPolicy *policy;
+  SIZE_T             size;       // frames it may hold
+  SIZE_T             numdirty;
+  SIZE_T             inflight;   // I/Os issued for it and not yet reaped
+  SIZE_T             flushing;   // how many of those are writes
+  // Counted here rather than in the cache, since every access bumps one
+  SIZE_T             reads, hits, misses, prefetchhits, readaheadhits;
+  vector<pair<CacheFrame *, ERROR_T> > iodone;  // I/Os done, not yet reaped
+  vector<pair<CacheFrame *, ERROR_T> > reaped;  // swapped with iodone by Reap
+
+  CacheShard() : policy(0), size(0), numdirty(0), inflight(0), flushing(0),
+		 reads(0), hits(0), misses(0), prefetchhits(0), readaheadhits(0) {}
+  ~CacheShard() { delete policy; }
+
+  bool InPool(const CacheFrame *f) const { 
+    return !frames.empty() && f>=&(frames[0]) && f<&(frames[0])+frames.size();
   }
 };
 
 
 //
-// LRU block cache with single step prefetch
+// Block cache with single step prefetch
 //
 // Write Back
 // Write Allocate
+//
+// The cache may be used from many threads at once.  Frames are split 
+// into shards by block number, and each shard has its own lock, hash 
+// table, and replacement policy, so threads working on different 
+// shards don't get in each other's way.  There is one disk, so disk 
+// requests, and the simulated clock, go one at a time under disklock.
+// Locks are always taken in the order shard, disklock, iolock.  The
+// counters that every access touches are kept per shard and summed
+// when asked for, and the rest are atomic.  Attach, Detach and Print
+// must not run at the same time as anything else.
+//
+// Prefetches are read by a background I/O thread straight into a 
+// frame that is set aside for them when they are asked for.  The I/O
+// thread only fills frames and reports back to their shard.
+//
+// Demand misses are watched for sequential or constant stride runs.
+// Once one is seen, the miss that continues it reads the next window 
+// of the run with one multi-block disk read, and the window doubles 
+// each time the run goes on.  A window never leaves the span of blocks
+// that belong to the missing block's shard.
+//
+// Dirty blocks go back to disk sorted by block number, with adjacent
+// ones merged into a single request.  Detach writes everything that 
+// way, and evicting a dirty block takes its dirty neighbours along.
+//
+// If it is given watermarks, the cache also writes dirty blocks in the
+// background.  Once more than highwater of a shard is dirty, its least
+// recently touched dirty blocks are handed to the I/O thread, in 
+// sorted runs, until only lowwater is left dirty.  Evictions then 
+// mostly find clean victims.  A block being written out can still be 
+// read, but pinning or writing it waits for the write to finish.
+//
+// Frame memory is all allocated up front, so once it is warm, hits, 
+// misses and evictions don't allocate at all, at least under the 
+// policies (LRU and CLOCK) that keep no ghost lists.
+//
+// Which frame goes when a shard is full is up to a ReplacementPolicy
+// (LRU unless you ask for another), so hits, misses, evictions and 
+// flushes are all constant time for LRU, CLOCK, 2Q and ARC, and 
+// logarithmic for LRU-K.
 class BufferCache {
  private:
   DiskSystem *disk;
   SIZE_T cachesize;
-  map<SIZE_T, Block, cache_compare_lessthan> blockmap;
-  double curtime;
-  SIZE_T allocs, deallocs, reads, writes, diskreads, diskwrites;
+  SIZE_T numshards;
+  vector<CacheShard *> shards;
+  double highwater, lowwater;   // fractions of cachesize, 0 for no flusher
+  BYTE_T *arena;                // cachesize blocks, the frames' data
+  SIZE_T  arenasize;            // in bytes, rounded up to its alignment
+
+  // The disk, and what goes with it, all under disklock
+  mutex          disklock;
+  atomic<double> curtime;       // written under disklock, read anywhere
+  double         diskfree;      // simulated time the disk finishes what it was given
+  atomic<double> writebacktime; // written under disklock, read anywhere
+  ReadAheadStream streams[BUFFERCACHE_RA_STREAMS];
+  SIZE_T          streamclock;
+
+  atomic<SIZE_T> allocs, deallocs, writes, diskreads, diskwrites;
+  atomic<SIZE_T> prefetches;
+  atomic<SIZE_T> readaheads;
+  atomic<SIZE_T> diskwritereqs;
+  atomic<SIZE_T> flushes, flushreqs;
+  atomic<SIZE_T> dirtyevictions;
+
+  // The I/O thread and what it shares with us, all under iolock
+  thread             *iothread;
+  mutex               iolock;
+  condition_variable  iowork;      // signalled when ioqueue grows or on shutdown
+  condition_variable  iofinished;  // signalled when some shard's iodone grows
+  deque<CacheFrame *> ioqueue;     // frames waiting to be read in or written out
+  bool                iostop;
+
+  void    IOThread();
  protected:
-  ERROR_T CheckDeleteOldest();
+  // Everything below that takes a shard expects its lock to be held,
+  // and to be given only blocks that belong to it
+
+  CacheShard &ShardOf(const SIZE_T blocknum) const;
+
+  // Makes the arena and every shard's frames, the first time
+  ERROR_T MakeFrames();
+  // Drops everything the shard holds and frees all its frames
+  void    EmptyShard(CacheShard &s);
+
+  // Advances simulated time past a synchronous disk access
+  // Call with disklock held.
+  void    AddDiskTime(const double reqtime);
+  // Hands a loading or flushing frame to the I/O thread
+  void    Submit(CacheFrame *f);
+  // Takes in the shard's prefetches and writes the I/O thread has finished
+  void    Reap(CacheShard &s);
+  // Waits for a prefetch or background write of the block, if one is 
+  // under way.  Readers only wait for a prefetch, since the bytes of a
+  // block being written out don't change.
+  void    WaitLoaded(CacheShard &s, const SIZE_T blocknum, 
+		     const bool reading=false);
+  // Waits for every I/O that is under way
+  void    DrainPrefetches();
+  void    StopIOThread();
+
+  // Dirties a frame, and wakes the flusher if that puts the shard over
+  // highwater
+  void    MarkDirty(CacheShard &s, CacheFrame *f);
+  // Hands the shard's coldest dirty frames to the I/O thread until lowwater
+  void    StartFlush(CacheShard &s);
+
+  // Feeds a demand miss to the read-ahead detector.  Gives true if it 
+  // continues a run, along with the stride and how many blocks to read,
+  // never more than maxwindow, and never reaching maxspan blocks past
+  // blocknum.  Call with disklock held.
+  bool    DetectStream(const SIZE_T blocknum, const SIZE_T maxwindow, 
+		       const SIZE_T maxspan, SIZE_T &stride, SIZE_T &window);
+  // Puts the rest of a read-ahead window after f into the cache, marked
+  // as read ahead.  The window's blocks are stride apart.  fetched is 
+  // how much of the window, counting f, came in, which is what the 
+  // caller charges the disk for.
+  ERROR_T InstallReadAhead(CacheShard &s, CacheFrame *f,
+			   const SIZE_T stride, const SIZE_T window,
+			   SIZE_T &fetched);
+
+  // Adds up one of the shards' counters, taking each shard's lock
+  SIZE_T  SumShards(SIZE_T CacheShard::*counter) const;
+
+  // Pins the block, reading it in if it has to.  reads counts it.
+  // A caller that only copies the block out need not wait for a 
+  // background write of it to finish.
+  ERROR_T PinFrame(CacheShard &s, const SIZE_T blocknum, CacheFrame *&f,
+		   const bool reading=false);
+
+  // Tells the policy blocknum missed, and makes room for it if the 
+  // shard is full
+  ERROR_T CheckDeleteOldest(CacheShard &s, const SIZE_T blocknum);
+  // FindFrame gives 0 if the block is not cached
+  // Hit tells the policy about a block that was found
+  // NewFrame makes a frame for a block that missed and hands it to the policy
+  // DeleteFrame takes it away from the policy and drops it
+  CacheFrame *FindFrame(CacheShard &s, const SIZE_T blocknum);
+  void        Hit(CacheShard &s, CacheFrame *f);
+  CacheFrame *NewFrame(CacheShard &s, const SIZE_T blocknum);
+  void        DeleteFrame(CacheShard &s, CacheFrame *f);
+  // Writes the frame to disk if it is dirty
+  ERROR_T WriteBack(CacheShard &s, CacheFrame *f);
+  // Writes the dirty frames in the list, sorted, one request per run 
+  // of adjacent blocks.  The list is reordered.
+  ERROR_T WriteBackRuns(CacheShard &s, vector<CacheFrame *> &frames);
+  // Writes the dirty frame along with any dirty frames right next to it
+  ERROR_T WriteBackCluster(CacheShard &s, CacheFrame *f);
  public:
   // Cache size is in number of blocks
+  // The policy is one of the names ReplacementPolicy::Create knows
+  // The watermarks are fractions of the cache, with 0<lowwater<highwater<=1,
+  // and both 0 (the default) leaves the background writer off
+  // One shard (the default) is just a cache with a lock.  There are 
+  // never more shards than blocks in the cache.
   BufferCache(DiskSystem *disk,
-	      const SIZE_T cachesize);
+	      const SIZE_T cachesize,
+	      const char *policy="lru",
+	      const double highwater=0,
+	      const double lowwater=0,
+	      const SIZE_T numshards=1);
   BufferCache() { throw 0; }
   BufferCache(const BufferCache &rhs) { throw 0; } 
   BufferCache & operator=(const BufferCache &rhs) { throw 0; return *this; } 
@@ -47,6 +272,7 @@ class BufferCache {
 
   // Number of blocks in the cache
   SIZE_T GetCacheSize() const;
+  SIZE_T GetNumShards() const { return numshards; }
   // Number of bytes per block
   SIZE_T GetBlockSize() const;
   // Number of blocks in the underlying device
@@ -71,10 +297,22 @@ class BufferCache {
   // ERROR_WRONGSIZEBLOCK or other nonzero error codes
   ERROR_T WriteBlock(const SIZE_T inblocknum, const Block &inblock);
   
+  // Pin a block in the cache and get at the cached frame itself
+  // Nothing is copied.  The frame stays where it is, and will not be
+  // evicted, until every pin on it has been dropped with UnpinBlock.
+  // If you wrote into the frame, say so with dirty=true.
+  // If every frame is pinned, the cache grows past cachesize until
+  // something is unpinned.
+  ERROR_T PinBlock(const SIZE_T blocknum, Block *&frame);
+  ERROR_T UnpinBlock(const SIZE_T blocknum, const bool dirty=false);
+
   // Request that a block be read into the cache
   // This returns immediately.
   // ERROR_NOFETCH means that there is no room currently
   // to prefetch the block and it was not prefetched.
+  // It evicts a block to make room if it has to, but only if that 
+  // block is not pinned.  Reading the block before it arrives waits 
+  // for it.
   ERROR_T PrefetchBlock (const SIZE_T blocknum);
   
   // Request that a block be flushed to disk
@@ -84,10 +322,37 @@ class BufferCache {
  
   SIZE_T GetNumAllocs() const { return allocs; }
   SIZE_T GetNumDeallocs() const { return deallocs; }
-  SIZE_T GetNumReads() const { return reads;}
+  SIZE_T GetNumReads() const { return SumShards(&CacheShard::reads);}
   SIZE_T GetNumWrites() const { return writes;}
   SIZE_T GetNumDiskReads() const { return diskreads;}
   SIZE_T GetNumDiskWrites() const { return diskwrites;}
+  // Disk requests the disk writes went out in, and the simulated time 
+  // they took
+  SIZE_T GetNumDiskWriteRequests() const { return diskwritereqs;}
+  double GetWriteBackTime() const { return writebacktime;}
+  // Blocks, and requests, the background writer wrote
+  SIZE_T GetNumFlushes() const { return flushes;}
+  SIZE_T GetNumFlushRequests() const { return flushreqs;}
+  // Misses whose victim had to be written out first
+  SIZE_T GetNumDirtyEvictions() const { return dirtyevictions;}
+  SIZE_T GetNumHits() const { return SumShards(&CacheShard::hits);}
+  SIZE_T GetNumMisses() const { return SumShards(&CacheShard::misses);}
+  SIZE_T GetNumPrefetches() const { return prefetches;}
+  // Prefetched blocks that were used before they were evicted
+  SIZE_T GetNumPrefetchHits() const { return SumShards(&CacheShard::prefetchhits);}
+  // Blocks brought in by read-ahead, and how many of those were used
+  SIZE_T GetNumReadAheads() const { return readaheads;}
+  SIZE_T GetNumReadAheadHits() const { return SumShards(&CacheShard::readaheadhits);}
+  double GetReadAheadHitRate() const;
+  double GetHitRate() const;
+  const char *GetPolicyName() const { return shards[0]->policy->GetName(); }
+
+  // Tools take the cache size as "cachesize", "cachesize:policy", or
+  // "cachesize:policy:highwater,lowwater", eg, 1000:arc or 1000:lru:0.5,0.25
+  // The watermarks are 0 if not given.
+  // Gives ERROR_BADCONFIG if it makes no sense.
+  static ERROR_T ParseCacheSpec(const char *spec, SIZE_T &cachesize, string &policy,
+				double &highwater, double &lowwater);
 
   ostream & Print(ostream &os) const;
   
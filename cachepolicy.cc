@@ -0,0 +1,588 @@
+#include <string.h>
+
+#include "cachepolicy.h"
+
+
+// Which list a frame is on, for the policies that have more than one
+#define QUEUE_NONE 0
+#define QUEUE_A1IN 1
+#define QUEUE_AM   2
+#define QUEUE_T1   3
+#define QUEUE_T2   4
+
+
+CacheFrame::CacheFrame() : 
+  blocknum(0), prev(0), next(0), loading(false), flushing(false), prefetched(false), readahead(false),
+  ready(0),
+  queue(QUEUE_NONE), referenced(false)
+{
+  for (SIZE_T i=0;i<BUFFERCACHE_LRUK_K;i++) {
+    history[i]=0;
+  }
+}
+
+
+void CacheFrame::Reset(const SIZE_T b)
+{
+  blocknum=b;
+  prev=next=0;
+  loading=flushing=prefetched=readahead=false;
+  ready=0;
+  queue=QUEUE_NONE;
+  referenced=false;
+  for (SIZE_T i=0;i<BUFFERCACHE_LRUK_K;i++) {
+    history[i]=0;
+  }
+  block.lastaccessed=-1;
+  block.dirty=false;
+  block.pincount=0;
+}
+
+
+FrameList::FrameList() : size(0)
+{
+  head.prev=head.next=&head;
+}
+
+void FrameList::Clear()
+{
+  head.prev=head.next=&head;
+  size=0;
+}
+
+void FrameList::PushFront(CacheFrame *f)
+{
+  f->prev=&head;
+  f->next=head.next;
+  head.next->prev=f;
+  head.next=f;
+  size++;
+}
+
+void FrameList::Remove(CacheFrame *f)
+{
+  f->prev->next=f->next;
+  f->next->prev=f->prev;
+  f->prev=f->next=0;
+  size--;
+}
+
+CacheFrame *FrameList::OldestUnpinned() const
+{
+  for (CacheFrame *f=head.prev; f!=&head; f=f->prev) {
+    if (f->block.pincount==0) {
+      return f;
+    }
+  }
+  return 0;
+}
+
+
+FrameTable::FrameTable() : count(0)
+{
+  Init(0);
+}
+
+SIZE_T FrameTable::Home(const SIZE_T blocknum) const
+{
+  // Fibonacci hashing, so runs of block numbers don't cluster
+  return (SIZE_T)(((unsigned long long)blocknum*0x9E3779B97F4A7C15ULL)>>32) & (slots.size()-1);
+}
+
+void FrameTable::Init(const SIZE_T n)
+{
+  SIZE_T cap=16;
+
+  while (cap<2*n) {
+    cap*=2;
+  }
+  slots.assign(cap,(CacheFrame *)0);
+  count=0;
+}
+
+void FrameTable::Clear()
+{
+  slots.assign(slots.size(),(CacheFrame *)0);
+  count=0;
+}
+
+void FrameTable::Grow()
+{
+  vector<CacheFrame *> old;
+
+  old.swap(slots);
+  slots.assign(2*old.size(),(CacheFrame *)0);
+  count=0;
+  for (SIZE_T i=0;i<old.size();i++) {
+    if (old[i]) {
+      Insert(old[i]);
+    }
+  }
+}
+
+CacheFrame *FrameTable::Find(const SIZE_T blocknum) const
+{
+  SIZE_T mask=slots.size()-1;
+
+  for (SIZE_T i=Home(blocknum); slots[i]; i=(i+1)&mask) {
+    if (slots[i]->blocknum==blocknum) {
+      return slots[i];
+    }
+  }
+  return 0;
+}
+
+void FrameTable::Insert(CacheFrame *f)
+{
+  if (2*(count+1)>slots.size()) {
+    Grow();
+  }
+
+  SIZE_T mask=slots.size()-1;
+  SIZE_T i;
+
+  for (i=Home(f->blocknum); slots[i]; i=(i+1)&mask) {
+  }
+  slots[i]=f;
+  count++;
+}
+
+void FrameTable::Erase(const SIZE_T blocknum)
+{
+  SIZE_T mask=slots.size()-1;
+  SIZE_T i, j;
+
+  for (i=Home(blocknum); slots[i] && slots[i]->blocknum!=blocknum; i=(i+1)&mask) {
+  }
+  if (!slots[i]) {
+    return;
+  }
+  slots[i]=0;
+  count--;
+
+  // Pull back anything after the hole that can't be found past it 
+  // any more, so lookups can still stop at the first empty slot
+  for (j=(i+1)&mask; slots[j]; j=(j+1)&mask) {
+    SIZE_T h=Home(slots[j]->blocknum);
+    // It is fine where it is if its home is cyclically in (i,j]
+    if (i<=j ? (i<h && h<=j) : (i<h || h<=j)) {
+      continue;
+    }
+    slots[i]=slots[j];
+    slots[j]=0;
+    i=j;
+  }
+}
+
+
+void GhostList::Clear()
+{
+  order.clear();
+  where.clear();
+}
+
+bool GhostList::Contains(const SIZE_T blocknum) const
+{
+  return where.find(blocknum)!=where.end();
+}
+
+void GhostList::PushFront(const SIZE_T blocknum)
+{
+  Remove(blocknum);
+  order.push_front(blocknum);
+  where[blocknum]=order.begin();
+}
+
+bool GhostList::Remove(const SIZE_T blocknum)
+{
+  unordered_map<SIZE_T, list<SIZE_T>::iterator>::iterator i=where.find(blocknum);
+
+  if (i==where.end()) {
+    return false;
+  }
+  order.erase((*i).second);
+  where.erase(i);
+  return true;
+}
+
+SIZE_T GhostList::PopBack()
+{
+  SIZE_T blocknum=order.back();
+
+  where.erase(blocknum);
+  order.pop_back();
+  return blocknum;
+}
+
+
+ReplacementPolicy *ReplacementPolicy::Create(const char *name, const SIZE_T cachesize)
+{
+  if (!strcmp(name,"lru")) {
+    return new LRUPolicy;
+  } else if (!strcmp(name,"clock")) {
+    return new ClockPolicy;
+  } else if (!strcmp(name,"2q")) {
+    return new TwoQPolicy(cachesize);
+  } else if (!strcmp(name,"arc")) {
+    return new ARCPolicy(cachesize);
+  } else if (!strcmp(name,"lruk")) {
+    return new LRUKPolicy(cachesize);
+  } else {
+    return 0;
+  }
+}
+
+
+//
+// LRU
+//
+void LRUPolicy::Clear()
+{
+  frames.Clear();
+}
+
+void LRUPolicy::Hit(CacheFrame *f)
+{
+  frames.Remove(f);
+  frames.PushFront(f);
+}
+
+CacheFrame *LRUPolicy::Victim()
+{
+  return frames.OldestUnpinned();
+}
+
+void LRUPolicy::Insert(CacheFrame *f)
+{
+  frames.PushFront(f);
+}
+
+void LRUPolicy::Remove(CacheFrame *f)
+{
+  frames.Remove(f);
+}
+
+
+//
+// CLOCK
+//
+ClockPolicy::ClockPolicy() : hand(0)
+{}
+
+void ClockPolicy::Clear()
+{
+  ring.Clear();
+  hand=0;
+}
+
+void ClockPolicy::Hit(CacheFrame *f)
+{
+  f->referenced=true;
+}
+
+CacheFrame *ClockPolicy::Victim()
+{
+  // Two trips around clear every bit, so if we still have nothing
+  // then everything is pinned
+  for (SIZE_T i=0; hand && i<=2*ring.size; i++) {
+    CacheFrame *f=hand;
+    hand = (f->next==&ring.head ? ring.head.next : f->next);
+    if (f->block.pincount>0) {
+      continue;
+    }
+    if (f->referenced) {
+      f->referenced=false;
+      continue;
+    }
+    return f;
+  }
+  return 0;
+}
+
+void ClockPolicy::Insert(CacheFrame *f)
+{
+  f->referenced=true;
+  if (!hand) {
+    ring.PushFront(f);
+    hand=f;
+  } else {
+    // just behind the hand, so it is the last one looked at
+    f->prev=hand->prev;
+    f->next=hand;
+    hand->prev->next=f;
+    hand->prev=f;
+    ring.size++;
+  }
+}
+
+void ClockPolicy::Remove(CacheFrame *f)
+{
+  if (hand==f) {
+    hand = (ring.size==1 ? 0 : f->next==&ring.head ? ring.head.next : f->next);
+  }
+  ring.Remove(f);
+}
+
+
+//
+// 2Q
+// The sizes are the ones the paper suggests: a1in gets a quarter of
+// the cache, and a1out remembers half a cache worth of blocks
+//
+TwoQPolicy::TwoQPolicy(const SIZE_T cachesize) :
+  kin(cachesize/4 > 0 ? cachesize/4 : 1),
+  kout(cachesize/2 > 0 ? cachesize/2 : 1),
+  promote(false)
+{}
+
+void TwoQPolicy::Clear()
+{
+  a1in.Clear();
+  am.Clear();
+  a1out.Clear();
+  promote=false;
+}
+
+void TwoQPolicy::Hit(CacheFrame *f)
+{
+  // A hit while on a1in is treated as correlated and ignored
+  if (f->queue==QUEUE_AM) {
+    am.Remove(f);
+    am.PushFront(f);
+  }
+}
+
+void TwoQPolicy::Miss(const SIZE_T blocknum)
+{
+  // It leaves a1out when it actually comes in
+  promote=a1out.Contains(blocknum);
+}
+
+void TwoQPolicy::Cancel()
+{
+  promote=false;
+}
+
+CacheFrame *TwoQPolicy::Victim()
+{
+  CacheFrame *f=0;
+
+  if (a1in.size>kin || am.size==0) {
+    f=a1in.OldestUnpinned();
+  }
+  if (!f) {
+    f=am.OldestUnpinned();
+  }
+  if (!f) {
+    f=a1in.OldestUnpinned();
+  }
+  return f;
+}
+
+void TwoQPolicy::Insert(CacheFrame *f)
+{
+  if (promote) {
+    a1out.Remove(f->blocknum);
+    f->queue=QUEUE_AM;
+    am.PushFront(f);
+  } else {
+    f->queue=QUEUE_A1IN;
+    a1in.PushFront(f);
+  }
+  promote=false;
+}
+
+void TwoQPolicy::Remove(CacheFrame *f)
+{
+  if (f->queue==QUEUE_A1IN) {
+    a1in.Remove(f);
+    a1out.PushFront(f->blocknum);
+    // The block coming in is still remembered until it arrives
+    while (a1out.Size()>kout+(promote ? 1 : 0)) {
+      a1out.PopBack();
+    }
+  } else {
+    am.Remove(f);
+  }
+  f->queue=QUEUE_NONE;
+}
+
+
+//
+// ARC
+//
+ARCPolicy::ARCPolicy(const SIZE_T cachesize) :
+  c(cachesize), p(0), missp(0), inb1(false), inb2(false)
+{}
+
+void ARCPolicy::Clear()
+{
+  t1.Clear();
+  t2.Clear();
+  b1.Clear();
+  b2.Clear();
+  p=missp=0;
+  inb1=inb2=false;
+}
+
+void ARCPolicy::Hit(CacheFrame *f)
+{
+  if (f->queue==QUEUE_T1) {
+    t1.Remove(f);
+  } else {
+    t2.Remove(f);
+  }
+  f->queue=QUEUE_T2;
+  t2.PushFront(f);
+}
+
+void ARCPolicy::Miss(const SIZE_T blocknum)
+{
+  double delta;
+
+  inb1=b1.Contains(blocknum);
+  inb2=b2.Contains(blocknum);
+  missp=p;
+
+  if (inb1) {
+    // t1 would have kept it had it been bigger
+    delta = b1.Size()>=b2.Size() ? 1 : (double)b2.Size()/b1.Size();
+    p = p+delta < c ? p+delta : c;
+  } else if (inb2) {
+    delta = b2.Size()>=b1.Size() ? 1 : (double)b1.Size()/b2.Size();
+    p = p-delta > 0 ? p-delta : 0;
+  }
+}
+
+void ARCPolicy::Cancel()
+{
+  p=missp;
+  inb1=inb2=false;
+}
+
+CacheFrame *ARCPolicy::Victim()
+{
+  CacheFrame *f=0;
+
+  if (t1.size>0 && (t1.size>p || (inb2 && t1.size==p))) {
+    f=t1.OldestUnpinned();
+  }
+  if (!f) {
+    f=t2.OldestUnpinned();
+  }
+  if (!f) {
+    f=t1.OldestUnpinned();
+  }
+  return f;
+}
+
+void ARCPolicy::Insert(CacheFrame *f)
+{
+  if (inb1 || inb2) {
+    b1.Remove(f->blocknum);
+    b2.Remove(f->blocknum);
+    f->queue=QUEUE_T2;
+    t2.PushFront(f);
+  } else {
+    f->queue=QUEUE_T1;
+    t1.PushFront(f);
+  }
+  inb1=inb2=false;
+
+  // The directory holds at most c blocks seen once, and 2c in all
+  while (t1.size+b1.Size()>c && b1.Size()>0) {
+    b1.PopBack();
+  }
+  while (t1.size+t2.size+b1.Size()+b2.Size()>2*c && b2.Size()>0) {
+    b2.PopBack();
+  }
+}
+
+void ARCPolicy::Remove(CacheFrame *f)
+{
+  if (f->queue==QUEUE_T1) {
+    t1.Remove(f);
+    b1.PushFront(f->blocknum);
+  } else {
+    t2.Remove(f);
+    b2.PushFront(f->blocknum);
+  }
+  f->queue=QUEUE_NONE;
+}
+
+
+//
+// LRU-K
+//
+bool LRUKPolicy::HistoryOrder::operator()(const CacheFrame *a, const CacheFrame *b) const
+{
+  if (a->history[BUFFERCACHE_LRUK_K-1]!=b->history[BUFFERCACHE_LRUK_K-1]) {
+    return a->history[BUFFERCACHE_LRUK_K-1]<b->history[BUFFERCACHE_LRUK_K-1];
+  }
+  if (a->history[0]!=b->history[0]) {
+    return a->history[0]<b->history[0];
+  }
+  return a->blocknum<b->blocknum;
+}
+
+LRUKPolicy::LRUKPolicy(const SIZE_T cachesize) : maxretained(cachesize), clock(0)
+{}
+
+void LRUKPolicy::Clear()
+{
+  frames.clear();
+  retained.clear();
+  retainedorder.Clear();
+  clock=0;
+}
+
+void LRUKPolicy::Reference(CacheFrame *f)
+{
+  for (SIZE_T i=BUFFERCACHE_LRUK_K-1;i>0;i--) {
+    f->history[i]=f->history[i-1];
+  }
+  f->history[0]=++clock;
+}
+
+void LRUKPolicy::Hit(CacheFrame *f)
+{
+  // The history is the sort key, so take it out while it changes
+  frames.erase(f);
+  Reference(f);
+  frames.insert(f);
+}
+
+CacheFrame *LRUKPolicy::Victim()
+{
+  for (set<CacheFrame *, HistoryOrder>::iterator i=frames.begin(); i!=frames.end(); ++i) {
+    if ((*i)->block.pincount==0) {
+      return *i;
+    }
+  }
+  return 0;
+}
+
+void LRUKPolicy::Insert(CacheFrame *f)
+{
+  unordered_map<SIZE_T, History>::iterator h=retained.find(f->blocknum);
+
+  if (h!=retained.end()) {
+    memcpy(f->history,(*h).second.t,sizeof(f->history));
+    retained.erase(h);
+    retainedorder.Remove(f->blocknum);
+  } else {
+    memset(f->history,0,sizeof(f->history));
+  }
+  Reference(f);
+  frames.insert(f);
+}
+
+void LRUKPolicy::Remove(CacheFrame *f)
+{
+  frames.erase(f);
+  memcpy(retained[f->blocknum].t,f->history,sizeof(f->history));
+  retainedorder.PushFront(f->blocknum);
+  while (retainedorder.Size()>maxretained) {
+    retained.erase(retainedorder.PopBack());
+  }
+}
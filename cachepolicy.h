@@ -0,0 +1,256 @@
+#ifndef _cachepolicy
+#define _cachepolicy
+
+#include <list>
+#include <set>
+#include <vector>
+#include <unordered_map>
+
+#include "global.h"
+#include "block.h"
+
+using namespace std;
+
+// Number of past references LRU-K remembers per block
+#define BUFFERCACHE_LRUK_K 2
+
+//
+// A cached block, as seen by the buffer cache and its replacement policy
+// The list links are intrusive so that moving a frame around never
+// allocates.  The remaining fields belong to whichever policy is in use.
+//
+struct CacheFrame {
+  SIZE_T      blocknum;
+  Block       block;
+  CacheFrame *prev;   // toward the front (most recently used) of its list
+  CacheFrame *next;   // toward the back (least recently used) of its list
+  bool        loading;      // a prefetch is still reading it in
+  bool        flushing;     // the background writer is still writing it out
+  bool        prefetched;   // brought in by a prefetch and not used yet
+  bool        readahead;    // brought in by read-ahead and not used yet
+  double      ready;        // simulated time its data arrives
+  int         queue;        // which of the policy's lists it is on
+  bool        referenced;   // CLOCK
+  unsigned long history[BUFFERCACHE_LRUK_K]; // LRU-K, newest first, 0=never
+
+  CacheFrame();
+
+  // Back to how a new frame starts out, for blocknum, keeping the data
+  void Reset(const SIZE_T blocknum);
+};
+
+
+//
+// A doubly linked list of frames, newest at the front
+//
+struct FrameList {
+  CacheFrame head;   // sentinel: head.next is the front, head.prev the back
+  SIZE_T     size;
+
+  FrameList();
+
+  void        Clear();
+  void        PushFront(CacheFrame *f);
+  void        Remove(CacheFrame *f);
+  // The frame furthest back that nobody has pinned, 0 if there is none
+  CacheFrame *OldestUnpinned() const;
+};
+
+
+//
+// Finds a cached frame by block number
+// Open addressing with linear probing, so once it has been sized for
+// the frames it will hold, inserting and erasing never allocate.  It
+// only grows if it gets more than half full.
+//
+class FrameTable {
+ private:
+  vector<CacheFrame *> slots;   // 0 for an empty slot
+  SIZE_T count;
+
+  SIZE_T Home(const SIZE_T blocknum) const;
+  void   Grow();
+ public:
+  FrameTable();
+
+  // Sizes it for n frames and empties it
+  void        Init(const SIZE_T n);
+  void        Clear();
+  SIZE_T      Size() const { return count; }
+  // 0 if the block isn't there
+  CacheFrame *Find(const SIZE_T blocknum) const;
+  // f->blocknum must not be there yet
+  void        Insert(CacheFrame *f);
+  void        Erase(const SIZE_T blocknum);
+  // For walking the whole table.  Empty slots are 0.
+  SIZE_T      Capacity() const { return slots.size(); }
+  CacheFrame *Slot(const SIZE_T i) const { return slots[i]; }
+};
+
+
+//
+// A list of block numbers that are no longer cached (ghost entries)
+// Used by the policies that learn from what they recently threw out
+//
+class GhostList {
+ private:
+  list<SIZE_T> order;   // newest at the front
+  unordered_map<SIZE_T, list<SIZE_T>::iterator> where;
+ public:
+  void   Clear();
+  SIZE_T Size() const { return order.size(); }
+  bool   Contains(const SIZE_T blocknum) const;
+  void   PushFront(const SIZE_T blocknum);
+  bool   Remove(const SIZE_T blocknum);
+  // Gives the block number it dropped
+  SIZE_T PopBack();
+};
+
+
+//
+// What the buffer cache asks of a replacement policy
+//
+// For each access the cache calls exactly one of:
+//   Hit(f)          f was already cached
+//   Miss(blocknum)  blocknum is about to be brought in.  Then, if the
+//                   cache is full, Victim() and Remove() of the victim,
+//                   and finally Insert() of the new frame.  If no frame
+//                   can be had for it after all, Cancel() instead of 
+//                   Insert() forgets the Miss.
+// Remove is also called when a block leaves the cache for other reasons
+// (FlushBlock).  Victim must never choose a pinned frame.
+//
+class ReplacementPolicy {
+ public:
+  virtual ~ReplacementPolicy() {}
+
+  virtual const char *GetName() const = 0;
+  virtual void        Clear() = 0;
+  virtual void        Hit(CacheFrame *f) = 0;
+  virtual void        Miss(const SIZE_T blocknum) {}
+  virtual void        Cancel() {}
+  virtual CacheFrame *Victim() = 0;
+  virtual void        Insert(CacheFrame *f) = 0;
+  virtual void        Remove(CacheFrame *f) = 0;
+
+  // Gives 0 if there is no policy by that name
+  // The names are lru, clock, 2q, arc, and lruk
+  static ReplacementPolicy *Create(const char *name, const SIZE_T cachesize);
+};
+
+
+// Least recently used
+class LRUPolicy : public ReplacementPolicy {
+ private:
+  FrameList frames;
+ public:
+  const char *GetName() const { return "lru"; }
+  void        Clear();
+  void        Hit(CacheFrame *f);
+  CacheFrame *Victim();
+  void        Insert(CacheFrame *f);
+  void        Remove(CacheFrame *f);
+};
+
+
+// Second chance: the hand clears reference bits until it finds one clear
+class ClockPolicy : public ReplacementPolicy {
+ private:
+  FrameList   ring;   // the hand sweeps from the front to the back
+  CacheFrame *hand;
+ public:
+  ClockPolicy();
+  const char *GetName() const { return "clock"; }
+  void        Clear();
+  void        Hit(CacheFrame *f);
+  CacheFrame *Victim();
+  void        Insert(CacheFrame *f);
+  void        Remove(CacheFrame *f);
+};
+
+
+//
+// 2Q (Johnson and Shasha)
+// New blocks go on a FIFO (a1in).  Only blocks that are referenced
+// again after falling out of it (they are remembered in a1out) make it
+// to the main LRU list (am), so a single scan can't flush am.
+//
+class TwoQPolicy : public ReplacementPolicy {
+ private:
+  FrameList a1in, am;
+  GhostList a1out;
+  SIZE_T    kin, kout;
+  bool      promote;   // the block coming in was found in a1out
+ public:
+  TwoQPolicy(const SIZE_T cachesize);
+  const char *GetName() const { return "2q"; }
+  void        Clear();
+  void        Hit(CacheFrame *f);
+  void        Miss(const SIZE_T blocknum);
+  void        Cancel();
+  CacheFrame *Victim();
+  void        Insert(CacheFrame *f);
+  void        Remove(CacheFrame *f);
+};
+
+
+//
+// Adaptive Replacement Cache (Megiddo and Modha)
+// t1 holds blocks seen once recently, t2 blocks seen at least twice.
+// b1 and b2 remember what was thrown out of each, and hits on them
+// move the target size p of t1 toward whichever side is doing better.
+//
+class ARCPolicy : public ReplacementPolicy {
+ private:
+  FrameList t1, t2;
+  GhostList b1, b2;
+  SIZE_T    c;
+  double    p;
+  double    missp;        // p before the block coming in adapted it
+  bool      inb1, inb2;   // where the block coming in was found
+ public:
+  ARCPolicy(const SIZE_T cachesize);
+  const char *GetName() const { return "arc"; }
+  void        Clear();
+  void        Hit(CacheFrame *f);
+  void        Miss(const SIZE_T blocknum);
+  void        Cancel();
+  CacheFrame *Victim();
+  void        Insert(CacheFrame *f);
+  void        Remove(CacheFrame *f);
+};
+
+
+//
+// LRU-K (O'Neil, O'Neil and Weikum)
+// Evicts the block whose Kth most recent reference is oldest.  Blocks
+// seen fewer than K times go first, oldest last reference first.
+// History is kept for a while after a block leaves the cache.
+//
+class LRUKPolicy : public ReplacementPolicy {
+ private:
+  struct HistoryOrder {
+    bool operator()(const CacheFrame *a, const CacheFrame *b) const;
+  };
+  struct History {
+    unsigned long t[BUFFERCACHE_LRUK_K];
+  };
+  set<CacheFrame *, HistoryOrder> frames;
+  unordered_map<SIZE_T, History> retained;  // history of departed blocks
+  GhostList retainedorder;
+  SIZE_T    maxretained;
+  unsigned long clock;
+
+  void        Reference(CacheFrame *f);
+ public:
+  LRUKPolicy(const SIZE_T cachesize);
+  const char *GetName() const { return "lruk"; }
+  void        Clear();
+  void        Hit(CacheFrame *f);
+  CacheFrame *Victim();
+  void        Insert(CacheFrame *f);
+  void        Remove(CacheFrame *f);
+};
+
+
+#endif
@@ -427,20 +427,53 @@ ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
 
   reqtime=ModelAccess(inoffblock,numblock);
 
+  // Make room for all of them first so each is read in place
+  SIZE_T first=blocks.size();
+  blocks.resize(first+numblock);
+
   for (SIZE_T i=0;i<numblock;i++) { 
-    Block b(blocksize);
-    if (!IsBlockAllocated(inoffblock+i)) { 
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
-      }
+    ERROR_T rc=ReadInto(inoffblock+i,blocks[first+i]);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::ReadInto(const SIZE_T blocknum, Block &b)
+{
+  if (!IsBlockAllocated(blocknum)) { 
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+      cerr <<"DiskSystem::Read: reading unallocated block "<<blocknum<<endl;
     }
-    if (myread(datafilefd,offset+(inoffblock+i)*blocksize,b.data,blocksize,true)!=blocksize) { 
-      cerr << "DiskSystem::Read: myread has failed"<<endl;
-      return ERROR_IMPLBUG;
+  }
+  return Fetch(blocknum,b);
+}
+
+double DiskSystem::Charge(const SIZE_T inoffblock, const SIZE_T numblock)
+{
+  return ModelAccess(inoffblock,numblock);
+}
+
+ERROR_T DiskSystem::Fetch(const SIZE_T blocknum, Block &b)
+{
+  if (blocknum >= numblocks) { 
+    cerr << "DiskSystem::Fetch: Attempt to read block "<<blocknum<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+  if (b.length!=blocksize) { 
+    if (b.Resize(blocksize,false)!=ERROR_NOERROR) { 
+      return ERROR_NOMEM;
     }
-    blocks.push_back(b);
   }
 
+  lock_guard<mutex> l(datafilelock);
+
+  if (myread(datafilefd,offset+blocknum*blocksize,b.data,blocksize,true)!=blocksize) { 
+    cerr << "DiskSystem::Read: myread has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
   return ERROR_NOERROR;
 }
 
@@ -464,29 +497,44 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
 	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (mywrite(datafilefd,offset+(inoffblock+i)*blocksize,blocks[i].data,blocksize)!=blocksize) {  
-      cerr << "DiskSystem::Write: mywrite has failed"<<endl;
-      return ERROR_IMPLBUG;
+    ERROR_T rc=Store(inoffblock+i,blocks[i]);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
     }
   }
 
   return ERROR_NOERROR;
 }
 
+ERROR_T DiskSystem::Store(const SIZE_T blocknum, const Block &b)
+{
+  if (blocknum >= numblocks) { 
+    cerr << "DiskSystem::Store: Attempt to write block "<<blocknum<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  lock_guard<mutex> l(datafilelock);
+
+  if (mywrite(datafilefd,offset+blocknum*blocksize,b.data,blocksize)!=blocksize) {  
+    cerr << "DiskSystem::Write: mywrite has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
 
 ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime)
 {
-  vector<Block> bl;
-
-  ERROR_T rc = Read(inoffblock,1,bl,reqtime);
+  reqtime=0;
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+  if (inoffblock >= numblocks) { 
+    cerr << "DiskSystem::Read: Attempt to read block "<<inoffblock<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
   }
 
-  blocks = bl[0];
+  reqtime=ModelAccess(inoffblock,1);
 
-  return ERROR_NOERROR;
+  return ReadInto(inoffblock,blocks);
 }
 
 ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
@@ -4,6 +4,7 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <mutex>
 
 #include "global.h"
 #include "block.h"
@@ -41,6 +42,10 @@ class DiskSystem {
   double trackseeklatency;
   double rotationallatency;
 
+  // Serializes use of the data file, which the buffer cache's
+  // prefetch thread shares with everyone else
+  mutex  datafilelock;
+
  protected:
   virtual double ModelAccess(const SIZE_T off, const SIZE_T num);
 
@@ -50,6 +55,8 @@ class DiskSystem {
   ERROR_T ReadConfig();
   ERROR_T WriteConfig();
   ERROR_T ReadBitMap();
+  // Reads one block straight into b, resizing it only if it is the wrong size
+  ERROR_T ReadInto(const SIZE_T blocknum, Block &b);
   ERROR_T WriteBitMap();
   
    
@@ -94,6 +101,15 @@ class DiskSystem {
 		const Block &blocks,
 		double &reqtime);
 
+  // Asynchronous I/O comes in two halves.  Charge models the access 
+  // when it is issued, so the model sees requests in issue order, and 
+  // returns its time.  Fetch and Store move the data later, from any 
+  // thread, and charge nothing.  Read is a Charge and a Fetch together,
+  // and Write is a Charge and a Store.
+  double  Charge(const SIZE_T inoffblock, const SIZE_T numblock);
+  ERROR_T Fetch(const SIZE_T inoffblock, Block &block);
+  ERROR_T Store(const SIZE_T inoffblock, const Block &block);
+
   SIZE_T GetBlockSize() const;
   SIZE_T GetNumBlocks() const;
 
@@ -6,7 +6,7 @@
 
 void usage() 
 {
-  cerr << "usage: freebuffer cachesize filestem blocknum numblocks\n";
+  cerr << "usage: freebuffer cachesize[:policy[:high,low]] filestem blocknum numblocks\n";
 }
 
 int main(int argc, char *argv[])
@@ -15,12 +15,18 @@ int main(int argc, char *argv[])
     usage();
     exit(-1);
   }
-  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    exit(-1);
+  }
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
 
   DiskSystem disk(argv[1]);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
 
   cache.Attach();
 
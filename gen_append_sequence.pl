@@ -0,0 +1,45 @@
+#!/usr/bin/perl -w
+
+$#ARGV>=3 or die "usage: gen_append_sequence.pl keysize valsize seed num [lookupfraction]\n";
+
+($keysize,$valuesize,$seed,$num,$lookupfraction)=@ARGV;
+
+$lookupfraction=0 if (!defined $lookupfraction);
+
+srand $seed;
+
+$valuebytes="abcdefghijklmnopqrstuvwxyz0123456789";
+
+#
+# Keys are increasing decimal numbers, zero padded to keysize, with
+# random gaps between them, so every insert is of a key larger than
+# any before it, as with timestamps or sequence numbers
+#
+$maxstep=3;
+$num*$maxstep < 10**$keysize or die "keysize $keysize is too small for $num keys\n";
+
+$next=0;
+@keys=();
+%content=();
+
+print "INIT $keysize $valuesize\n";
+
+for ($i=1;$i<$num;$i++) {
+  if (@keys>0 && rand() < $lookupfraction) {
+    my $key=$keys[int(rand($#keys+1))];
+    print "LOOKUP $key  # should succeed and return $content{$key}\n";
+  } else {
+    $next+=1+int(rand($maxstep));
+    my ($key, $value) = (sprintf("%0${keysize}d",$next), MakeValue());
+    push @keys, $key;
+    $content{$key}=$value;
+    print "INSERT $key $value  # should succeed\n";
+  }
+}
+
+print "DEINIT\n";
+
+
+sub MakeValue {
+  return join("", map { substr($valuebytes,int(rand(length($valuebytes))),1) } (1..$valuesize));
+}
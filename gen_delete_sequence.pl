@@ -0,0 +1,76 @@
+#!/usr/bin/perl -w
+
+$#ARGV>=3 or die "usage: gen_delete_sequence.pl keysize valsize seed num [deletefraction [compact]]\n";
+
+($keysize,$valuesize,$seed,$num,$deletefraction,$compact)=@ARGV;
+
+$deletefraction=0.5 if (!defined $deletefraction);
+$compact=0 if (!defined $compact);
+
+srand $seed;
+
+$keybytes="abcdefghijklmnopqrstuvwxyz0123456789";
+$valuebytes="abcdefghijklmnopqrstuvwxyz0123456789";
+
+#
+# The first half of the requests fill the tree with random keys.  In
+# the second half, deletefraction of the requests delete a random key
+# that is in, and the rest insert new keys or look up keys that are in,
+# so the tree shrinks when deletefraction is over a half.  With compact,
+# a COMPACT comes just before the end.
+#
+%content=();
+@keys=();
+
+print "INIT $keysize $valuesize\n";
+
+for ($i=1;$i<$num;$i++) {
+  if ($i<$num/2 || @keys==0) {
+    print gen_insert_new(), "\n";
+  } elsif (rand() < $deletefraction) {
+    print gen_delete_exists(), "\n";
+  } elsif (rand() < 0.8) {
+    print gen_insert_new(), "\n";
+  } else {
+    print gen_lookup_exists(), "\n";
+  }
+}
+
+print "COMPACT\n" if ($compact);
+print "DEINIT\n";
+
+
+sub MakeBytes {
+  my ($bytes,$n)=@_;
+  return join("", map { substr($bytes,int(rand(length($bytes))),1) } (1..$n));
+}
+
+sub MakeNonExistentKey {
+  my $key;
+  do {
+    $key=MakeBytes($keybytes,$keysize);
+  } while (defined $content{$key});
+  return $key;
+}
+
+
+sub gen_insert_new {
+  my ($key, $value) = (MakeNonExistentKey(), MakeBytes($valuebytes,$valuesize));
+  $content{$key}=$value;
+  push @keys, $key;
+  return "INSERT $key $value  # should succeed";
+}
+
+sub gen_delete_exists {
+  my $j=int(rand($#keys+1));
+  my $key=$keys[$j];
+  $keys[$j]=$keys[$#keys];
+  pop @keys;
+  delete $content{$key};
+  return "DELETE $key  # should succeed";
+}
+
+sub gen_lookup_exists {
+  my $key=$keys[int(rand($#keys+1))];
+  return "LOOKUP $key  # should succeed and return $content{$key}";
+}
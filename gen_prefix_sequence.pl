@@ -0,0 +1,90 @@
+#!/usr/bin/perl -w
+
+$#ARGV>=3 or die "usage: gen_prefix_sequence.pl keysize valsize seed num [numprefixes [prefixsize]]\n";
+
+($keysize,$valuesize,$seed,$num,$numprefixes,$prefixsize)=@ARGV;
+
+$numprefixes=4 if (!defined $numprefixes);
+$prefixsize=int($keysize*3/4) if (!defined $prefixsize);
+$prefixsize<$keysize or die "prefixsize must be less than keysize\n";
+
+srand $seed;
+
+$keybytes="abcdefghijklmnopqrstuvwxyz0123456789";
+$valuebytes="abcdefghijklmnopqrstuvwxyz0123456789";
+
+#
+# Keys are one of a few prefixes (think tenant and date) followed by
+# random bytes, so keys that sort near each other share a long prefix.
+# Mostly inserts, with some lookups and updates of keys already in.
+#
+@prefixes=map { MakeBytes($keybytes,$prefixsize) } (1..$numprefixes);
+
+@ops = ( [60, \&gen_insert_new],
+	 [5,  \&gen_insert_exists],
+	 [10, \&gen_update_exists],
+	 [20, \&gen_lookup_exists],
+	 [5,  \&gen_lookup_new] );
+
+%content=();
+@keys=();
+
+print "INIT $keysize $valuesize\n";
+
+for ($i=1;$i<$num;$i++) {
+  my $r=rand(100);
+  my $j=0;
+  while ($j<$#ops && ($r-=$ops[$j][0])>=0) {
+    $j++;
+  }
+  # never try to do an existing key if no keys currently exist
+  $j=0 if (@keys==0);
+  print &{$ops[$j][1]}(), "\n";
+}
+
+print "DEINIT\n";
+
+
+sub MakeBytes {
+  my ($bytes,$n)=@_;
+  return join("", map { substr($bytes,int(rand(length($bytes))),1) } (1..$n));
+}
+
+sub MakeNonExistentKey {
+  my $key;
+  do {
+    $key=$prefixes[int(rand($numprefixes))].MakeBytes($keybytes,$keysize-$prefixsize);
+  } while (defined $content{$key});
+  return $key;
+}
+
+sub MakeExistentKey {
+  return $keys[int(rand($#keys+1))];
+}
+
+
+sub gen_insert_new {
+  my ($key, $value) = (MakeNonExistentKey(), MakeBytes($valuebytes,$valuesize));
+  $content{$key}=$value;
+  push @keys, $key;
+  return "INSERT $key $value  # should succeed";
+}
+
+sub gen_insert_exists {
+  return "INSERT ".MakeExistentKey()." ".MakeBytes($valuebytes,$valuesize)."  # should fail";
+}
+
+sub gen_update_exists {
+  my ($key, $value) = (MakeExistentKey(), MakeBytes($valuebytes,$valuesize));
+  $content{$key}=$value;
+  return "UPDATE $key $value  # should succeed";
+}
+
+sub gen_lookup_exists {
+  my $key=MakeExistentKey();
+  return "LOOKUP $key  # should succeed and return $content{$key}";
+}
+
+sub gen_lookup_new {
+  return "LOOKUP ".MakeNonExistentKey()."  # should fail";
+}
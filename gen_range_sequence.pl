@@ -0,0 +1,116 @@
+#!/usr/bin/perl -w
+
+$#ARGV>=3 or die "usage: gen_range_sequence.pl keysize valsize seed num [rangefraction]\n";
+
+($keysize,$valuesize,$seed,$num,$rangefraction)=@ARGV;
+
+$rangefraction=0.05 if (!defined $rangefraction);
+
+srand $seed;
+
+$valuebytes="abcdefghijklmnopqrstuvwxyz0123456789";
+
+#
+# Keys are decimal numbers, zero padded to keysize, so ranges of them
+# are easy to read.  The first third of the requests fill the tree.
+# After that, rangefraction of the requests are a DELETERANGE over up
+# to a quarter of the key space, which takes whole subtrees out, and
+# each is followed by inserts and lookups inside the range it emptied,
+# and a lookup of a key it took out.  The rest insert new keys, delete
+# keys that are in, or look them up.  A DISPLAY comes just before the
+# end.
+#
+%content=();
+@keys=();
+
+$digits=$keysize<9 ? $keysize : 9;
+$keyspace=10**$digits;
+
+print "INIT $keysize $valuesize\n";
+
+for ($i=1;$i<$num;$i++) {
+  if ($i<$num/3 || @keys==0) {
+    print gen_insert_new(0,$keyspace-1), "\n";
+  } elsif (rand() < $rangefraction) {
+    my $lo=int(rand($keyspace));
+    my $hi=$lo+int(rand($keyspace/4));
+    $hi=$keyspace-1 if ($hi>=$keyspace);
+    my @gone=gen_deleterange($lo,$hi);
+    print "DELETERANGE ", MakeKey($lo), " ", MakeKey($hi), "  # should succeed\n";
+    for (my $j=0;$j<3 && $j<$hi-$lo+1;$j++) {
+      print gen_insert_new($lo,$hi), "\n";
+      print "LOOKUP $keys[$#keys]  # should succeed and return $content{$keys[$#keys]}\n";
+      $i+=2;
+    }
+    if (@gone) {
+      my $key=$gone[int(rand($#gone+1))];
+      print "LOOKUP $key  # should fail\n" if (!defined $content{$key});
+      $i++;
+    }
+  } elsif (rand() < 0.5) {
+    print gen_insert_new(0,$keyspace-1), "\n";
+  } elsif (rand() < 0.5) {
+    print gen_delete_exists(), "\n";
+  } else {
+    print gen_lookup_exists(), "\n";
+  }
+}
+
+print "DISPLAY\n";
+print "DEINIT\n";
+
+
+sub MakeBytes {
+  my ($bytes,$n)=@_;
+  return join("", map { substr($bytes,int(rand(length($bytes))),1) } (1..$n));
+}
+
+sub MakeKey {
+  my ($n)=@_;
+  return sprintf("%0${keysize}d",$n);
+}
+
+# A key from lo to hi that isn't in the tree
+sub MakeNonExistentKey {
+  my ($lo,$hi)=@_;
+  my $key;
+  do {
+    $key=MakeKey($lo+int(rand($hi-$lo+1)));
+  } while (defined $content{$key});
+  return $key;
+}
+
+
+sub gen_insert_new {
+  my ($lo,$hi)=@_;
+  my ($key, $value) = (MakeNonExistentKey($lo,$hi), MakeBytes($valuebytes,$valuesize));
+  $content{$key}=$value;
+  push @keys, $key;
+  return "INSERT $key $value  # should succeed";
+}
+
+sub gen_delete_exists {
+  my $j=int(rand($#keys+1));
+  my $key=$keys[$j];
+  $keys[$j]=$keys[$#keys];
+  pop @keys;
+  delete $content{$key};
+  return "DELETE $key  # should succeed";
+}
+
+sub gen_lookup_exists {
+  my $key=$keys[int(rand($#keys+1))];
+  return "LOOKUP $key  # should succeed and return $content{$key}";
+}
+
+# Takes every key from lo to hi out, and gives them
+sub gen_deleterange {
+  my ($lo,$hi)=@_;
+  my ($lokey,$hikey)=(MakeKey($lo),MakeKey($hi));
+  my @gone=grep { $_ ge $lokey && $_ le $hikey } @keys;
+  @keys=grep { $_ lt $lokey || $_ gt $hikey } @keys;
+  foreach $key (@gone) {
+    delete $content{$key};
+  }
+  return @gone;
+}
@@ -0,0 +1,96 @@
+#!/usr/bin/perl -w
+
+$#ARGV>=3 or die "usage: gen_varlen_sequence.pl maxkeysize maxvalsize seed num [pad]\n";
+
+($keysize,$valuesize,$seed,$num,$pad)=@ARGV;
+
+$pad=0 if (!defined $pad);
+
+srand $seed;
+
+$keybytes="abcdefghijklmnopqrstuvwxyz0123456789";
+$valuebytes="abcdefghijklmnopqrstuvwxyz0123456789";
+
+#
+# Keys and values are anywhere from a quarter of their largest size up
+# to it, as names or urls are.  Updates change a value's length too.
+# With pad, every key and value is padded out to its largest size with
+# '_', which is what a tree with fixed size slots has to be given.
+#
+$minkeysize=int($keysize/4) || 1;
+$minvaluesize=int($valuesize/4) || 1;
+
+@ops = ( [60, \&gen_insert_new],
+	 [5,  \&gen_insert_exists],
+	 [10, \&gen_update_exists],
+	 [20, \&gen_lookup_exists],
+	 [5,  \&gen_lookup_new] );
+
+%content=();
+@keys=();
+
+print "INIT $keysize $valuesize\n";
+
+for ($i=1;$i<$num;$i++) {
+  my $r=rand(100);
+  my $j=0;
+  while ($j<$#ops && ($r-=$ops[$j][0])>=0) {
+    $j++;
+  }
+  # never try to do an existing key if no keys currently exist
+  $j=0 if (@keys==0);
+  print &{$ops[$j][1]}(), "\n";
+}
+
+print "DEINIT\n";
+
+
+sub MakeBytes {
+  my ($bytes,$min,$max)=@_;
+  my $n=$min+int(rand($max-$min+1));
+  my $s=join("", map { substr($bytes,int(rand(length($bytes))),1) } (1..$n));
+  return $pad ? $s.("_" x ($max-$n)) : $s;
+}
+
+sub MakeValue {
+  return MakeBytes($valuebytes,$minvaluesize,$valuesize);
+}
+
+sub MakeNonExistentKey {
+  my $key;
+  do {
+    $key=MakeBytes($keybytes,$minkeysize,$keysize);
+  } while (defined $content{$key});
+  return $key;
+}
+
+sub MakeExistentKey {
+  return $keys[int(rand($#keys+1))];
+}
+
+
+sub gen_insert_new {
+  my ($key, $value) = (MakeNonExistentKey(), MakeValue());
+  $content{$key}=$value;
+  push @keys, $key;
+  return "INSERT $key $value  # should succeed";
+}
+
+sub gen_insert_exists {
+  return "INSERT ".MakeExistentKey()." ".MakeValue()."  # should fail";
+}
+
+sub gen_update_exists {
+  my ($key, $value) = (MakeExistentKey(), MakeValue());
+  $content{$key}=$value;
+  return "UPDATE $key $value  # should succeed";
+}
+
+sub gen_lookup_exists {
+  my $key=MakeExistentKey();
+  return "LOOKUP $key  # should succeed and return $content{$key}";
+}
+
+sub gen_lookup_new {
+  return "LOOKUP ".MakeNonExistentKey()."  # should fail";
+}
@@ -6,7 +6,7 @@
 
 void usage() 
 {
-  cerr << "usage: readbuffer cachesize filestem blocknum numblocks > data\n";
+  cerr << "usage: readbuffer cachesize[:policy[:high,low]] filestem blocknum numblocks [stride] > data\n";
 }
 
 int main(int argc, char *argv[])
@@ -15,18 +15,25 @@ int main(int argc, char *argv[])
     usage();
     exit(-1);
   }
-  SIZE_T cachesize=atoi(argv[1]);
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  if (BufferCache::ParseCacheSpec(argv[1],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    exit(-1);
+  }
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
+  SIZE_T stride=(argc>5 ? atoi(argv[5]) : 1);
 
   DiskSystem disk(argv[2]);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
 
   SIZE_T blocksize = disk.GetBlockSize();
 
   cache.Attach();
 
-  for (unsigned i=blocknum;i<(blocknum+numblocks);i++) { 
+  for (SIZE_T i=blocknum;i<(blocknum+numblocks*stride);i+=stride) { 
     Block block(blocksize);
     ERROR_T rc;
     rc=cache.ReadBlock(i,block);
@@ -49,6 +56,13 @@ int main(int argc, char *argv[])
   cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
   cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
   cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+  cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+  cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+  cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
+  cerr << "readaheads      = "<<cache.GetNumReadAheads()<<endl;
+  cerr << "readaheadhits   = "<<cache.GetNumReadAheadHits()<<endl;
+  cerr << "readaheadrate   = "<<cache.GetReadAheadHitRate()<<endl;
   cerr << endl;
 
   cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
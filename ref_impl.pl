@@ -53,6 +53,18 @@ while ($line=<STDIN>) {
       print STDERR "Deleted ($key)\n" if $debug;
       print "OK\n";
     }
+  } elsif ($op eq "DELETERANGE") { 
+    ($lo,$hi)=split(/\s+/,$rest);
+    if (Bug()) { 
+      print STDERR "Deleting from ($lo) to ($hi) failed\n" if $debug;
+      print "FAIL\n";
+    } else {
+      foreach $key (grep { $_ ge $lo && $_ le $hi } keys %content) {
+	delete $content{$key};
+      }
+      print STDERR "Deleted from ($lo) to ($hi)\n" if $debug;
+      print "OK\n";
+    }
   } elsif ($op eq "LOOKUP") { 
     ($key)=split(/\s+/,$rest);
     if (!(defined $content{$key}) || Bug() ) { 
@@ -70,6 +82,9 @@ while ($line=<STDIN>) {
       print "($key, $content{$key})\n";
     }
     print "OK END DISPLAY\n";
+  } elsif ($op eq "COMPACT") {
+    print STDERR "Compacting, which changes no content\n" if $debug;
+    print "OK\n";
   } elsif ($op eq "DEINIT") {
     print STDERR "Got a deinit.  Finishing up now\n" if $debug;
     print "OK\n";
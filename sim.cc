@@ -11,7 +11,46 @@ using namespace std;
 
 void usage()
 {
-  cerr << "usage: sim filestem cachesize < specfile \n";
+  cerr << "usage: sim filestem cachesize[:policy[:high,low]] [insertbatchsize [residentnodes [split [format [overflow [delete]]]]]] < specfile \n";
+  cerr << "  with insertbatchsize>1, runs of consecutive INSERTs are\n";
+  cerr << "  applied together through InsertBatch\n";
+  cerr << "  residentnodes is how many interior nodes the index keeps\n";
+  cerr << "  resident (default "<<BTREE_RESIDENT_NODES<<")\n";
+  cerr << "  split is how full nodes split: even, right, or key, with an\n";
+  cerr << "  optional :fill, eg, right:0.9 (default even)\n";
+  cerr << "  format is the node format the tree is created with: plain,\n";
+  cerr << "  prefix, or slotted (default plain)\n";
+  cerr << "  overflow is the longest value kept in a leaf, longer ones go\n";
+  cerr << "  in overflow blocks (default 0, every value in its leaf)\n";
+  cerr << "  delete is what deletes do with underfull nodes: eager (merge\n";
+  cerr << "  or borrow right away) or lazy (leave them for COMPACT)\n";
+}
+
+
+// Applies the buffered inserts and prints their replies in order
+static void FlushInserts(BTreeIndex *btree, vector<KeyValuePair> &batch)
+{
+  vector<ERROR_T> results;
+  ERROR_T rc;
+
+  if (batch.size()==0) {
+    return;
+  }
+
+  rc=btree->InsertBatch(batch,&results);
+
+  for (SIZE_T i=0;i<batch.size();i++) {
+    if (rc!=ERROR_NOERROR && rc!=ERROR_CONFLICT) {
+      results[i]=rc;
+    }
+    if (results[i]!=ERROR_NOERROR) {
+      cout <<"FAIL"<<endl;
+      cerr <<"Can't insert due to error "<<results[i]<<"\n";
+    } else {
+      cout <<"OK\n";
+    }
+  }
+  batch.clear();
 }
 
 
@@ -20,27 +59,59 @@ int main(int argc, char *argv[])
 
   // CONFORMS to the interface of ref_impl.pl
 
-  if (argc != 3){
+  if (argc < 3 || argc > 9){
     usage();
     return 1;
   }
 
   char *filestem=argv[1];
-  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  SIZE_T insertbatchsize = argc>=4 ? atoi(argv[3]) : 1;
+  SIZE_T residentnodes = argc>=5 ? atoi(argv[4]) : BTREE_RESIDENT_NODES;
   SIZE_T superblocknum;
+  vector<KeyValuePair> batch;
+  vector<BTreeLevelStats> levelstats;
+  SIZE_T numappends=0;
+  BTreeSplitPolicy splitpolicy;
+  SIZE_T format=BTREE_FORMAT_PLAIN;
+  SIZE_T overflow = argc>=8 ? atoi(argv[7]) : 0;
+  BTreeStats treestats;
+  BTreeDeletePolicy deletepolicy=BTREE_DELETE_EAGER;
+  SIZE_T numdeletes=0, deletewrites=0, compactwrites=0;
+  SIZE_T numrangedeletes=0, rangedeletewrites=0;
+  SIZE_T writes;
+
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    return 1;
+  }
+  if (argc>=6 && BTreeSplitPolicy::Parse(argv[5],splitpolicy)!=ERROR_NOERROR) { 
+    usage();
+    return 1;
+  }
+  if (argc>=7 && ParseBTreeFormat(argv[6],format)!=ERROR_NOERROR) { 
+    usage();
+    return 1;
+  }
+  if (argc>=9 && ParseBTreeDeletePolicy(argv[8],deletepolicy)!=ERROR_NOERROR) { 
+    usage();
+    return 1;
+  }
 
   FILE *file; 
-  char line[1024];
-  int max = 8192;
+  char line[65536];
+  int max = sizeof(line);
   ERROR_T rc;
   
   // We'll connect to the btree only once and then
   // run lots of operations
   // so we need to do this outside the loop
   DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
   // will be set on init
-  BTreeIndex *btree;
+  BTreeIndex *btree=0;
 
 
   if ((rc=cache.Attach())!=ERROR_NOERROR) {
@@ -58,8 +129,22 @@ int main(int argc, char *argv[])
     istrstream is(line2.c_str(),line2.size());
     is >> action >> key >> value;
 
+    if (insertbatchsize>1) {
+      if (action == "INSERT") {
+        batch.push_back(KeyValuePair(KEY_T(key.c_str()),VALUE_T(value.c_str())));
+        if (batch.size()>=insertbatchsize) {
+          FlushInserts(btree,batch);
+        }
+        continue;
+      }
+      FlushInserts(btree,batch);
+    }
+
     if (action == "INIT") {
-      btree = new BTreeIndex(atoi(key.c_str()),atoi(value.c_str()),&cache);
+      btree = new BTreeIndex(atoi(key.c_str()),atoi(value.c_str()),&cache,true,format,overflow);
+      btree->SetResidentBudget(residentnodes);
+      btree->SetSplitPolicy(splitpolicy);
+      btree->SetDeletePolicy(deletepolicy);
       if ((rc=btree->Attach(0, true))!=ERROR_NOERROR) {
 	cerr << "Can't attach btree with initialization due to error "<<rc<<"\n";
 	cout << "FAIL\n";
@@ -81,9 +166,34 @@ int main(int argc, char *argv[])
         cout <<"OK\n";
       }
     } else if (action == "DELETE"){
-      if ((rc=btree->Delete(KEY_T(key.c_str())))!=ERROR_NOERROR) { 
+      writes=cache.GetNumWrites();
+      rc=btree->Delete(KEY_T(key.c_str()));
+      deletewrites+=cache.GetNumWrites()-writes;
+      if (rc!=ERROR_NOERROR) { 
         cout <<"FAIL"<<endl;
 	cerr <<"Can't delete due to error "<<rc<<endl;
+      } else {
+	numdeletes++;
+        cout <<"OK\n";
+      }
+    } else if (action == "DELETERANGE"){
+      writes=cache.GetNumWrites();
+      rc=btree->DeleteRange(KEY_T(key.c_str()),KEY_T(value.c_str()));
+      rangedeletewrites+=cache.GetNumWrites()-writes;
+      if (rc!=ERROR_NOERROR) { 
+        cout <<"FAIL"<<endl;
+	cerr <<"Can't delete range due to error "<<rc<<endl;
+      } else {
+	numrangedeletes++;
+        cout <<"OK\n";
+      }
+    } else if (action == "COMPACT"){
+      writes=cache.GetNumWrites();
+      rc=btree->Compact();
+      compactwrites+=cache.GetNumWrites()-writes;
+      if (rc!=ERROR_NOERROR) { 
+        cout <<"FAIL"<<endl;
+	cerr <<"Can't compact due to error "<<rc<<endl;
       } else {
         cout <<"OK\n";
       }
@@ -105,6 +215,7 @@ int main(int argc, char *argv[])
       btree->Display(cout,BTREE_SORTED_KEYVAL);
       cout <<"OK END DISPLAY\n";
     } else if (action == "DEINIT"){
+      btree->GetStats(treestats);
       if ((rc=btree->Detach(superblocknum))!=ERROR_NOERROR) { 
 	cout << "FAIL"<<endl;
 	cerr << "Can't detach btree due to error "<<rc<<endl;
@@ -113,15 +224,79 @@ int main(int argc, char *argv[])
 	  cout <<"FAIL"<<endl;
 	  cerr <<"Can't detach cache due to error "<<rc<<endl;
 	} else {
+	  levelstats=btree->GetLevelStats();
+	  numappends=btree->GetNumAppends();
 	  delete btree;
+	  btree=0;
 	  cout << "OK\n";
 	}
       }
     }
   }
+
+  if (insertbatchsize>1) {
+    FlushInserts(btree,batch);
+  }
     
   fclose(file);
 
+  cerr << "Performance statistics:\n";
+
+  cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+  cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+  cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+  cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+  cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+  cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "numdiskwritereqs= "<<cache.GetNumDiskWriteRequests()<<endl;
+  cerr << "writebacktime   = "<<cache.GetWriteBackTime()<<endl;
+  cerr << "flushes         = "<<cache.GetNumFlushes()<<endl;
+  cerr << "flushreqs       = "<<cache.GetNumFlushRequests()<<endl;
+  cerr << "dirtyevictions  = "<<cache.GetNumDirtyEvictions()<<endl;
+  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+  cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+  cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+  cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
+  cerr << endl;
+
+  if (btree) {
+    levelstats=btree->GetLevelStats();
+    numappends=btree->GetNumAppends();
+    btree->GetStats(treestats);
+  }
+  cerr << "split           = "<<splitpolicy.GetName()<<":"<<splitpolicy.fill<<endl;
+  cerr << "format          = "<<GetBTreeFormatName(format)<<endl;
+  cerr << "depth           = "<<treestats.depth<<endl;
+  cerr << "leaves          = "<<treestats.numleaves<<endl;
+  cerr << "interiornodes   = "<<treestats.numinterior<<endl;
+  cerr << "leafutil        = "<<treestats.GetLeafUtilization()<<endl;
+  cerr << "interiorutil    = "<<treestats.GetInteriorUtilization()<<endl;
+  cerr << "avgprefix       = "<<treestats.GetAveragePrefix()<<endl;
+  cerr << "spaceutil       = "<<treestats.GetSpaceUtilization()<<endl;
+  cerr << "overflow        = "<<overflow<<endl;
+  cerr << "overflowvalues  = "<<treestats.overflowvalues<<endl;
+  cerr << "overflowblocks  = "<<treestats.overflowblocks<<endl;
+  cerr << "appends         = "<<numappends<<endl;
+  cerr << "delete          = "<<GetBTreeDeletePolicyName(deletepolicy)<<endl;
+  cerr << "deletes         = "<<numdeletes<<endl;
+  cerr << "deletewrites    = "<<deletewrites<<endl;
+  cerr << "writesperdelete = "<<(numdeletes>0 ? (double)deletewrites/numdeletes : 0)<<endl;
+  cerr << "compactwrites   = "<<compactwrites<<endl;
+  cerr << "rangedeletes    = "<<numrangedeletes<<endl;
+  cerr << "rangewrites     = "<<rangedeletewrites<<endl;
+  cerr << endl;
+
+  cerr << "residentnodes   = "<<residentnodes<<endl;
+  for (SIZE_T d=0;d<levelstats.size();d++) {
+    SIZE_T n=levelstats[d].residenthits+levelstats[d].cachereads;
+    cerr << "level "<<d<<"         = "<<levelstats[d].residenthits<<" resident, "
+	 <<levelstats[d].cachereads<<" from cache, residentrate "
+	 <<(n>0 ? (double)levelstats[d].residenthits/n : 0)<<endl;
+  }
+  cerr << endl;
+
+  cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
   return 0;
 
 }
@@ -6,7 +6,7 @@
 
 void usage() 
 {
-  cerr << "usage: writebuffer cachesize filestem blocknum numblocks < data\n";
+  cerr << "usage: writebuffer cachesize[:policy[:high,low]] filestem blocknum numblocks < data\n";
 }
 
 int main(int argc, char *argv[])
@@ -15,12 +15,18 @@ int main(int argc, char *argv[])
     usage();
     exit(-1);
   }
-  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T cachesize;
+  string policy;
+  double highwater, lowwater;
+  if (BufferCache::ParseCacheSpec(argv[2],cachesize,policy,highwater,lowwater)!=ERROR_NOERROR) { 
+    usage();
+    exit(-1);
+  }
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
 
   DiskSystem disk(argv[1]);
-  BufferCache cache(&disk,cachesize);
+  BufferCache cache(&disk,cachesize,policy.c_str(),highwater,lowwater);
 
   SIZE_T blocksize = disk.GetBlockSize();
 
@@ -54,6 +60,10 @@ int main(int argc, char *argv[])
   cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
   cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
   cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+  cerr << "hitrate         = "<<cache.GetHitRate()<<endl;
+  cerr << "prefetches      = "<<cache.GetNumPrefetches()<<endl;
+  cerr << "prefetchhits    = "<<cache.GetNumPrefetchHits()<<endl;
   cerr << endl;
 
   cerr << "total time      = "<<cache.GetCurrentTime()<<endl;